@@ -0,0 +1,166 @@
+#include "CommandRecorder.h"
+#include "VulkanAPIHandler.h"
+
+CommandRecorder::CommandRecorder(VulkanAPIHandler* vkAPIHandler, uint32_t queueFamily, uint32_t threadCount, uint32_t framesInFlight) {
+	vulkanAPIHandler = vkAPIHandler;
+	device = vkAPIHandler->getDevice();
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamily;
+	// The pools are reset as a whole every frame
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	for (uint32_t i = 0; i < std::max(threadCount, 1u); i++) {
+		auto worker = std::make_unique<Worker>();
+		worker->commandBuffers.resize(framesInFlight);
+		worker->commandPools.reserve(framesInFlight);
+
+		for (uint32_t frame = 0; frame < framesInFlight; frame++) {
+			worker->commandPools.emplace_back(VDeleter<VkCommandPool>{ device, vkDestroyCommandPool });
+
+			if (vkCreateCommandPool(device, &poolInfo, nullptr, worker->commandPools[frame].replace()) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create recording command pool!");
+			}
+
+			VkCommandBufferAllocateInfo allocInfo = {};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = worker->commandPools[frame];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 1;
+
+			if (vkAllocateCommandBuffers(device, &allocInfo, &worker->commandBuffers[frame]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate secondary command buffer!");
+			}
+		}
+
+		workers.push_back(std::move(worker));
+	}
+
+	for (uint32_t i = 1; i < workers.size(); i++) {
+		threads.emplace_back(&CommandRecorder::workerLoop, this, i);
+	}
+}
+
+CommandRecorder::~CommandRecorder() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
+
+std::vector<VkCommandBuffer> CommandRecorder::record(uint32_t frameIndex, VkRenderPass renderPass, VkFramebuffer framebuffer, uint32_t itemCount, const RecordRangeFunction& recordRange) {
+	jobFrameIndex = frameIndex;
+	jobItemCount = itemCount;
+	jobRecordRange = &recordRange;
+	jobError = nullptr;
+
+	jobInheritance = {};
+	jobInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	jobInheritance.renderPass = renderPass;
+	jobInheritance.subpass = 0;
+	jobInheritance.framebuffer = framebuffer;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobGeneration++;
+		runningWorkers = threads.size();
+	}
+	jobAvailable.notify_all();
+
+	try {
+		recordShare(0);
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> lock(mutex);
+		jobError = std::current_exception();
+	}
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		jobFinished.wait(lock, [this] { return runningWorkers == 0; });
+	}
+
+	if (jobError) {
+		std::rethrow_exception(jobError);
+	}
+
+	std::vector<VkCommandBuffer> commandBuffers;
+	for (auto& worker : workers) {
+		commandBuffers.push_back(worker->commandBuffers[frameIndex]);
+	}
+
+	return commandBuffers;
+}
+
+uint32_t CommandRecorder::getThreadCount() {
+	return workers.size();
+}
+
+void CommandRecorder::workerLoop(uint32_t workerIndex) {
+	uint64_t finishedGeneration = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			jobAvailable.wait(lock, [this, finishedGeneration] { return stopping || jobGeneration != finishedGeneration; });
+
+			if (stopping) {
+				return;
+			}
+			finishedGeneration = jobGeneration;
+		}
+
+		std::exception_ptr error;
+		try {
+			recordShare(workerIndex);
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (error && !jobError) {
+			jobError = error;
+		}
+
+		if (--runningWorkers == 0) {
+			jobFinished.notify_one();
+		}
+	}
+}
+
+// Every worker gets a contiguous share of the items, so the draws stay in the order the items are in
+void CommandRecorder::recordShare(uint32_t workerIndex) {
+	Worker& worker = *workers[workerIndex];
+	uint32_t firstItem = uint64_t(jobItemCount) * workerIndex / workers.size();
+	uint32_t lastItem = uint64_t(jobItemCount) * (workerIndex + 1) / workers.size();
+
+	// The GPU has finished the frame, so everything allocated from its pool can be reused
+	vkResetCommandPool(device, worker.commandPools[jobFrameIndex], 0);
+
+	VkCommandBuffer commandBuffer = worker.commandBuffers[jobFrameIndex];
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &jobInheritance;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin secondary command buffer!");
+	}
+
+	// Shares without items are still executed, they are just empty
+	if (lastItem > firstItem) {
+		(*jobRecordRange)(commandBuffer, firstItem, lastItem - firstItem);
+	}
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record secondary command buffer!");
+	}
+}
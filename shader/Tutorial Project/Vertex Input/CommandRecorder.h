@@ -0,0 +1,65 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "VDeleter.h"
+
+class VulkanAPIHandler;
+
+// Called with the secondary command buffer of one worker and the range of items it records
+typedef std::function<void(VkCommandBuffer commandBuffer, uint32_t firstItem, uint32_t itemCount)> RecordRangeFunction;
+
+// Splits the recording of a render pass over worker threads. Each worker records an even share of the items into
+// its own secondary command buffer, which the primary command buffer executes in order. The calling thread records
+// the first share itself and waits for the others.
+//
+// Command pools can only be used by one thread at a time, so every worker has its own pool per frame in flight.
+// A frame's pools are reset when the frame is recorded again, after its fence has been waited on.
+class CommandRecorder {
+public:
+	CommandRecorder(VulkanAPIHandler* vkAPIHandler, uint32_t queueFamily, uint32_t threadCount, uint32_t framesInFlight);
+	~CommandRecorder();
+
+	// Has to be called outside of a render pass. The returned command buffers continue subpass 0 of renderPass
+	// on framebuffer and have to be executed within the same frame
+	std::vector<VkCommandBuffer> record(uint32_t frameIndex, VkRenderPass renderPass, VkFramebuffer framebuffer, uint32_t itemCount, const RecordRangeFunction& recordRange);
+
+	uint32_t getThreadCount();
+private:
+	struct Worker {
+		// Indexed by frame in flight
+		std::vector<VDeleter<VkCommandPool>> commandPools;
+		std::vector<VkCommandBuffer> commandBuffers;
+	};
+
+	VulkanAPIHandler* vulkanAPIHandler;
+	VDeleter<VkDevice> device;
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	// Worker 0 is the thread that calls record()
+	std::vector<std::thread> threads;
+
+	// The job that is currently being recorded. Only written while no worker is running
+	uint32_t jobFrameIndex{0};
+	uint32_t jobItemCount{0};
+	VkCommandBufferInheritanceInfo jobInheritance{};
+	const RecordRangeFunction* jobRecordRange{nullptr};
+
+	std::mutex mutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobFinished;
+	uint64_t jobGeneration{0};
+	uint32_t runningWorkers{0};
+	bool stopping{false};
+	// The first exception a worker ran into, thrown again on the calling thread
+	std::exception_ptr jobError;
+
+	void workerLoop(uint32_t workerIndex);
+	void recordShare(uint32_t workerIndex);
+};
@@ -0,0 +1,460 @@
+#include "DepthPyramid.h"
+#include "VulkanAPIHandler.h"
+
+DepthPyramid::DepthPyramid(VulkanAPIHandler* vkAPIHandler, VkDescriptorSetLayout renderableSetLayout) {
+	vulkanAPIHandler = vkAPIHandler;
+	device = vkAPIHandler->getDevice();
+	this->renderableSetLayout = renderableSetLayout;
+}
+
+void DepthPyramid::create() {
+	// D16_UNORM has to support sampling, D32_SFLOAT keeps the depth of far walls apart
+	VkFormatFeatureFlags features = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+	depthFormat = (vulkanAPIHandler->getFormatProperties(VK_FORMAT_D32_SFLOAT).optimalTilingFeatures & features) == features ? VK_FORMAT_D32_SFLOAT : VK_FORMAT_D16_UNORM;
+
+	// Down to 1x1, the narrower side stays at one texel for the last levels
+	levelCount = 1;
+	while ((std::max(DEPTH_PYRAMID_WIDTH, DEPTH_PYRAMID_HEIGHT) >> (levelCount - 1)) > 1) {
+		levelCount++;
+	}
+
+	createImages();
+	createRenderPass();
+	createOccluderPipeline();
+	createDescriptorSets();
+	createReducePipeline();
+
+	printf("Depth pyramid: %ux%u %s occluder depth, %u levels\n", DEPTH_PYRAMID_WIDTH, DEPTH_PYRAMID_HEIGHT, depthFormat == VK_FORMAT_D32_SFLOAT ? "D32_SFLOAT" : "D16_UNORM", levelCount);
+}
+
+void DepthPyramid::update(VkCommandBuffer commandBuffer, const glm::mat4& viewProjection, const DrawOccludersFunction& drawOccluders) {
+	if (ready && viewProjection == this->viewProjection) {
+		return;
+	}
+
+	// The previous frames may still be culling against the old pyramid and reducing the old depth.
+	// The render pass waits for the latter itself
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	VkClearValue clearValue = {};
+	clearValue.depthStencil = { 1.0f, 0 };
+
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = renderPass;
+	renderPassBeginInfo.framebuffer = framebuffer;
+	renderPassBeginInfo.renderArea.extent = { DEPTH_PYRAMID_WIDTH, DEPTH_PYRAMID_HEIGHT };
+	renderPassBeginInfo.clearValueCount = 1;
+	renderPassBeginInfo.pClearValues = &clearValue;
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, occluderPipeline);
+	vkCmdPushConstants(commandBuffer, occluderPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4), &viewProjection);
+	drawOccluders(commandBuffer, occluderPipelineLayout);
+	vkCmdEndRenderPass(commandBuffer);
+
+	recordReduction(commandBuffer);
+
+	this->viewProjection = viewProjection;
+	ready = true;
+	updates++;
+}
+
+bool DepthPyramid::isReady() {
+	return ready;
+}
+
+VkImageView DepthPyramid::getImageView() {
+	return pyramidImageView;
+}
+
+VkSampler DepthPyramid::getSampler() {
+	return sampler;
+}
+
+uint32_t DepthPyramid::getLevelCount() {
+	return levelCount;
+}
+
+uint32_t DepthPyramid::getUpdateCount() {
+	return updates;
+}
+
+// Level 0 is reduced from the depth image, every other level from the one above it
+void DepthPyramid::recordReduction(VkCommandBuffer commandBuffer) {
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, reducePipeline);
+
+	VkImageMemoryBarrier levelBarrier = {};
+	levelBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+	levelBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	levelBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	levelBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	levelBarrier.image = pyramidImage;
+
+	for (uint32_t level = 0; level < levelCount; level++) {
+		uint32_t width = std::max(DEPTH_PYRAMID_WIDTH >> level, 1u);
+		uint32_t height = std::max(DEPTH_PYRAMID_HEIGHT >> level, 1u);
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, reducePipelineLayout, 0, 1, &descriptorSets[level], 0, nullptr);
+		vkCmdDispatch(commandBuffer, (width + DEPTH_PYRAMID_WORKGROUP_SIZE - 1) / DEPTH_PYRAMID_WORKGROUP_SIZE, (height + DEPTH_PYRAMID_WORKGROUP_SIZE - 1) / DEPTH_PYRAMID_WORKGROUP_SIZE, 1);
+
+		// Read by the next level, and by the culling shader once all levels are done
+		levelBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+	}
+}
+
+void DepthPyramid::createImages() {
+	VkImageCreateInfo imageInfo = {};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = depthFormat;
+	imageInfo.extent = { DEPTH_PYRAMID_WIDTH, DEPTH_PYRAMID_HEIGHT, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	vulkanAPIHandler->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+	vulkanAPIHandler->createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, depthImageView);
+
+	// R32_SFLOAT storage images are supported everywhere
+	imageInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageInfo.mipLevels = levelCount;
+	imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+
+	vulkanAPIHandler->createImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, pyramidImage, pyramidImageMemory);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = pyramidImage;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+
+	vulkanAPIHandler->createImageView(viewInfo, pyramidImageView);
+
+	levelImageViews.reserve(levelCount);
+	for (uint32_t level = 0; level < levelCount; level++) {
+		levelImageViews.emplace_back(VDeleter<VkImageView>{ device, vkDestroyImageView });
+	}
+
+	for (uint32_t level = 0; level < levelCount; level++) {
+		viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, 1, 0, 1 };
+		vulkanAPIHandler->createImageView(viewInfo, levelImageViews[level]);
+	}
+
+	// The pyramid is read and written in GENERAL, the culling shader never reads it before the first update
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = pyramidImage;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount, 0, 1 };
+
+	VkCommandBuffer layoutCmd = vulkanAPIHandler->getUploadBatcher()->getCommandBuffer();
+	vkCmdPipelineBarrier(layoutCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+	vulkanAPIHandler->getUploadBatcher()->commit();
+
+	// Texels are fetched, never filtered
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = samplerInfo.addressModeU;
+	samplerInfo.addressModeW = samplerInfo.addressModeU;
+	samplerInfo.compareOp = VK_COMPARE_OP_NEVER;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = (float)levelCount;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, sampler.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pyramid sampler!");
+	}
+}
+
+void DepthPyramid::createRenderPass() {
+	VkAttachmentDescription depthAttachment = {};
+	depthAttachment.format = depthFormat;
+	depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference depthReference = {};
+	depthReference.attachment = 0;
+	depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.pDepthStencilAttachment = &depthReference;
+
+	std::array<VkSubpassDependency, 2> dependencies = {};
+
+	// The previous reduction may still be reading the depth
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Makes the depth visible to the reduction
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &depthAttachment;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = dependencies.size();
+	renderPassInfo.pDependencies = dependencies.data();
+
+	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, renderPass.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create occluder render pass!");
+	}
+
+	VkImageView attachment = depthImageView;
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = renderPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &attachment;
+	framebufferInfo.width = DEPTH_PYRAMID_WIDTH;
+	framebufferInfo.height = DEPTH_PYRAMID_HEIGHT;
+	framebufferInfo.layers = 1;
+
+	if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, framebuffer.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create occluder framebuffer!");
+	}
+}
+
+// Depth only, there is no fragment shader. The scene's vertex input, with the view projection as a push constant
+void DepthPyramid::createOccluderPipeline() {
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(glm::mat4);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &renderableSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, occluderPipelineLayout.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create occluder pipeline layout!");
+	}
+
+	auto vertShaderCode = ShaderHandler::readFile("Shaders/occluders.spv");
+	VDeleter<VkShaderModule> vertShaderModule{ device, vkDestroyShaderModule };
+	vulkanAPIHandler->createShaderModule(vertShaderCode, vertShaderModule);
+
+	VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertShaderStageInfo.module = vertShaderModule;
+	vertShaderStageInfo.pName = "main";
+
+	std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = { Vertex::getBindingDescription(), InstanceData::getBindingDescription() };
+	auto vertexAttributeDescriptions = Vertex::getAttributeDescriptions();
+	auto instanceAttributeDescriptions = InstanceData::getAttributeDescriptions();
+
+	std::array<VkVertexInputAttributeDescription, NUM_VERTEX_ATTRIBUTES + NUM_INSTANCE_ATTRIBUTES> attributeDescriptions = {};
+	std::copy(vertexAttributeDescriptions.begin(), vertexAttributeDescriptions.end(), attributeDescriptions.begin());
+	std::copy(instanceAttributeDescriptions.begin(), instanceAttributeDescriptions.end(), attributeDescriptions.begin() + NUM_VERTEX_ATTRIBUTES);
+
+	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	vertexInputInfo.vertexBindingDescriptionCount = bindingDescriptions.size();
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
+	vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
+	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+	VkViewport viewport = {};
+	viewport.width = (float)DEPTH_PYRAMID_WIDTH;
+	viewport.height = (float)DEPTH_PYRAMID_HEIGHT;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+
+	VkRect2D scissor = {};
+	scissor.extent = { DEPTH_PYRAMID_WIDTH, DEPTH_PYRAMID_HEIGHT };
+
+	VkPipelineViewportStateCreateInfo viewportState = {};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.pViewports = &viewport;
+	viewportState.scissorCount = 1;
+	viewportState.pScissors = &scissor;
+
+	// Same culling as the scene pass, so the occluders cover exactly what they cover on screen
+	VkPipelineRasterizationStateCreateInfo rasterizer = {};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.lineWidth = 1.0f;
+	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+	VkPipelineMultisampleStateCreateInfo multisampling = {};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+	depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+	depthStencil.depthTestEnable = VK_TRUE;
+	depthStencil.depthWriteEnable = VK_TRUE;
+	depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+
+	VkPipelineColorBlendStateCreateInfo colorBlending = {};
+	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlending.attachmentCount = 0;
+
+	VkGraphicsPipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 1;
+	pipelineInfo.pStages = &vertShaderStageInfo;
+	pipelineInfo.pVertexInputState = &vertexInputInfo;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pDepthStencilState = &depthStencil;
+	pipelineInfo.pColorBlendState = &colorBlending;
+	pipelineInfo.layout = occluderPipelineLayout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+
+	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, occluderPipeline.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create occluder pipeline!");
+	}
+}
+
+void DepthPyramid::createDescriptorSets() {
+	// The level above or the depth image, and the level that is written
+	std::array<VkDescriptorSetLayoutBinding, 2> layoutBindings = {};
+	layoutBindings[0].binding = 0;
+	layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	layoutBindings[0].descriptorCount = 1;
+	layoutBindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	layoutBindings[1].binding = 1;
+	layoutBindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	layoutBindings[1].descriptorCount = 1;
+	layoutBindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = layoutBindings.size();
+	layoutInfo.pBindings = layoutBindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, descriptorSetLayout.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pyramid descriptor set layout!");
+	}
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount = levelCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	poolSizes[1].descriptorCount = levelCount;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = poolSizes.size();
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = levelCount;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, descriptorPool.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pyramid descriptor pool!");
+	}
+
+	std::vector<VkDescriptorSetLayout> layouts(levelCount, descriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = levelCount;
+	allocInfo.pSetLayouts = layouts.data();
+
+	descriptorSets.resize(levelCount);
+	if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate depth pyramid descriptor sets!");
+	}
+
+	for (uint32_t level = 0; level < levelCount; level++) {
+		VkDescriptorImageInfo sourceInfo = {};
+		sourceInfo.sampler = sampler;
+		sourceInfo.imageView = level == 0 ? (VkImageView)depthImageView : (VkImageView)levelImageViews[level - 1];
+		sourceInfo.imageLayout = level == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+
+		VkDescriptorImageInfo destinationInfo = {};
+		destinationInfo.imageView = levelImageViews[level];
+		destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+		for (uint32_t i = 0; i < descriptorWrites.size(); i++) {
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = descriptorSets[level];
+			descriptorWrites[i].dstBinding = i;
+			descriptorWrites[i].dstArrayElement = 0;
+			descriptorWrites[i].descriptorType = layoutBindings[i].descriptorType;
+			descriptorWrites[i].descriptorCount = 1;
+		}
+		descriptorWrites[0].pImageInfo = &sourceInfo;
+		descriptorWrites[1].pImageInfo = &destinationInfo;
+
+		vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void DepthPyramid::createReducePipeline() {
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	VkDescriptorSetLayout setLayout = descriptorSetLayout;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, reducePipelineLayout.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pyramid pipeline layout!");
+	}
+
+	auto compShaderCode = ShaderHandler::readFile("Shaders/depthPyramid.spv");
+	VDeleter<VkShaderModule> compShaderModule{ device, vkDestroyShaderModule };
+	vulkanAPIHandler->createShaderModule(compShaderCode, compShaderModule);
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = compShaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = reducePipelineLayout;
+
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, reducePipeline.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create depth pyramid pipeline!");
+	}
+}
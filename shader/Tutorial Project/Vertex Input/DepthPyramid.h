@@ -0,0 +1,78 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <functional>
+#include <vector>
+#include <glm/glm.hpp>
+#include "VDeleter.h"
+#include "DeviceMemoryAllocator.h"
+
+class VulkanAPIHandler;
+
+// Records the draws of the occluders with the given pipeline layout
+typedef std::function<void(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout)> DrawOccludersFunction;
+
+// Hierarchical depth of the static scene as the camera sees it, for occlusion culling. The occluders are rendered
+// depth-only into an image of DEPTH_PYRAMID_WIDTH x DEPTH_PYRAMID_HEIGHT, which a compute shader reduces into a mip
+// chain where every texel keeps the farthest depth of the texels it covers. Anything whose nearest depth is behind
+// the farthest depth of the region it projects to is hidden.
+//
+// The occluders are the static renderables, which are loaded with the level and never move or change, so the
+// pyramid is only built again when the camera's view projection changes. It stays in VK_IMAGE_LAYOUT_GENERAL
+class DepthPyramid {
+public:
+	// renderableSetLayout is bound at set RENDERABLE_UBO while drawing the occluders
+	DepthPyramid(VulkanAPIHandler* vkAPIHandler, VkDescriptorSetLayout renderableSetLayout);
+
+	void create();
+	// Renders the occluders and builds the pyramid if the view projection has changed. The culling shader recorded
+	// after it in the same command buffer sees the result
+	void update(VkCommandBuffer commandBuffer, const glm::mat4& viewProjection, const DrawOccludersFunction& drawOccluders);
+	// False until the first update
+	bool isReady();
+
+	VkImageView getImageView();
+	VkSampler getSampler();
+	uint32_t getLevelCount();
+	uint32_t getUpdateCount();
+private:
+	VulkanAPIHandler* vulkanAPIHandler;
+	VDeleter<VkDevice> device;
+	VkDescriptorSetLayout renderableSetLayout;
+	VkFormat depthFormat;
+	uint32_t levelCount{0};
+
+	glm::mat4 viewProjection;
+	bool ready{false};
+	uint32_t updates{0};
+
+	// Depth of the occluders
+	VDeleter<VkImage> depthImage{ device, vkDestroyImage };
+	MemoryAllocation depthImageMemory;
+	VDeleter<VkImageView> depthImageView{ device, vkDestroyImageView };
+	VDeleter<VkRenderPass> renderPass{ device, vkDestroyRenderPass };
+	VDeleter<VkFramebuffer> framebuffer{ device, vkDestroyFramebuffer };
+	VDeleter<VkPipelineLayout> occluderPipelineLayout{ device, vkDestroyPipelineLayout };
+	VDeleter<VkPipeline> occluderPipeline{ device, vkDestroyPipeline };
+
+	// The pyramid, with one view per level for building it and one of all levels for the culling shader
+	VDeleter<VkImage> pyramidImage{ device, vkDestroyImage };
+	MemoryAllocation pyramidImageMemory;
+	VDeleter<VkImageView> pyramidImageView{ device, vkDestroyImageView };
+	std::vector<VDeleter<VkImageView>> levelImageViews;
+	VDeleter<VkSampler> sampler{ device, vkDestroySampler };
+
+	// One set per level, reading the level above it or the depth image
+	VDeleter<VkDescriptorSetLayout> descriptorSetLayout{ device, vkDestroyDescriptorSetLayout };
+	VDeleter<VkDescriptorPool> descriptorPool{ device, vkDestroyDescriptorPool };
+	std::vector<VkDescriptorSet> descriptorSets;
+	VDeleter<VkPipelineLayout> reducePipelineLayout{ device, vkDestroyPipelineLayout };
+	VDeleter<VkPipeline> reducePipeline{ device, vkDestroyPipeline };
+
+	void createImages();
+	void createRenderPass();
+	void createOccluderPipeline();
+	void createDescriptorSets();
+	void createReducePipeline();
+	void recordReduction(VkCommandBuffer commandBuffer);
+};
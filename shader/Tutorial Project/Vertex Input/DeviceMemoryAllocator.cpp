@@ -0,0 +1,285 @@
+#include "DeviceMemoryAllocator.h"
+#include "VulkanAPIHandler.h"
+
+MemoryAllocation::MemoryAllocation(MemoryAllocation&& other) {
+	allocator = other.allocator;
+	block = other.block;
+	offset = other.offset;
+	size = other.size;
+
+	other.allocator = nullptr;
+	other.block = nullptr;
+}
+
+MemoryAllocation::~MemoryAllocation() {
+	free();
+}
+
+void MemoryAllocation::free() {
+	if (allocator != nullptr) {
+		allocator->free(*this);
+	}
+}
+
+VkDeviceMemory MemoryAllocation::getMemory() const {
+	return block != nullptr ? block->memory : VK_NULL_HANDLE;
+}
+
+VkDeviceSize MemoryAllocation::getOffset() const {
+	return offset;
+}
+
+VkDeviceSize MemoryAllocation::getSize() const {
+	return size;
+}
+
+void* MemoryAllocation::getMappedData() const {
+	if (block == nullptr || block->mappedData == nullptr) {
+		return nullptr;
+	}
+
+	return block->mappedData + offset;
+}
+
+DeviceMemoryAllocator::DeviceMemoryAllocator(VulkanAPIHandler* vkAPIHandler, AllocationStrategy allocationStrategy) {
+	vulkanAPIHandler = vkAPIHandler;
+	device = vkAPIHandler->getDevice();
+	strategy = allocationStrategy;
+
+	memoryProperties = vkAPIHandler->getPhysicalDeviceMemoryProperties();
+	blocks.resize(memoryProperties.memoryTypeCount);
+
+	VkPhysicalDeviceLimits limits = vkAPIHandler->getPhysicalDeviceProperties().limits;
+	bufferImageGranularity = std::max<VkDeviceSize>(1, limits.bufferImageGranularity);
+	maxAllocationCount = limits.maxMemoryAllocationCount;
+}
+
+DeviceMemoryAllocator::~DeviceMemoryAllocator() {
+	for (auto& typeBlocks : blocks) {
+		for (auto& block : typeBlocks) {
+			vkFreeMemory(device, block->memory, nullptr);
+		}
+	}
+}
+
+void DeviceMemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linearResource, MemoryAllocation& allocation) {
+	allocation.free();
+
+	uint32_t memoryTypeIndex = vulkanAPIHandler->findMemoryType(requirements.memoryTypeBits, properties);
+	VkDeviceSize blockSize = getBlockSize(memoryTypeIndex);
+
+	MemoryBlock* block = nullptr;
+	VkDeviceSize offset = 0;
+
+	if (strategy == ALLOCATION_STRATEGY_DEDICATED || requirements.size > blockSize / 2) {
+		block = createBlock(memoryTypeIndex, requirements.size, true);
+	}
+	else {
+		for (auto& candidate : blocks[memoryTypeIndex]) {
+			if (!candidate->dedicated && findOffset(candidate.get(), requirements.size, requirements.alignment, linearResource, offset)) {
+				block = candidate.get();
+				break;
+			}
+		}
+
+		if (block == nullptr) {
+			block = createBlock(memoryTypeIndex, blockSize, false);
+			offset = 0;
+		}
+	}
+
+	block->suballocations[offset] = { requirements.size, linearResource };
+	if (strategy == ALLOCATION_STRATEGY_LINEAR) {
+		block->linearOffset = std::max(block->linearOffset, offset + requirements.size);
+	}
+
+	allocation.allocator = this;
+	allocation.block = block;
+	allocation.offset = offset;
+	allocation.size = requirements.size;
+}
+
+void DeviceMemoryAllocator::free(MemoryAllocation& allocation) {
+	MemoryBlock* block = allocation.block;
+	block->suballocations.erase(allocation.offset);
+
+	allocation.allocator = nullptr;
+	allocation.block = nullptr;
+
+	// Freeing the top of a linear block makes its space available again, everything below has to wait
+	block->linearOffset = block->suballocations.empty() ? 0 : block->suballocations.rbegin()->first + block->suballocations.rbegin()->second.size;
+
+	if (!block->suballocations.empty()) {
+		return;
+	}
+
+	// One empty block per memory type is kept around, otherwise short lived allocations like staging memory
+	// would allocate and free a whole block every time
+	auto& typeBlocks = blocks[block->memoryTypeIndex];
+	bool hasOtherEmptyBlock = std::any_of(typeBlocks.begin(), typeBlocks.end(), [block](const std::unique_ptr<MemoryBlock>& other) {
+		return other.get() != block && !other->dedicated && other->suballocations.empty();
+	});
+
+	if (block->dedicated || hasOtherEmptyBlock) {
+		destroyBlock(block);
+	}
+}
+
+std::vector<MemoryHeapStatistics> DeviceMemoryAllocator::getHeapStatistics() {
+	std::vector<MemoryHeapStatistics> statistics(memoryProperties.memoryHeapCount);
+
+	for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; type++) {
+		MemoryHeapStatistics& heap = statistics[memoryProperties.memoryTypes[type].heapIndex];
+
+		for (auto& block : blocks[type]) {
+			heap.blockCount++;
+			heap.blockBytes += block->size;
+			heap.allocationCount += block->suballocations.size();
+
+			for (auto& suballocation : block->suballocations) {
+				heap.usedBytes += suballocation.second.size;
+			}
+		}
+	}
+
+	return statistics;
+}
+
+uint32_t DeviceMemoryAllocator::getDeviceAllocationCount() {
+	return deviceAllocationCount;
+}
+
+void DeviceMemoryAllocator::printStatistics() {
+	std::vector<MemoryHeapStatistics> statistics = getHeapStatistics();
+
+	printf("Device memory: %u vkAllocateMemory calls live (limit %u)\n", deviceAllocationCount, maxAllocationCount);
+	for (uint32_t heap = 0; heap < statistics.size(); heap++) {
+		if (statistics[heap].blockCount == 0) {
+			continue;
+		}
+
+		bool deviceLocal = (memoryProperties.memoryHeaps[heap].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		printf("  Heap %u (%s): %u blocks, %u allocations, %llu KB used of %llu KB\n",
+			   heap,
+			   deviceLocal ? "device local" : "host",
+			   statistics[heap].blockCount,
+			   statistics[heap].allocationCount,
+			   (unsigned long long)statistics[heap].usedBytes / 1024,
+			   (unsigned long long)statistics[heap].blockBytes / 1024);
+	}
+}
+
+MemoryBlock* DeviceMemoryAllocator::createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated) {
+	if (deviceAllocationCount >= maxAllocationCount) {
+		throw std::runtime_error("exceeded maxMemoryAllocationCount!");
+	}
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	auto block = std::make_unique<MemoryBlock>();
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &block->memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate device memory block!");
+	}
+	deviceAllocationCount++;
+
+	block->size = size;
+	block->memoryTypeIndex = memoryTypeIndex;
+	block->dedicated = dedicated;
+
+	if (memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		void* data;
+		if (vkMapMemory(device, block->memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS) {
+			throw std::runtime_error("failed to map device memory block!");
+		}
+		block->mappedData = reinterpret_cast<uint8_t*>(data);
+	}
+
+	blocks[memoryTypeIndex].push_back(std::move(block));
+	return blocks[memoryTypeIndex].back().get();
+}
+
+void DeviceMemoryAllocator::destroyBlock(MemoryBlock* block) {
+	auto& typeBlocks = blocks[block->memoryTypeIndex];
+
+	// Freeing mapped memory unmaps it implicitly
+	vkFreeMemory(device, block->memory, nullptr);
+	deviceAllocationCount--;
+
+	typeBlocks.erase(std::find_if(typeBlocks.begin(), typeBlocks.end(), [block](const std::unique_ptr<MemoryBlock>& other) {
+		return other.get() == block;
+	}));
+}
+
+VkDeviceSize DeviceMemoryAllocator::getBlockSize(uint32_t memoryTypeIndex) {
+	// Small heaps like the host visible part of VRAM would be used up by a few default sized blocks
+	VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+	return std::min<VkDeviceSize>(DEVICE_MEMORY_BLOCK_SIZE, heapSize / 8);
+}
+
+bool DeviceMemoryAllocator::findOffset(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, bool linear, VkDeviceSize& offset) {
+	auto alignUp = [](VkDeviceSize value, VkDeviceSize align) {
+		return (value + align - 1) / align * align;
+	};
+
+	if (strategy == ALLOCATION_STRATEGY_LINEAR) {
+		VkDeviceSize candidate = alignUp(block->linearOffset, alignment);
+
+		if (!block->suballocations.empty()) {
+			auto& last = *block->suballocations.rbegin();
+			if (conflicts(last.second, linear) && onSamePage(last.first + last.second.size - 1, candidate)) {
+				candidate = alignUp(candidate, bufferImageGranularity);
+			}
+		}
+
+		if (candidate + size > block->size) {
+			return false;
+		}
+
+		offset = candidate;
+		return true;
+	}
+
+	// First fit over the gaps between the live sub-allocations
+	VkDeviceSize gapStart = 0;
+	const std::pair<const VkDeviceSize, Suballocation>* previous = nullptr;
+
+	for (auto next = block->suballocations.begin();; ++next) {
+		bool atEnd = next == block->suballocations.end();
+		VkDeviceSize gapEnd = atEnd ? block->size : next->first;
+
+		VkDeviceSize candidate = alignUp(gapStart, alignment);
+
+		// Linear and optimal resources must not share a bufferImageGranularity page
+		if (previous != nullptr && conflicts(previous->second, linear) && onSamePage(previous->first + previous->second.size - 1, candidate)) {
+			candidate = alignUp(candidate, bufferImageGranularity);
+		}
+
+		bool fits = candidate + size <= gapEnd;
+		if (fits && !atEnd && conflicts(next->second, linear) && onSamePage(candidate + size - 1, next->first)) {
+			fits = false;
+		}
+
+		if (fits) {
+			offset = candidate;
+			return true;
+		}
+
+		if (atEnd) {
+			return false;
+		}
+
+		gapStart = next->first + next->second.size;
+		previous = &*next;
+	}
+}
+
+bool DeviceMemoryAllocator::onSamePage(VkDeviceSize endOfFirst, VkDeviceSize startOfSecond) {
+	return endOfFirst / bufferImageGranularity == startOfSecond / bufferImageGranularity;
+}
+
+bool DeviceMemoryAllocator::conflicts(const Suballocation& neighbour, bool linear) {
+	return bufferImageGranularity > 1 && neighbour.linear != linear;
+}
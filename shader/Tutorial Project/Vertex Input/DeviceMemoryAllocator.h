@@ -0,0 +1,108 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+class VulkanAPIHandler;
+class DeviceMemoryAllocator;
+
+enum AllocationStrategy {
+	// First fit into the gaps between live allocations, freed ranges are reused right away
+	ALLOCATION_STRATEGY_FREE_LIST = 0,
+	// Bump allocation, a block only gets its space back once the allocations on top of it are freed
+	ALLOCATION_STRATEGY_LINEAR,
+	// One vkAllocateMemory call per resource, which is how memory used to be allocated. Kept for comparison
+	ALLOCATION_STRATEGY_DEDICATED
+};
+
+struct Suballocation {
+	VkDeviceSize size;
+	// Buffers and linear images. Used for the bufferImageGranularity checks
+	bool linear;
+};
+
+// One vkAllocateMemory call that resources are carved out of
+struct MemoryBlock {
+	VkDeviceMemory memory{VK_NULL_HANDLE};
+	VkDeviceSize size{0};
+	uint32_t memoryTypeIndex{0};
+	// Host visible blocks are mapped once when they are created
+	uint8_t* mappedData{nullptr};
+	// Holds a single resource that was too large to share a block
+	bool dedicated{false};
+	// Live sub-allocations keyed by offset. The gaps between them are the free list
+	std::map<VkDeviceSize, Suballocation> suballocations;
+	// Only used by the linear strategy, nothing is handed out above this offset
+	VkDeviceSize linearOffset{0};
+};
+
+// A range inside one of the allocator's blocks. The range is returned to the block when the
+// allocation is destroyed or allocated again, the same way VDeleter releases its handle.
+class MemoryAllocation {
+public:
+	MemoryAllocation() {}
+	MemoryAllocation(MemoryAllocation&& other);
+	MemoryAllocation(const MemoryAllocation&) = delete;
+	MemoryAllocation& operator=(const MemoryAllocation&) = delete;
+	~MemoryAllocation();
+
+	void free();
+
+	VkDeviceMemory getMemory() const;
+	VkDeviceSize getOffset() const;
+	VkDeviceSize getSize() const;
+	// Only valid for host visible memory
+	void* getMappedData() const;
+private:
+	friend class DeviceMemoryAllocator;
+
+	DeviceMemoryAllocator* allocator{nullptr};
+	MemoryBlock* block{nullptr};
+	VkDeviceSize offset{0};
+	VkDeviceSize size{0};
+};
+
+struct MemoryHeapStatistics {
+	uint32_t blockCount{0};
+	uint32_t allocationCount{0};
+	VkDeviceSize blockBytes{0};
+	VkDeviceSize usedBytes{0};
+};
+
+// Sub-allocates buffers and images from large blocks, one list of blocks per memory type, instead of
+// calling vkAllocateMemory for every resource. Resources larger than half a block get a block of their own.
+class DeviceMemoryAllocator {
+public:
+	DeviceMemoryAllocator(VulkanAPIHandler* vkAPIHandler, AllocationStrategy allocationStrategy);
+	~DeviceMemoryAllocator();
+
+	// linearResource has to be true for buffers and linear tiled images
+	void allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linearResource, MemoryAllocation& allocation);
+	void free(MemoryAllocation& allocation);
+
+	// Indexed by memory heap
+	std::vector<MemoryHeapStatistics> getHeapStatistics();
+	uint32_t getDeviceAllocationCount();
+	void printStatistics();
+private:
+	VulkanAPIHandler* vulkanAPIHandler;
+	VkDevice device;
+	AllocationStrategy strategy;
+
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	VkDeviceSize bufferImageGranularity{1};
+	uint32_t maxAllocationCount{0};
+	uint32_t deviceAllocationCount{0};
+
+	// Indexed by memory type
+	std::vector<std::vector<std::unique_ptr<MemoryBlock>>> blocks;
+
+	MemoryBlock* createBlock(uint32_t memoryTypeIndex, VkDeviceSize size, bool dedicated);
+	void destroyBlock(MemoryBlock* block);
+	VkDeviceSize getBlockSize(uint32_t memoryTypeIndex);
+	bool findOffset(MemoryBlock* block, VkDeviceSize size, VkDeviceSize alignment, bool linear, VkDeviceSize& offset);
+	bool onSamePage(VkDeviceSize endOfFirst, VkDeviceSize startOfSecond);
+	bool conflicts(const Suballocation& neighbour, bool linear);
+};
@@ -0,0 +1,68 @@
+#include "FrameRingBuffer.h"
+#include "VulkanAPIHandler.h"
+
+FrameRingBuffer::FrameRingBuffer(VulkanAPIHandler* vkAPIHandler, uint32_t numFrames, VkBufferUsageFlags bufferUsage) {
+	vulkanAPIHandler = vkAPIHandler;
+	device = vkAPIHandler->getDevice();
+	frameCount = numFrames;
+	usage = bufferUsage;
+
+	// Every descriptor has to point at an offset that is a multiple of this. Vertex data only needs its
+	// attributes aligned, a vec4 is enough for that
+	alignment = sizeof(float) * 4;
+	if (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+		alignment = std::max<VkDeviceSize>(alignment, vkAPIHandler->getPhysicalDeviceProperties().limits.minUniformBufferOffsetAlignment);
+	}
+	// Vertex data that is also read by compute shaders
+	if (usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+		alignment = std::max<VkDeviceSize>(alignment, vkAPIHandler->getPhysicalDeviceProperties().limits.minStorageBufferOffsetAlignment);
+	}
+}
+
+VkDeviceSize FrameRingBuffer::reserve(VkDeviceSize size) {
+	if (mappedData != nullptr) {
+		throw std::runtime_error("frame ring buffer slots have to be reserved before it is created!");
+	}
+
+	VkDeviceSize slotOffset = frameSize;
+	frameSize += alignUp(size);
+	slotCount++;
+
+	return slotOffset;
+}
+
+void FrameRingBuffer::create() {
+	// Keeping the regions aligned means every slot offset stays aligned in every frame
+	frameSize = alignUp(frameSize);
+
+	vulkanAPIHandler->createBuffer(frameSize * frameCount,
+								   usage,
+								   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+								   buffer,
+								   bufferMemory);
+
+	// Host coherent memory can stay mapped while the GPU reads from it. The allocator maps its blocks once
+	mappedData = reinterpret_cast<uint8_t*>(bufferMemory.getMappedData());
+
+	printf("%s ring buffer: %u slots, %llu bytes per frame, %u frames\n", (usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) ? "Uniform" : "Vertex", slotCount, (unsigned long long)frameSize, frameCount);
+}
+
+void FrameRingBuffer::write(uint32_t frameIndex, VkDeviceSize slotOffset, const void* data, VkDeviceSize size) {
+	memcpy(mappedData + getOffset(frameIndex, slotOffset), data, (size_t)size);
+}
+
+VkBuffer FrameRingBuffer::getBuffer() {
+	return buffer;
+}
+
+VkDeviceSize FrameRingBuffer::getOffset(uint32_t frameIndex, VkDeviceSize slotOffset) {
+	return frameIndex * frameSize + slotOffset;
+}
+
+VkDeviceSize FrameRingBuffer::getFrameSize() {
+	return frameSize;
+}
+
+VkDeviceSize FrameRingBuffer::alignUp(VkDeviceSize size) {
+	return (size + alignment - 1) / alignment * alignment;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include "VDeleter.h"
+#include "DeviceMemoryAllocator.h"
+
+class VulkanAPIHandler;
+
+// A single host visible buffer for data the CPU writes every frame, mapped for the lifetime of the application.
+// The buffer is split into one region per frame in flight. Slots are reserved once at startup and
+// live at the same offset in every region, so writing to a slot is a plain memcpy into the region
+// of the current frame, which the GPU is guaranteed to be done with.
+// The usage decides what the slots are read as: uniform blocks, the instance vertex buffer, or storage
+// buffers of the culling shader. Offsets are aligned for every usage that is passed
+class FrameRingBuffer {
+public:
+	FrameRingBuffer(VulkanAPIHandler* vkAPIHandler, uint32_t numFrames, VkBufferUsageFlags bufferUsage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+
+	// Reserves space for one uniform block in every frame region. Has to be called before create()
+	VkDeviceSize reserve(VkDeviceSize size);
+	void create();
+
+	void write(uint32_t frameIndex, VkDeviceSize slotOffset, const void* data, VkDeviceSize size);
+
+	VkBuffer getBuffer();
+	VkDeviceSize getOffset(uint32_t frameIndex, VkDeviceSize slotOffset);
+	VkDeviceSize getFrameSize();
+private:
+	VulkanAPIHandler* vulkanAPIHandler;
+	VDeleter<VkDevice> device;
+
+	uint32_t frameCount;
+	VkBufferUsageFlags usage;
+	VkDeviceSize alignment{1};
+	VkDeviceSize frameSize{0};
+	uint32_t slotCount{0};
+
+	uint8_t* mappedData{nullptr};
+
+	VDeleter<VkBuffer> buffer{ device, vkDestroyBuffer };
+	MemoryAllocation bufferMemory;
+
+	VkDeviceSize alignUp(VkDeviceSize size);
+};
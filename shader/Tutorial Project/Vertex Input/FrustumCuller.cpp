@@ -0,0 +1,92 @@
+#include "FrustumCuller.h"
+#include <algorithm>
+#ifdef FRUSTUM_CULLER_SSE
+#include <emmintrin.h>
+#endif
+
+void FrustumCuller::resize(uint32_t sphereCount) {
+	count = sphereCount;
+	uint32_t paddedCount = (sphereCount + 3) & ~3u;
+
+	centerX.resize(paddedCount, 0.f);
+	centerY.resize(paddedCount, 0.f);
+	centerZ.resize(paddedCount, 0.f);
+	radius.resize(paddedCount, 0.f);
+}
+
+uint32_t FrustumCuller::size() {
+	return count;
+}
+
+void FrustumCuller::setBoundingSphere(uint32_t index, glm::vec4 boundingSphere) {
+	centerX[index] = boundingSphere.x;
+	centerY[index] = boundingSphere.y;
+	centerZ[index] = boundingSphere.z;
+	radius[index] = boundingSphere.w;
+}
+
+// Gribb and Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-Projection Matrix"
+void FrustumCuller::setFrustum(const glm::mat4& viewProjection) {
+	// GLM matrices are column major, row i is m[0][i], m[1][i], m[2][i], m[3][i]
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+
+	planes[0] = rows[3] + rows[0];
+	planes[1] = rows[3] - rows[0];
+	planes[2] = rows[3] + rows[1];
+	planes[3] = rows[3] - rows[1];
+	// Clip space depth goes from zero to one
+	planes[4] = rows[2];
+	planes[5] = rows[3] - rows[2];
+
+	// Normalized so the plane distance can be compared with the sphere radius
+	for (auto& plane : planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+}
+
+const std::array<glm::vec4, 6>& FrustumCuller::getPlanes() {
+	return planes;
+}
+
+uint32_t FrustumCuller::cull(std::vector<uint32_t>& visibility) {
+	visibility.resize(count);
+	uint32_t visibleCount = 0;
+
+#ifdef FRUSTUM_CULLER_SSE
+	for (uint32_t first = 0; first < count; first += 4) {
+		__m128 x = _mm_loadu_ps(&centerX[first]);
+		__m128 y = _mm_loadu_ps(&centerY[first]);
+		__m128 z = _mm_loadu_ps(&centerZ[first]);
+		__m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radius[first]));
+
+		// A sphere is outside as soon as it is completely behind one of the planes
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (auto& plane : planes) {
+			__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(plane.x)), _mm_mul_ps(y, _mm_set1_ps(plane.y))),
+										 _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+		}
+
+		int mask = _mm_movemask_ps(inside);
+		for (uint32_t i = first; i < std::min(first + 4, count); i++) {
+			visibility[i] = (mask >> (i - first)) & 1;
+			visibleCount += visibility[i];
+		}
+	}
+#else
+	for (uint32_t i = 0; i < count; i++) {
+		bool inside = true;
+		for (auto& plane : planes) {
+			inside = inside && plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w >= -radius[i];
+		}
+
+		visibility[i] = inside ? 1 : 0;
+		visibleCount += visibility[i];
+	}
+#endif
+
+	return visibleCount;
+}
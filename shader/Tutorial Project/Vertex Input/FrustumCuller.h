@@ -0,0 +1,37 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// SSE is part of every x86 target the project is built for, other targets test one sphere at a time
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define FRUSTUM_CULLER_SSE
+#endif
+
+// Tests bounding spheres against the six planes of a view frustum. The spheres are stored as separate arrays
+// of x, y, z and radius, so four of them are tested against a plane with a handful of SSE instructions.
+class FrustumCuller {
+public:
+	// Padded to a multiple of four, the padding is never reported as visible
+	void resize(uint32_t count);
+	uint32_t size();
+	// World space center in xyz, radius in w
+	void setBoundingSphere(uint32_t index, glm::vec4 boundingSphere);
+
+	// Extracts the planes from a projection * view matrix with a depth range of zero to one
+	void setFrustum(const glm::mat4& viewProjection);
+	const std::array<glm::vec4, 6>& getPlanes();
+
+	// Writes 1 for every sphere that intersects the frustum and 0 for the others, returns how many are visible
+	uint32_t cull(std::vector<uint32_t>& visibility);
+private:
+	uint32_t count{0};
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+
+	// Normal in xyz pointing into the frustum, distance from the origin in w
+	std::array<glm::vec4, 6> planes;
+};
@@ -0,0 +1,394 @@
+#include "GpuCuller.h"
+#include "VulkanAPIHandler.h"
+#include "DepthPyramid.h"
+
+GpuCuller::GpuCuller(VulkanAPIHandler* vkAPIHandler, uint32_t framesInFlight) {
+	vulkanAPIHandler = vkAPIHandler;
+	device = vkAPIHandler->getDevice();
+	frameCount = framesInFlight;
+}
+
+void GpuCuller::addBatch(Mesh* mesh, uint32_t firstInstance, uint32_t instanceCount, bool isStatic) {
+	// Batches of the same mesh with different textures share its range of the packed buffers
+	auto meshRange = meshRanges.find(mesh);
+	if (meshRange == meshRanges.end()) {
+		MeshRange range = { (uint32_t)indices.size(), (int32_t)vertices.size() };
+		meshRange = meshRanges.emplace(mesh, range).first;
+
+		vertices.insert(vertices.end(), mesh->vertices.begin(), mesh->vertices.end());
+		indices.insert(indices.end(), mesh->indices.begin(), mesh->indices.end());
+	}
+
+	CullingBatch batch = {};
+	batch.boundingSphere = mesh->getBoundingSphere();
+	batch.indexCount = mesh->getIndexCount();
+	batch.firstIndex = meshRange->second.firstIndex;
+	batch.vertexOffset = meshRange->second.vertexOffset;
+	batch.firstInstance = firstInstance;
+	batch.instanceCount = instanceCount;
+	batch.isStatic = isStatic ? 1 : 0;
+
+	instanceBatches.resize(firstInstance + instanceCount, (uint32_t)batches.size());
+	batches.push_back(batch);
+}
+
+void GpuCuller::create(VkDeviceSize instanceSlot, DepthPyramid* depthPyramid) {
+	cullingUBO.counts = glm::uvec4(instanceBatches.size(), batches.size(), 0, 0);
+	cullingUBO.depthPyramid = glm::uvec4(DEPTH_PYRAMID_WIDTH, DEPTH_PYRAMID_HEIGHT, depthPyramid->getLevelCount(), 0);
+	setCamera(glm::mat4(1.0f), {}, false);
+	clearShadowViews();
+
+	createBuffers();
+	createDescriptorSets(instanceSlot, depthPyramid);
+	createPipeline();
+
+	printf("GPU culling: %u instances in %u batches, %u meshes packed into %llu KB, %llu KB of draw commands and instances per frame\n",
+		   (uint32_t)instanceBatches.size(),
+		   (uint32_t)batches.size(),
+		   (uint32_t)meshRanges.size(),
+		   (unsigned long long)(vertices.size() * sizeof(Vertex) + indices.size() * sizeof(uint32_t)) / 1024,
+		   (unsigned long long)(getIndirectBufferSize() + getVisibleInstanceBufferSize()) / 1024);
+
+	// The packed copies have been staged, the meshes keep their own
+	vertices.clear();
+	indices.clear();
+}
+
+void GpuCuller::setCamera(const glm::mat4& viewProjection, const std::array<glm::vec4, 6>& planes, bool frustumCulling) {
+	cullingUBO.cameraViewProjection = viewProjection;
+	for (uint32_t i = 0; i < planes.size(); i++) {
+		cullingUBO.frustumPlanes[i] = planes[i];
+	}
+
+	cullingUBO.views[CAMERA_CULLING_VIEW].x = frustumCulling ? 1 : 0;
+	cullingUBO.views[CAMERA_CULLING_VIEW].w = frustumCulling || cullingUBO.depthPyramid.w != 0 ? CULLING_VIEW_CAMERA : CULLING_VIEW_ALL;
+}
+
+void GpuCuller::setOcclusionCulling(bool enabled) {
+	cullingUBO.depthPyramid.w = enabled ? 1 : 0;
+	if (enabled) {
+		cullingUBO.views[CAMERA_CULLING_VIEW].w = CULLING_VIEW_CAMERA;
+	}
+}
+
+void GpuCuller::setLightPosition(uint32_t lightIndex, glm::vec4 position) {
+	cullingUBO.lightPositions[lightIndex] = position;
+}
+
+void GpuCuller::setShadowView(uint32_t view, uint32_t lightIndex, CullingViewType type, uint32_t staticFaces, uint32_t dynamicFaces) {
+	cullingUBO.views[view] = glm::uvec4(lightIndex, staticFaces, dynamicFaces, type);
+}
+
+void GpuCuller::clearShadowViews() {
+	for (uint32_t view = 0; view < NUM_CULLING_VIEWS; view++) {
+		if (view != CAMERA_CULLING_VIEW) {
+			cullingUBO.views[view] = glm::uvec4(0, 0, 0, CULLING_VIEW_NONE);
+		}
+	}
+}
+
+void GpuCuller::recordCulling(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	// The frame's region is no longer in use by the GPU at this point
+	uniformRingBuffer->write(frameIndex, uniformSlot, &cullingUBO, sizeof(cullingUBO));
+
+	// Every view starts out without instances, and the counts start at zero
+	VkBufferCopy copyRegion = {};
+	copyRegion.size = getIndirectBufferSize();
+	vkCmdCopyBuffer(commandBuffer, commandTemplateBuffer, indirectBuffers[frameIndex], 1, &copyRegion);
+	vkCmdFillBuffer(commandBuffer, statisticsBuffers[frameIndex], 0, VK_WHOLE_SIZE, 0);
+	statisticsWritten[frameIndex] = true;
+
+	std::array<VkBufferMemoryBarrier, 2> resetBarriers = {};
+	VkBufferMemoryBarrier& resetBarrier = resetBarriers[0];
+	resetBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	resetBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	resetBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	resetBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	resetBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	resetBarrier.buffer = indirectBuffers[frameIndex];
+	resetBarrier.offset = 0;
+	resetBarrier.size = VK_WHOLE_SIZE;
+
+	resetBarriers[1] = resetBarrier;
+	resetBarriers[1].buffer = statisticsBuffers[frameIndex];
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, resetBarriers.size(), resetBarriers.data(), 0, nullptr);
+
+	// One invocation per instance and view
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[frameIndex], 0, nullptr);
+	vkCmdDispatch(commandBuffer, (uint32_t(instanceBatches.size()) + CULLING_WORKGROUP_SIZE - 1) / CULLING_WORKGROUP_SIZE, NUM_CULLING_VIEWS, 1);
+
+	// The shadow passes draw from the results in the same command buffer. The scene pass waits for the
+	// offscreen semaphore at the draw indirect stage. The counts are read by the host after the fence
+	std::array<VkBufferMemoryBarrier, 3> resultBarriers = {};
+	resultBarriers[0] = resetBarrier;
+	resultBarriers[0].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	resultBarriers[0].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+
+	resultBarriers[1] = resultBarriers[0];
+	resultBarriers[1].dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+	resultBarriers[1].buffer = visibleInstanceBuffers[frameIndex];
+
+	resultBarriers[2] = resultBarriers[0];
+	resultBarriers[2].dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	resultBarriers[2].buffer = statisticsBuffers[frameIndex];
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, resultBarriers.size(), resultBarriers.data(), 0, nullptr);
+}
+
+void GpuCuller::collectStatistics(uint32_t frameIndex) {
+	if (!statisticsWritten[frameIndex]) {
+		return;
+	}
+
+	CullingStatistics frameStatistics = *reinterpret_cast<CullingStatistics*>(statisticsBufferMemories[frameIndex].getMappedData());
+	statistics.instancesTested += frameStatistics.instancesTested;
+	statistics.frustumCulled += frameStatistics.frustumCulled;
+	statistics.occlusionCulled += frameStatistics.occlusionCulled;
+	statisticsWritten[frameIndex] = false;
+}
+
+const CullingStatistics& GpuCuller::getStatistics() {
+	return statistics;
+}
+
+void GpuCuller::resetStatistics() {
+	statistics = {};
+}
+
+VkBuffer GpuCuller::getVertexBuffer() {
+	return vertexBuffer;
+}
+
+VkBuffer GpuCuller::getIndexBuffer() {
+	return indexBuffer;
+}
+
+VkBuffer GpuCuller::getIndirectBuffer(uint32_t frameIndex) {
+	return indirectBuffers[frameIndex];
+}
+
+VkDeviceSize GpuCuller::getIndirectOffset(uint32_t view, uint32_t batchIndex) {
+	return (view * batches.size() + batchIndex) * sizeof(VkDrawIndexedIndirectCommand);
+}
+
+VkBuffer GpuCuller::getVisibleInstanceBuffer(uint32_t frameIndex) {
+	return visibleInstanceBuffers[frameIndex];
+}
+
+// Every view has room for all instances. A batch's visible instances start at its first instance, so the draw
+// commands can leave firstInstance at 0 and do not need the drawIndirectFirstInstance feature
+VkDeviceSize GpuCuller::getVisibleInstanceOffset(uint32_t view, uint32_t firstInstance) {
+	return (view * instanceBatches.size() + firstInstance) * sizeof(InstanceData);
+}
+
+uint32_t GpuCuller::getShadowView(uint32_t lightIndex, uint32_t faceIndex) {
+	return 1 + lightIndex * NUM_CUBE_FACES + faceIndex;
+}
+
+VkDeviceSize GpuCuller::getIndirectBufferSize() {
+	return std::max<VkDeviceSize>(1, NUM_CULLING_VIEWS * batches.size()) * sizeof(VkDrawIndexedIndirectCommand);
+}
+
+VkDeviceSize GpuCuller::getVisibleInstanceBufferSize() {
+	return std::max<VkDeviceSize>(1, NUM_CULLING_VIEWS * instanceBatches.size()) * sizeof(InstanceData);
+}
+
+void GpuCuller::createBuffers() {
+	UploadBatcher* batcher = vulkanAPIHandler->getStreamingBatcher();
+
+	// Shared geometry
+	VkDeviceSize bufferSize = sizeof(Vertex) * std::max<size_t>(1, vertices.size());
+	vulkanAPIHandler->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+	if (!vertices.empty()) {
+		batcher->uploadBuffer(vertices.data(), sizeof(Vertex) * vertices.size(), vertexBuffer);
+	}
+
+	bufferSize = sizeof(uint32_t) * std::max<size_t>(1, indices.size());
+	vulkanAPIHandler->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+	if (!indices.empty()) {
+		batcher->uploadBuffer(indices.data(), sizeof(uint32_t) * indices.size(), indexBuffer);
+	}
+
+	// What the culling shader reads about the batches and instances
+	bufferSize = sizeof(CullingBatch) * std::max<size_t>(1, batches.size());
+	vulkanAPIHandler->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, batchBuffer, batchBufferMemory);
+	if (!batches.empty()) {
+		batcher->uploadBuffer(batches.data(), sizeof(CullingBatch) * batches.size(), batchBuffer);
+	}
+
+	bufferSize = sizeof(uint32_t) * std::max<size_t>(1, instanceBatches.size());
+	vulkanAPIHandler->createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, instanceBatchBuffer, instanceBatchBufferMemory);
+	if (!instanceBatches.empty()) {
+		batcher->uploadBuffer(instanceBatches.data(), sizeof(uint32_t) * instanceBatches.size(), instanceBatchBuffer);
+	}
+
+	// The culling shader only counts the instances of the draw commands, everything else stays as it is here
+	std::vector<VkDrawIndexedIndirectCommand> drawCommands(getIndirectBufferSize() / sizeof(VkDrawIndexedIndirectCommand));
+	for (uint32_t view = 0; view < NUM_CULLING_VIEWS; view++) {
+		for (uint32_t i = 0; i < batches.size(); i++) {
+			VkDrawIndexedIndirectCommand& drawCommand = drawCommands[view * batches.size() + i];
+			drawCommand.indexCount = batches[i].indexCount;
+			drawCommand.instanceCount = 0;
+			drawCommand.firstIndex = batches[i].firstIndex;
+			drawCommand.vertexOffset = batches[i].vertexOffset;
+			drawCommand.firstInstance = 0;
+		}
+	}
+
+	vulkanAPIHandler->createBuffer(getIndirectBufferSize(), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, commandTemplateBuffer, commandTemplateBufferMemory);
+	batcher->uploadBuffer(drawCommands.data(), getIndirectBufferSize(), commandTemplateBuffer);
+
+	// Results, one set per frame in flight
+	indirectBufferMemories.resize(frameCount);
+	visibleInstanceBufferMemories.resize(frameCount);
+	statisticsBufferMemories.resize(frameCount);
+	statisticsWritten.assign(frameCount, false);
+	indirectBuffers.reserve(frameCount);
+	visibleInstanceBuffers.reserve(frameCount);
+	statisticsBuffers.reserve(frameCount);
+
+	for (uint32_t frame = 0; frame < frameCount; frame++) {
+		indirectBuffers.emplace_back(VDeleter<VkBuffer>{ device, vkDestroyBuffer });
+		visibleInstanceBuffers.emplace_back(VDeleter<VkBuffer>{ device, vkDestroyBuffer });
+		statisticsBuffers.emplace_back(VDeleter<VkBuffer>{ device, vkDestroyBuffer });
+	}
+
+	for (uint32_t frame = 0; frame < frameCount; frame++) {
+		vulkanAPIHandler->createBuffer(getIndirectBufferSize(),
+									   VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+									   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+									   indirectBuffers[frame],
+									   indirectBufferMemories[frame]);
+
+		vulkanAPIHandler->createBuffer(getVisibleInstanceBufferSize(),
+									   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+									   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+									   visibleInstanceBuffers[frame],
+									   visibleInstanceBufferMemories[frame]);
+
+		vulkanAPIHandler->createBuffer(sizeof(CullingStatistics),
+									   VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+									   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+									   statisticsBuffers[frame],
+									   statisticsBufferMemories[frame]);
+	}
+
+	uniformRingBuffer = std::make_unique<FrameRingBuffer>(vulkanAPIHandler, frameCount);
+	uniformSlot = uniformRingBuffer->reserve(sizeof(CullingUBO));
+	uniformRingBuffer->create();
+}
+
+void GpuCuller::createDescriptorSets(VkDeviceSize instanceSlot, DepthPyramid* depthPyramid) {
+	// The parameters, the frame's instances, the batches, the batch of every instance, the draw commands, the visible instances,
+	// the depth pyramid and the statistics
+	std::array<VkDescriptorSetLayoutBinding, 8> layoutBindings = {};
+	for (uint32_t i = 0; i < layoutBindings.size(); i++) {
+		layoutBindings[i].binding = i;
+		layoutBindings[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		layoutBindings[i].descriptorCount = 1;
+		layoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+	layoutBindings[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = layoutBindings.size();
+	layoutInfo.pBindings = layoutBindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, descriptorSetLayout.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create culling descriptor set layout!");
+	}
+
+	std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = frameCount;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount = (layoutBindings.size() - 2) * frameCount;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[2].descriptorCount = frameCount;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = poolSizes.size();
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = frameCount;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, descriptorPool.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create culling descriptor pool!");
+	}
+
+	std::vector<VkDescriptorSetLayout> layouts(frameCount, descriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = frameCount;
+	allocInfo.pSetLayouts = layouts.data();
+
+	descriptorSets.resize(frameCount);
+	if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate culling descriptor sets!");
+	}
+
+	FrameRingBuffer* instanceRingBuffer = vulkanAPIHandler->getInstanceRingBuffer();
+
+	VkDescriptorImageInfo pyramidInfo = {};
+	pyramidInfo.sampler = depthPyramid->getSampler();
+	pyramidInfo.imageView = depthPyramid->getImageView();
+	pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	for (uint32_t frame = 0; frame < frameCount; frame++) {
+		std::array<VkDescriptorBufferInfo, 8> bufferInfos = {};
+		bufferInfos[0] = { uniformRingBuffer->getBuffer(), uniformRingBuffer->getOffset(frame, uniformSlot), sizeof(CullingUBO) };
+		bufferInfos[1] = { instanceRingBuffer->getBuffer(), instanceRingBuffer->getOffset(frame, instanceSlot), std::max<VkDeviceSize>(1, instanceBatches.size()) * sizeof(InstanceData) };
+		bufferInfos[2] = { batchBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[3] = { instanceBatchBuffer, 0, VK_WHOLE_SIZE };
+		bufferInfos[4] = { indirectBuffers[frame], 0, VK_WHOLE_SIZE };
+		bufferInfos[5] = { visibleInstanceBuffers[frame], 0, VK_WHOLE_SIZE };
+		bufferInfos[7] = { statisticsBuffers[frame], 0, VK_WHOLE_SIZE };
+
+		std::array<VkWriteDescriptorSet, 8> descriptorWrites = {};
+		for (uint32_t i = 0; i < descriptorWrites.size(); i++) {
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = descriptorSets[frame];
+			descriptorWrites[i].dstBinding = i;
+			descriptorWrites[i].dstArrayElement = 0;
+			descriptorWrites[i].descriptorType = layoutBindings[i].descriptorType;
+			descriptorWrites[i].descriptorCount = 1;
+			descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+		}
+		descriptorWrites[6].pBufferInfo = nullptr;
+		descriptorWrites[6].pImageInfo = &pyramidInfo;
+
+		vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void GpuCuller::createPipeline() {
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	VkDescriptorSetLayout setLayout = descriptorSetLayout;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, pipelineLayout.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create culling pipeline layout!");
+	}
+
+	auto compShaderCode = ShaderHandler::readFile("Shaders/cull.spv");
+	VDeleter<VkShaderModule> compShaderModule{ device, vkDestroyShaderModule };
+	vulkanAPIHandler->createShaderModule(compShaderCode, compShaderModule);
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = compShaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = pipelineLayout;
+
+	if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, pipeline.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create culling pipeline!");
+	}
+}
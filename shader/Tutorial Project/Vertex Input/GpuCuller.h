@@ -0,0 +1,113 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <array>
+#include <map>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "VDeleter.h"
+#include "DeviceMemoryAllocator.h"
+#include "Structs.h"
+
+class VulkanAPIHandler;
+class Mesh;
+class FrameRingBuffer;
+class DepthPyramid;
+
+// GPU driven drawing of the instance batches. A compute shader tests every instance against every culling view
+// and appends the visible ones to the view's copy of the instance buffer, counting them in one
+// VkDrawIndexedIndirectCommand per batch and view. Drawing a view then costs one indirect draw per batch on the
+// CPU, however many instances there are. All meshes are packed into one vertex and one index buffer.
+//
+// View CAMERA_CULLING_VIEW is the scene pass, the others belong to the shadow map faces, see getShadowView.
+// The camera view can also be tested against a DepthPyramid of the occluders. The output buffers exist once per
+// frame in flight, they are read by the frame's offscreen and scene passes
+class GpuCuller {
+public:
+	GpuCuller(VulkanAPIHandler* vkAPIHandler, uint32_t framesInFlight);
+
+	// Batches have to be added in instance order before create()
+	void addBatch(Mesh* mesh, uint32_t firstInstance, uint32_t instanceCount, bool isStatic);
+	// instanceSlot is where the instance data of every frame is in the instance ring buffer
+	void create(VkDeviceSize instanceSlot, DepthPyramid* depthPyramid);
+
+	void setCamera(const glm::mat4& viewProjection, const std::array<glm::vec4, 6>& planes, bool frustumCulling);
+	// Only enable once the depth pyramid has been built
+	void setOcclusionCulling(bool enabled);
+	void setLightPosition(uint32_t lightIndex, glm::vec4 position);
+	// Faces are cube faces or paraboloid halves. Static and moving batches can be tested against different faces
+	void setShadowView(uint32_t view, uint32_t lightIndex, CullingViewType type, uint32_t staticFaces, uint32_t dynamicFaces);
+	// Shadow views that are not set again before the next recordCulling() draw nothing
+	void clearShadowViews();
+	// Has to be recorded before anything draws the frame's views. Also makes the results visible to the draws
+	// recorded after it in the same command buffer
+	void recordCulling(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	// Adds the frame's counts to the statistics. Only call after the frame's fence has signaled
+	void collectStatistics(uint32_t frameIndex);
+	const CullingStatistics& getStatistics();
+	void resetStatistics();
+
+	VkBuffer getVertexBuffer();
+	VkBuffer getIndexBuffer();
+	VkBuffer getIndirectBuffer(uint32_t frameIndex);
+	VkDeviceSize getIndirectOffset(uint32_t view, uint32_t batchIndex);
+	VkBuffer getVisibleInstanceBuffer(uint32_t frameIndex);
+	VkDeviceSize getVisibleInstanceOffset(uint32_t view, uint32_t firstInstance);
+
+	static uint32_t getShadowView(uint32_t lightIndex, uint32_t faceIndex);
+private:
+	// Where a mesh is in the shared vertex and index buffers
+	struct MeshRange {
+		uint32_t firstIndex;
+		int32_t vertexOffset;
+	};
+
+	VulkanAPIHandler* vulkanAPIHandler;
+	VDeleter<VkDevice> device;
+	uint32_t frameCount;
+
+	std::vector<CullingBatch> batches;
+	std::vector<uint32_t> instanceBatches;
+	std::map<Mesh*, MeshRange> meshRanges;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	CullingUBO cullingUBO{};
+
+	VDeleter<VkBuffer> vertexBuffer{ device, vkDestroyBuffer };
+	MemoryAllocation vertexBufferMemory;
+	VDeleter<VkBuffer> indexBuffer{ device, vkDestroyBuffer };
+	MemoryAllocation indexBufferMemory;
+	VDeleter<VkBuffer> batchBuffer{ device, vkDestroyBuffer };
+	MemoryAllocation batchBufferMemory;
+	VDeleter<VkBuffer> instanceBatchBuffer{ device, vkDestroyBuffer };
+	MemoryAllocation instanceBatchBufferMemory;
+	// The draw commands of every view with no instances, copied over the frame's commands before culling
+	VDeleter<VkBuffer> commandTemplateBuffer{ device, vkDestroyBuffer };
+	MemoryAllocation commandTemplateBufferMemory;
+
+	// One of each per frame in flight
+	std::vector<VDeleter<VkBuffer>> indirectBuffers;
+	std::vector<MemoryAllocation> indirectBufferMemories;
+	std::vector<VDeleter<VkBuffer>> visibleInstanceBuffers;
+	std::vector<MemoryAllocation> visibleInstanceBufferMemories;
+	// Host visible, so the counts can be read once the frame has finished
+	std::vector<VDeleter<VkBuffer>> statisticsBuffers;
+	std::vector<MemoryAllocation> statisticsBufferMemories;
+	std::vector<bool> statisticsWritten;
+	CullingStatistics statistics{};
+	std::unique_ptr<FrameRingBuffer> uniformRingBuffer;
+	VkDeviceSize uniformSlot{0};
+
+	VDeleter<VkDescriptorSetLayout> descriptorSetLayout{ device, vkDestroyDescriptorSetLayout };
+	VDeleter<VkDescriptorPool> descriptorPool{ device, vkDestroyDescriptorPool };
+	std::vector<VkDescriptorSet> descriptorSets;
+	VDeleter<VkPipelineLayout> pipelineLayout{ device, vkDestroyPipelineLayout };
+	VDeleter<VkPipeline> pipeline{ device, vkDestroyPipeline };
+
+	VkDeviceSize getIndirectBufferSize();
+	VkDeviceSize getVisibleInstanceBufferSize();
+	void createBuffers();
+	void createDescriptorSets(VkDeviceSize instanceSlot, DepthPyramid* depthPyramid);
+	void createPipeline();
+};
@@ -0,0 +1,156 @@
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+#include "MeshCache.h"
+#include "VulkanAPIHandler.h"
+
+Mesh::Mesh(VulkanAPIHandler* vkAPIHandler) {
+	vulkanAPIHandler = vkAPIHandler;
+	device = vkAPIHandler->getDevice();
+}
+
+void Mesh::createBuffers() {
+	if (buffersCreated) {
+		return;
+	}
+	buffersCreated = true;
+
+	// Sphere around the bounding box, the vertices are final at this point
+	glm::vec3 minimum(std::numeric_limits<float>::max());
+	glm::vec3 maximum(-std::numeric_limits<float>::max());
+	for (const Vertex& vertex : vertices) {
+		minimum = glm::min(minimum, glm::vec3(vertex.position));
+		maximum = glm::max(maximum, glm::vec3(vertex.position));
+	}
+	if (!vertices.empty()) {
+		boundingSphere = glm::vec4((minimum + maximum) * 0.5f, glm::length(maximum - minimum) * 0.5f);
+	}
+
+	// Create Vertex buffer
+	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+
+	vulkanAPIHandler->createBuffer(
+		bufferSize, 
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
+		vertexBuffer, 
+		vertexBufferMemory);
+
+	// The staging memory belongs to the upload batcher and is released once the batch has executed
+	vulkanAPIHandler->getStreamingBatcher()->uploadBuffer(vertices.data(), bufferSize, vertexBuffer);
+
+	// Create Index buffer
+	bufferSize = sizeof(indices[0]) * indices.size();
+
+	vulkanAPIHandler->createBuffer(
+		bufferSize, 
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
+		indexBuffer, 
+		indexBufferMemory);
+
+	vulkanAPIHandler->getStreamingBatcher()->uploadBuffer(indices.data(), bufferSize, indexBuffer);
+}
+
+VkBuffer Mesh::getVertexBuffer() {
+	return vertexBuffer;
+}
+
+VkBuffer Mesh::getIndexBuffer() {
+	return indexBuffer;
+}
+
+uint32_t Mesh::getIndexCount() {
+	return indices.size();
+}
+
+glm::vec4 Mesh::getBoundingSphere() {
+	return boundingSphere;
+}
+
+MeshCache::MeshCache(VulkanAPIHandler* vkAPIHandler) {
+	vulkanAPIHandler = vkAPIHandler;
+}
+
+std::shared_ptr<Mesh> MeshCache::load(const std::string& modelPath, bool invertNormals) {
+	MeshKey key(modelPath, invertNormals);
+
+	auto cached = meshes.find(key);
+	if (cached != meshes.end()) {
+		if (std::shared_ptr<Mesh> mesh = cached->second.lock()) {
+			cacheHits++;
+			return mesh;
+		}
+	}
+
+	auto mesh = std::make_shared<Mesh>(vulkanAPIHandler);
+	loadModel(mesh.get(), modelPath, invertNormals);
+	meshes[key] = mesh;
+	modelsLoaded++;
+
+	return mesh;
+}
+
+void MeshCache::printStatistics() {
+	printf("Mesh cache: %u models loaded, %u loads shared an existing mesh\n", modelsLoaded, cacheHits);
+}
+
+void MeshCache::loadModel(Mesh* mesh, const std::string& modelPath, bool invertNormals) {
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+	std::string err;
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, modelPath.c_str())) {
+		throw std::runtime_error(err);
+	}
+
+	std::unordered_map<Vertex, int> uniqueVertices = {};
+	std::vector<Vertex>& vertices = mesh->vertices;
+	std::vector<uint32_t>& indices = mesh->indices;
+
+	for (const auto& shape : shapes) {
+		for (const auto& index : shape.mesh.indices) {
+			Vertex vertex = {};
+
+			// Vertices consist of 3 floats so we need to offset by multiplying the index with 3
+			vertex.position = {
+				attrib.vertices[3 * index.vertex_index + 0],
+				attrib.vertices[3 * index.vertex_index + 1],
+				attrib.vertices[3 * index.vertex_index + 2],
+				1.0f
+			};
+
+			// The colour of the renderable is applied from its uniform buffer
+			vertex.color = glm::vec4(1.f, 1.f, 1.f, 1.f);
+
+			if (attrib.texcoords.size() != 0) {
+				// The same goes for texture coordinates where we use 2 instead
+				vertex.texCoord = {
+					attrib.texcoords[2 * index.texcoord_index + 0],
+					// The origin of texture coordinates in vulkan is in the top left corner so we are flipping this vertical component
+					1.0f - attrib.texcoords[2 * index.texcoord_index + 1],
+					0,
+					1
+				};
+			}
+			
+			if (attrib.normals.size() != 0) {
+				vertex.normal = {
+					attrib.normals[3 * index.normal_index + 0],
+					attrib.normals[3 * index.normal_index + 1],
+					attrib.normals[3 * index.normal_index + 2],
+					0
+				};
+				vertex.normal *= (invertNormals ? -1.f : 1.f);
+			}
+
+			// Performing vertex deduplication
+			if (uniqueVertices.count(vertex) == 0) {
+				uniqueVertices[vertex] = vertices.size();
+				vertices.push_back(vertex);
+			}
+
+			indices.push_back(uniqueVertices[vertex]);
+		}
+	}
+}
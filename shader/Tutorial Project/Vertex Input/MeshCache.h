@@ -0,0 +1,63 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Structs.h"
+#include "VDeleter.h"
+
+class VulkanAPIHandler;
+
+// Vertex and index data plus the GPU buffers holding it. Shared by every renderable drawing the same model,
+// anything that differs between them (transform, colour, material) lives in the instance buffer
+class Mesh {
+public:
+	Mesh(VulkanAPIHandler* vkAPIHandler);
+
+	std::vector<Vertex> vertices{};
+	std::vector<uint32_t> indices{};
+
+	// Only uploads the first time it is called, the other users of the mesh get the same buffers
+	void createBuffers();
+
+	VkBuffer getVertexBuffer();
+	VkBuffer getIndexBuffer();
+	uint32_t getIndexCount();
+	// Center in model space in xyz, radius in w. Valid once the buffers have been created
+	glm::vec4 getBoundingSphere();
+private:
+	VulkanAPIHandler* vulkanAPIHandler;
+	VDeleter<VkDevice> device;
+
+	bool buffersCreated{false};
+	glm::vec4 boundingSphere{0.f};
+
+	VDeleter<VkBuffer> vertexBuffer{ device, vkDestroyBuffer };
+	MemoryAllocation vertexBufferMemory;
+	VDeleter<VkBuffer> indexBuffer{ device, vkDestroyBuffer };
+	MemoryAllocation indexBufferMemory;
+};
+
+// Loads every model once. The cache only holds weak references, so a mesh and its buffers are
+// released as soon as the last renderable using it is destroyed
+class MeshCache {
+public:
+	MeshCache(VulkanAPIHandler* vkAPIHandler);
+
+	std::shared_ptr<Mesh> load(const std::string& modelPath, bool invertNormals);
+
+	void printStatistics();
+private:
+	// Everything that changes the loaded vertex data has to be part of the key
+	typedef std::pair<std::string, bool> MeshKey;
+
+	VulkanAPIHandler* vulkanAPIHandler;
+	std::map<MeshKey, std::weak_ptr<Mesh>> meshes;
+
+	uint32_t modelsLoaded{0};
+	uint32_t cacheHits{0};
+
+	void loadModel(Mesh* mesh, const std::string& modelPath, bool invertNormals);
+};
@@ -65,8 +65,8 @@ void Moveable::moveTowardsDirection(MoveableDirections direction) {
 
 void Moveable::setupCollider() {
 	// Finding collider bounds
-	auto minMaxX = std::minmax_element(vertices.begin(), vertices.end(), [](const Vertex& a, const Vertex& b) { return a.position.x < b.position.x; });
-	auto minMaxZ = std::minmax_element(vertices.begin(), vertices.end(), [](const Vertex& a, const Vertex& b) { return a.position.z < b.position.z; });
+	auto minMaxX = std::minmax_element(mesh->vertices.begin(), mesh->vertices.end(), [](const Vertex& a, const Vertex& b) { return a.position.x < b.position.x; });
+	auto minMaxZ = std::minmax_element(mesh->vertices.begin(), mesh->vertices.end(), [](const Vertex& a, const Vertex& b) { return a.position.z < b.position.z; });
 	lowestX =  (*minMaxX.first).position.x * scale.x;
 	highestX = (*minMaxX.second).position.x * scale.x;
 	lowestZ =  (*minMaxZ.first).position.z * scale.z;
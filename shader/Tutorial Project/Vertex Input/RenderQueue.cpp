@@ -0,0 +1,68 @@
+#include "RenderQueue.h"
+#include <algorithm>
+#include <array>
+#include <string>
+#include "consts.h"
+
+void RenderQueue::clear() {
+	keys.clear();
+}
+
+void RenderQueue::push(uint32_t item, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth) {
+	uint32_t depthBits = uint32_t(std::min(std::max(depth, 0.f), 1.f) * ((1u << SORT_KEY_DEPTH_BITS) - 1));
+
+	uint64_t key = uint64_t(pipeline & ((1u << SORT_KEY_PIPELINE_BITS) - 1));
+	key = (key << SORT_KEY_MATERIAL_BITS) | (material & ((1u << SORT_KEY_MATERIAL_BITS) - 1));
+	key = (key << SORT_KEY_MESH_BITS) | (mesh & ((1u << SORT_KEY_MESH_BITS) - 1));
+	key = (key << SORT_KEY_DEPTH_BITS) | depthBits;
+	key = (key << SORT_KEY_ITEM_BITS) | (item & ((1u << SORT_KEY_ITEM_BITS) - 1));
+
+	keys.push_back(key);
+}
+
+void RenderQueue::sort() {
+	sortBuffer.resize(keys.size());
+	sortPasses = 0;
+
+	for (uint32_t shift = 0; shift < 64; shift += 8) {
+		std::array<uint32_t, 256> offsets = {};
+		for (uint64_t key : keys) {
+			offsets[(key >> shift) & 0xFF]++;
+		}
+
+		// Every key has the same byte, the order does not change
+		if (offsets[(keys.empty() ? 0 : keys[0] >> shift) & 0xFF] == keys.size()) {
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for (auto& count : offsets) {
+			uint32_t bucketSize = count;
+			count = offset;
+			offset += bucketSize;
+		}
+
+		// Stable, so the order of the lower bytes is kept within every bucket
+		for (uint64_t key : keys) {
+			sortBuffer[offsets[(key >> shift) & 0xFF]++] = key;
+		}
+
+		keys.swap(sortBuffer);
+		sortPasses++;
+	}
+}
+
+uint32_t RenderQueue::size() {
+	return keys.size();
+}
+
+void RenderQueue::getItems(std::vector<uint32_t>& items) {
+	items.resize(keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		items[i] = uint32_t(keys[i] & ((1u << SORT_KEY_ITEM_BITS) - 1));
+	}
+}
+
+uint32_t RenderQueue::getSortPasses() {
+	return sortPasses;
+}
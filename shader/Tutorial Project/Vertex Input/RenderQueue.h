@@ -0,0 +1,24 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Draws of a pass sorted by the state they need, so consecutive draws can share their binds. Every draw gets a
+// 64 bit key of its pipeline, material, mesh and depth, from the most to the least significant bits, with the
+// draw's item in the lowest SORT_KEY_ITEM_BITS. The keys are sorted with an LSD radix sort, one byte per pass.
+// Bytes that are the same in every key are skipped, so unused key fields cost nothing
+class RenderQueue {
+public:
+	void clear();
+	// Ids are cut to their SORT_KEY_*_BITS. depth goes from 0 at the camera to 1 at the far plane, nearer draws come first
+	void push(uint32_t item, uint32_t pipeline, uint32_t material, uint32_t mesh, float depth);
+	void sort();
+	uint32_t size();
+	// The items in sorted order
+	void getItems(std::vector<uint32_t>& items);
+	// Radix passes the last sort needed
+	uint32_t getSortPasses();
+private:
+	std::vector<uint64_t> keys;
+	std::vector<uint64_t> sortBuffer;
+	uint32_t sortPasses{0};
+};
@@ -1,7 +1,3 @@
-#define STB_IMAGE_IMPLEMENTATION
-#define TINYOBJLOADER_IMPLEMENTATION
-#include "stb_image.h"
-#include "tiny_obj_loader.h"
 #include "Renderable.h"
 #include "VulkanAPIHandler.h"
 
@@ -15,7 +11,7 @@ Renderable::Renderable(VulkanAPIHandler* vkAPIHandler, glm::vec4 pos, std::strin
 	modelPath = meshPath;
 	position = pos;
 
-	loadModel(invertedNormals);
+	mesh = vkAPIHandler->getMeshCache()->load(modelPath, invertedNormals);
 }
 
 Renderable::Renderable(VulkanAPIHandler* vkAPIHandler, glm::vec4 pos, std::string texPath, std::string meshPath, glm::vec3 renderableScale, glm::vec4 c, bool invertedNormals) {
@@ -27,7 +23,7 @@ Renderable::Renderable(VulkanAPIHandler* vkAPIHandler, glm::vec4 pos, std::strin
 	baseColor = c;
 	scale = renderableScale;
 
-	loadModel(invertedNormals);
+	mesh = vkAPIHandler->getMeshCache()->load(modelPath, invertedNormals);
 }
 
 Renderable::Renderable(VulkanAPIHandler* vkAPIHandler, glm::vec3 renderableScale, glm::vec4 c, bool invertedNormals) {
@@ -36,7 +32,7 @@ Renderable::Renderable(VulkanAPIHandler* vkAPIHandler, glm::vec3 renderableScale
 	scale = renderableScale;
 	baseColor = c;
 
-	loadModel(invertedNormals);
+	mesh = vkAPIHandler->getMeshCache()->load(modelPath, invertedNormals);
 }
 
 Renderable::Renderable(VulkanAPIHandler* vkAPIHandler, glm::vec4 pos, std::string texPath) {
@@ -50,212 +46,40 @@ Renderable::~Renderable() {
 }
 
 void Renderable::createVertexIndexBuffers() {
-	// Create Vertex buffer
-	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
-
-	VDeleter<VkBuffer> vertexStagingBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> vertexStagingBufferMemory{ device, vkFreeMemory };
-	
-	vulkanAPIHandler->createBuffer(
-		bufferSize, 
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		vertexStagingBuffer, 
-		vertexStagingBufferMemory);
-
-	void* vertexData;
-	vkMapMemory(device, vertexStagingBufferMemory, 0, bufferSize, 0, &vertexData);
-	memcpy(vertexData, vertices.data(), (size_t)bufferSize);
-	vkUnmapMemory(device, vertexStagingBufferMemory);
-
-	vulkanAPIHandler->createBuffer(
-		bufferSize, 
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
-		vertexBuffer, 
-		vertexBufferMemory);
-
-	vulkanAPIHandler->copyBuffer(vertexStagingBuffer, vertexBuffer, bufferSize);
-
-	// Create Index buffer
-	bufferSize = sizeof(indices[0]) * indices.size();
-
-	VDeleter<VkBuffer> indexStagingBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> indexStagingBufferMemory{ device, vkFreeMemory };
-	vulkanAPIHandler->createBuffer(
-		bufferSize, 
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-		indexStagingBuffer, 
-		indexStagingBufferMemory);
-
-	void* indexData;
-	vkMapMemory(device, indexStagingBufferMemory, 0, bufferSize, 0, &indexData);
-	memcpy(indexData, indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(device, indexStagingBufferMemory);
-
-	vulkanAPIHandler->createBuffer(
-		bufferSize, 
-		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
-		indexBuffer, 
-		indexBufferMemory);
-
-	vulkanAPIHandler->copyBuffer(indexStagingBuffer, indexBuffer, bufferSize);
+	// Renderables sharing the mesh share its buffers as well, only the first call uploads anything
+	mesh->createBuffers();
 }
 
-void Renderable::createUniformBuffers() {
-	// NOTE: sizeof(RenderableUBO) will make the staging buffer work for both the UBO and Material since the material has a smaller size.
-	// Creating another staging buffer just for the material would be expensive, but the current way this is handled isn't exactly very clear.
-	// The current approach requires that the staging buffer is the same size as the current largest buffer struct for the class. 
-	vulkanAPIHandler->createBuffer(sizeof(RenderableUBO), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, uniformStagingBuffer, uniformStagingBufferMemory);
-	
-	vulkanAPIHandler->createBuffer(sizeof(RenderableUBO), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, uniformBuffer, uniformBufferMemory);
-	vulkanAPIHandler->createBuffer(sizeof(RenderableMaterialUBO), VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, materialBuffer, materialBufferMemory);
+std::shared_ptr<Mesh> Renderable::getMesh() {
+	return mesh;
 }
 
 VkBuffer Renderable::getVertexBuffer() {
-	return vertexBuffer;
+	return mesh->getVertexBuffer();
 }
 
 VkBuffer Renderable::getIndexBuffer() {
-	return indexBuffer;
+	return mesh->getIndexBuffer();
 }
 
 int Renderable::numIndices() {
-	return indices.size();
+	return mesh->getIndexCount();
 }
 
 glm::vec3 Renderable::getPosition() {
 	return position;
 }
 
-void Renderable::loadModel(bool invertNormals) {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string err;
-
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, modelPath.c_str())) {
-		throw std::runtime_error(err);
-	}
+glm::vec4 Renderable::getBoundingSphere() {
+	glm::vec4 meshSphere = mesh->getBoundingSphere();
+	float maxScale = std::max(scale.x, std::max(scale.y, scale.z));
 
-	std::unordered_map<Vertex, int> uniqueVertices = {};
-
-	for (const auto& shape : shapes) {
-		for (const auto& index : shape.mesh.indices) {
-			Vertex vertex = {};
-
-			// Vertices consist of 3 floats so we need to offset by multiplying the index with 3
-			vertex.position = {
-				attrib.vertices[3 * index.vertex_index + 0],
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2],
-				1.0f
-			};
-
-			vertex.color = baseColor;
-
-			if (attrib.texcoords.size() != 0) {
-				// The same goes for texture coordinates where we use 2 instead
-				vertex.texCoord = {
-					attrib.texcoords[2 * index.texcoord_index + 0],
-					// The origin of texture coordinates in vulkan is in the top left corner so we are flipping this vertical component
-					1.0f - attrib.texcoords[2 * index.texcoord_index + 1],
-					0,
-					1
-				};
-			}
-			
-			if (attrib.normals.size() != 0) {
-				vertex.normal = {
-					attrib.normals[3 * index.normal_index + 0],
-					attrib.normals[3 * index.normal_index + 1],
-					attrib.normals[3 * index.normal_index + 2],
-					0
-				};
-				vertex.normal *= (invertNormals ? -1.f : 1.f);
-			}
-
-			// Performing vertex deduplication
-			if (uniqueVertices.count(vertex) == 0) {
-				uniqueVertices[vertex] = vertices.size();
-				vertices.push_back(vertex);
-			}
-
-			indices.push_back(uniqueVertices[vertex]);
-		}
-	}
+	return glm::vec4(position + glm::vec3(meshSphere) * scale, meshSphere.w * maxScale);
 }
 
 void Renderable::createTextureImage() {
-	const int BYTES_PER_PIXEL = 4;
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(texturePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	VkDeviceSize imageSize = texWidth * texHeight * BYTES_PER_PIXEL;
-
-	if (!pixels) {
-		throw std::runtime_error("failed to load texture image!");
-	}
-
-	VDeleter<VkImage> stagingImage{ device, vkDestroyImage };
-	VDeleter<VkDeviceMemory> stagingImageMemory{ device, vkFreeMemory };
-	vulkanAPIHandler->createImage(
-		texWidth,
-		texHeight,
-		VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_TILING_LINEAR,
-		VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingImage,
-		stagingImageMemory);
-
-	VkImageSubresource subresource = {};
-	subresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	subresource.mipLevel = 0;
-	subresource.arrayLayer = 0;
-
-	VkSubresourceLayout stagingImageLayout;
-	vkGetImageSubresourceLayout(device, stagingImage, &subresource, &stagingImageLayout);
-
-	void* data;
-	vkMapMemory(device, stagingImageMemory, 0, imageSize, 0, &data);
-
-	// Handling cases where the image has padding bytes
-	if (stagingImageLayout.rowPitch == texWidth * BYTES_PER_PIXEL) {
-		memcpy(data, pixels, (size_t)imageSize);
-	}
-	else {
-		uint8_t* dataBytes = reinterpret_cast<uint8_t*>(data);
-
-		for (int y = 0; y < texHeight; y++) {
-			memcpy(&dataBytes[y * stagingImageLayout.rowPitch], &pixels[y * texWidth * BYTES_PER_PIXEL], texWidth * BYTES_PER_PIXEL);
-		}
-	}
-	vkUnmapMemory(device, stagingImageMemory);
-	stbi_image_free(pixels);
-
-	// Creating the final texture image
-	vulkanAPIHandler->createImage(
-		texWidth,
-		texHeight,
-		VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		textureImage,
-		textureImageMemory
-	);
-
-	// Copying staging image to the texture image
-	vulkanAPIHandler->transitionImageLayout(stagingImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-	vulkanAPIHandler->transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_PREINITIALIZED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-	vulkanAPIHandler->copyImage(stagingImage, textureImage, texWidth, texHeight);
-	vulkanAPIHandler->transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-}
-
-void Renderable::createTextureImageView() {
-	vulkanAPIHandler->createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, textureImageView);
+	// Only the first renderable using a file decodes and uploads it, the image view is created along with it
+	texture = vulkanAPIHandler->getTextureCache()->load(texturePath);
 }
 
 void Renderable::createTextureSampler() {
@@ -277,35 +101,33 @@ void Renderable::createTextureSampler() {
 	samplerInfo.minLod = 0.0f;
 	samplerInfo.maxLod = 0.0f;
 
-	if (vkCreateSampler(device, &samplerInfo, nullptr, textureSampler.replace()) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create texture sampler!");
-	}
+	textureSampler = vulkanAPIHandler->getTextureCache()->getSampler(samplerInfo);
 }
 
 void Renderable::createDescriptorSetLayout() {
-	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
+	// Matrices, colour and material come from the instance buffer, only the texture is left
 	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
 	samplerLayoutBinding.binding = 1;
 	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	samplerLayoutBinding.descriptorCount = 1;
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	VkDescriptorSetLayoutBinding materialLayoutBinding = {};
-	materialLayoutBinding.binding = 2;
-	materialLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	materialLayoutBinding.descriptorCount = 1;
-	materialLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	// With dynamic uniforms the vertex shaders read the instance array through the set instead
+	VkDescriptorSetLayoutBinding instanceLayoutBinding = {};
+	instanceLayoutBinding.binding = 0;
+	instanceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	instanceLayoutBinding.descriptorCount = 1;
+	instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	std::vector<VkDescriptorSetLayoutBinding> layoutBindings = { samplerLayoutBinding };
+	if (vulkanAPIHandler->getRenderSettings().dynamicUniforms) {
+		layoutBindings.push_back(instanceLayoutBinding);
+	}
 
-	std::array<VkDescriptorSetLayoutBinding, 3> bindings = { uboLayoutBinding, samplerLayoutBinding, materialLayoutBinding };
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount = bindings.size();
-	layoutInfo.pBindings = bindings.data();
+	layoutInfo.bindingCount = layoutBindings.size();
+	layoutInfo.pBindings = layoutBindings.data();
 
 	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, descriptorSetLayout.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create descriptor set layout!");
@@ -313,67 +135,54 @@ void Renderable::createDescriptorSetLayout() {
 }
 
 void Renderable::createDescriptorSet(VkDescriptorPool descriptorPool) {
-	VkDescriptorSetLayout layouts[] = { descriptorSetLayout };
+	VkDescriptorSetLayout layout = descriptorSetLayout;
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
 	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = layouts;
+	allocInfo.pSetLayouts = &layout;
 
 	VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate descriptor set!");
 	}
 
-	VkDescriptorBufferInfo bufferInfo = {};
-	bufferInfo.buffer = uniformBuffer;
-	bufferInfo.offset = 0;
-	bufferInfo.range = sizeof(RenderableUBO);
-
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	imageInfo.imageView = textureImageView;
+	imageInfo.imageView = texture->getImageView();
 	imageInfo.sampler = textureSampler;
 
-	VkDescriptorBufferInfo materialInfo = {};
-	materialInfo.buffer = materialBuffer;
-	materialInfo.offset = 0;
-	materialInfo.range = sizeof(RenderableMaterialUBO);
-
-	std::array<VkWriteDescriptorSet, 3> descriptorWrites = {};
-
-	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[0].dstSet = descriptorSet;
-	descriptorWrites[0].dstBinding = 0;
-	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[0].descriptorCount = 1;
-	descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[1].dstSet = descriptorSet;
-	descriptorWrites[1].dstBinding = 1;
-	descriptorWrites[1].dstArrayElement = 0;
-	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorWrites[1].descriptorCount = 1;
-	descriptorWrites[1].pImageInfo = &imageInfo;
-
-	descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[2].dstSet = descriptorSet;
-	descriptorWrites[2].dstBinding = 2;
-	descriptorWrites[2].dstArrayElement = 0;
-	descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[2].descriptorCount = 1;
-	descriptorWrites[2].pBufferInfo = &materialInfo;
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSet;
+	descriptorWrite.dstBinding = 1;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pImageInfo = &imageInfo;
+
+	std::vector<VkWriteDescriptorSet> descriptorWrites = { descriptorWrite };
+
+	// The frame is selected by the dynamic offset, so the set points at the start of the instance ring buffer
+	VkDescriptorBufferInfo instanceInfo = {};
+	instanceInfo.buffer = vulkanAPIHandler->getInstanceRingBuffer()->getBuffer();
+	instanceInfo.offset = 0;
+	instanceInfo.range = sizeof(InstanceData) * MAX_UNIFORM_INSTANCES;
+
+	if (vulkanAPIHandler->getRenderSettings().dynamicUniforms) {
+		descriptorWrite.dstBinding = 0;
+		descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		descriptorWrite.pImageInfo = nullptr;
+		descriptorWrite.pBufferInfo = &instanceInfo;
+		descriptorWrites.push_back(descriptorWrite);
+	}
 
 	vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+}
 
-	// Static copying of the material data. This should be done if we dont want to update the material each frame
-	void* data;
-	vkMapMemory(device, uniformStagingBufferMemory, 0, sizeof(material), 0, &data);
-	memcpy(data, &material, sizeof(material));
-	vkUnmapMemory(device, uniformStagingBufferMemory);
-	vulkanAPIHandler->copyBuffer(uniformStagingBuffer, materialBuffer, sizeof(material));
+// Used for renderables that have the same texture as one that already owns a set
+void Renderable::shareDescriptorSet(VkDescriptorSet sharedDescriptorSet) {
+	descriptorSet = sharedDescriptorSet;
 }
 
 void Renderable::update(float deltaTime) {
@@ -387,8 +196,21 @@ VkDescriptorSetLayout Renderable::getDescriptorLayout() {
 	return descriptorSetLayout;
 }
 
-void Renderable::updateUniformBuffer(glm::mat4 projectionMatrix, glm::mat4 viewMatrix) {
-	RenderableUBO ubo = {};
+std::string Renderable::getTexturePath() {
+	return texturePath;
+}
+
+void Renderable::bindDescriptorSet(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t instanceOffset) {
+	if (vulkanAPIHandler->getRenderSettings().dynamicUniforms) {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, RENDERABLE_UBO, 1, &descriptorSet, 1, &instanceOffset);
+	}
+	else {
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, RENDERABLE_UBO, 1, &descriptorSet, 0, nullptr);
+	}
+}
+
+InstanceData Renderable::getInstanceData() {
+	InstanceData instance = {};
 	
 	/* // Making the renderable spin around the y axis
 	modelMatrix = 
@@ -399,23 +221,9 @@ void Renderable::updateUniformBuffer(glm::mat4 projectionMatrix, glm::mat4 viewM
 	*/
 
 	modelMatrix = glm::translate(glm::mat4(1.0f), position) * glm::scale(glm::mat4(1.0f), scale);
-	ubo.mvp = projectionMatrix * viewMatrix * modelMatrix;
-	ubo.viewMatrix = viewMatrix;
-	ubo.modelMatrix = modelMatrix;
-	ubo.projectionMatrix = projectionMatrix;
-
-	// Updating UBO
-	void* data;
-	vkMapMemory(device, uniformStagingBufferMemory, 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(device, uniformStagingBufferMemory);
-	vulkanAPIHandler->copyBuffer(uniformStagingBuffer, uniformBuffer, sizeof(ubo));
-
-	/*
-	// Updating Material dynamically
-	vkMapMemory(device, uniformStagingBufferMemory, 0, sizeof(material), 0, &data);
-	memcpy(data, &material, sizeof(material));
-	vkUnmapMemory(device, uniformStagingBufferMemory);
-	vulkanAPIHandler->copyBuffer(uniformStagingBuffer, materialBuffer, sizeof(material));
-	*/
+	instance.modelMatrix = modelMatrix;
+	instance.color = baseColor;
+	instance.material = glm::vec4(material.specularExponent, material.specularGain, material.diffuseGain, material.selfShadowEnabled ? 1.f : 0.f);
+
+	return instance;
 }
@@ -9,6 +9,8 @@
 #include <vector>
 #include "Structs.h"
 #include "VDeleter.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
 
 class VulkanAPIHandler;
 
@@ -37,63 +39,52 @@ public:
 
 	int numIndices();
 	glm::vec3 getPosition();
+	// World space center in xyz, radius in w
+	glm::vec4 getBoundingSphere();
 
-	void updateUniformBuffer(glm::mat4 projectionMatrix, glm::mat4 viewMatrix);
+	// Written into the instance buffer every frame
+	InstanceData getInstanceData();
 
+	std::shared_ptr<Mesh> getMesh();
 	VkBuffer getVertexBuffer();
 	VkBuffer getIndexBuffer();
 	VkDescriptorSet getDescriptorSet();
 	VkDescriptorSetLayout getDescriptorLayout();
+	std::string getTexturePath();
+	// With dynamic uniforms, instanceOffset is where the frame's instances are in the instance ring buffer
+	void bindDescriptorSet(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t instanceOffset = 0);
 
 	void createVertexIndexBuffers();
-	void createUniformBuffers();
 	void createTextureImage();
-	void createTextureImageView();
 	void createTextureSampler();
 	void createDescriptorSetLayout();
 	void createDescriptorSet(VkDescriptorPool descriptorPool);
+	void shareDescriptorSet(VkDescriptorSet descriptorSet);
 protected:
 	VDeleter<VkDevice> device;
 	VulkanAPIHandler* vulkanAPIHandler;
 	
-	std::vector<Vertex> vertices{};
-	std::vector<uint32_t> indices{};
+	std::shared_ptr<Mesh> mesh;
 	glm::mat4 modelMatrix{1.f};
 	
 	glm::vec3 position{0.f, 0.f, 0.f};
 	glm::vec3 scale{1.f, 1.f, 1.f};
 	glm::vec4 baseColor{1.f, 1.f, 1.f, 1.f};
 
-	RenderableMaterialUBO material{};
+	RenderableMaterial material{};
 
 	Renderable(VulkanAPIHandler* vkAPIHandler, glm::vec4 pos, std::string texturePath);
 private:
-	VkDescriptorSet descriptorSet;
+	// Only holds the texture, so renderables with the same texture share it
+	VkDescriptorSet descriptorSet{VK_NULL_HANDLE};
 
 	std::string texturePath{DEFAULT_TEXTURE_PATH};
 	std::string modelPath{CUBE_MODEL_PATH};
 
 	VDeleter<VkDescriptorSetLayout> descriptorSetLayout{ device, vkDestroyDescriptorSetLayout };
 
-	VDeleter<VkImage> textureImage{ device , vkDestroyImage };
-	VDeleter<VkImageView> textureImageView{ device, vkDestroyImageView };
-	VDeleter<VkSampler> textureSampler{ device, vkDestroySampler };
-	VDeleter<VkDeviceMemory> textureImageMemory{ device, vkFreeMemory };
-
-	VDeleter<VkBuffer> vertexBuffer{device, vkDestroyBuffer};
-	VDeleter<VkDeviceMemory> vertexBufferMemory{ device, vkFreeMemory };
-	VDeleter<VkBuffer> indexBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> indexBufferMemory{ device, vkFreeMemory };
-	
-	VDeleter<VkBuffer> uniformStagingBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> uniformStagingBufferMemory{ device, vkFreeMemory };
-	
-	VDeleter<VkBuffer> uniformBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> uniformBufferMemory{ device, vkFreeMemory };
-
-	VDeleter<VkBuffer> materialBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> materialBufferMemory{ device, vkFreeMemory };
-
-	void loadModel(bool invertNormals);
+	std::shared_ptr<Texture> texture;
+	// Owned by the texture cache
+	VkSampler textureSampler{VK_NULL_HANDLE};
 };
 
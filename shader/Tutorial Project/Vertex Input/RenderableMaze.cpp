@@ -3,6 +3,9 @@
 
 
 RenderableMaze::RenderableMaze(VulkanAPIHandler* vkAPIHandler, glm::vec4 pos, std::string texturePath) : Renderable(vkAPIHandler, pos, texturePath) {
+	// The maze is generated from the level file, so it does not go through the mesh cache
+	mesh = std::make_shared<Mesh>(vkAPIHandler);
+
 	readSVGRects(FILE_PATH.c_str());
 	convertRectsToVertices();
 	addFloorVertices();
@@ -22,6 +25,10 @@ std::vector<CollisionRect> RenderableMaze::getWalls() {
 	return wallCollisionRects;
 }
 
+int RenderableMaze::getWallHeight() {
+	return WALL_HEIGHT;
+}
+
 void RenderableMaze::readSVGRects(const char* fileName) {
 	tinyxml2::XMLDocument doc;
 	doc.LoadFile(fileName);
@@ -118,7 +125,7 @@ void RenderableMaze::pushVertexFace(std::vector<glm::vec4> vertexPositions, glm:
 		vertex.color = color;
 		vertex.normal = faceNormal;
 		vertex.texCoord = textureCoordinates[i];
-		vertices.push_back(vertex);
+		mesh->vertices.push_back(vertex);
 	}
 }
 
@@ -148,13 +155,13 @@ void RenderableMaze::pushIndices() {
 	// Adding in the index order for all vertices with the order being (k,k+1,k+2  k,k+2,k+3) 
 	int k = 0;
 	for (int i = 0; i < numIndices; i += 6) {
-		indices.push_back(k);
-		indices.push_back(k + 1);
-		indices.push_back(k + 2);
+		mesh->indices.push_back(k);
+		mesh->indices.push_back(k + 1);
+		mesh->indices.push_back(k + 2);
 
-		indices.push_back(k);
-		indices.push_back(k + 2);
-		indices.push_back(k + 3);
+		mesh->indices.push_back(k);
+		mesh->indices.push_back(k + 2);
+		mesh->indices.push_back(k + 3);
 		k += 4;
 	}
 }
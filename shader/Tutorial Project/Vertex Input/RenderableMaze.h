@@ -8,6 +8,7 @@ public:
 	RenderableMaze(VulkanAPIHandler* vkAPIHandler, glm::vec4 pos, std::string texturePath = DEFAULT_TEXTURE_PATH);
 	~RenderableMaze();
 	std::vector<CollisionRect> getWalls();
+	int getWallHeight();
 private:
 	const int WALL_HEIGHT{30};
 	const float FLOOR_OFFSET_Y{-1.5f};
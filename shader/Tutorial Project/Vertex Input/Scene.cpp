@@ -18,60 +18,96 @@ Scene::Scene(VulkanAPIHandler* vulkanAPI) {
 	sceneUBO.projectionMatrix = glm::perspective(glm::radians(90.0f), 1.0f, Z_NEAR, Z_FAR);
 	sceneUBO.projectionMatrix[1][1] *= -1;
 
+	for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+		sceneUBO.cubeFaceViewMatrices[face] = getCubeFaceViewMatrix(face);
+	}
+
+	layeredCubeMapViews.reserve(NUM_LIGHTS);
+	layeredFrameBuffers.reserve(NUM_LIGHTS);
+	staticLayerImages.reserve(NUM_LIGHTS);
+	staticLayerImageViews.reserve(NUM_LIGHTS);
+	staticLayerFrameBuffers.reserve(NUM_LIGHTS);
+
 	for (int i = 0; i < NUM_LIGHTS; i++) {
-		shadowCubeMapImages.emplace_back(VDeleter<VkImage>{ device, vkDestroyImage });
-		shadowCubeMapImageViews.emplace_back(VDeleter<VkImageView>{ device, vkDestroyImageView });
-		shadowCubeMapSamplers.emplace_back(VDeleter<VkSampler>{ device, vkDestroySampler });
-		shadowCubeMapMemories.emplace_back(VDeleter<VkDeviceMemory>{ device, vkFreeMemory });
+		layeredCubeMapViews.emplace_back(VDeleter<VkImageView>{ device, vkDestroyImageView });
+		layeredFrameBuffers.emplace_back(VDeleter<VkFramebuffer>{ device, vkDestroyFramebuffer });
+		staticLayerImages.emplace_back(VDeleter<VkImage>{ device, vkDestroyImage });
+		staticLayerImageViews.emplace_back(VDeleter<VkImageView>{ device, vkDestroyImageView });
+		staticLayerMemories.emplace_back();
+		staticLayerFrameBuffers.emplace_back(VDeleter<VkFramebuffer>{ device, vkDestroyFramebuffer });
+		staticLayers.emplace_back();
+		shadowMaps.emplace_back();
 	}
 }
 
 Scene::~Scene() {
-	// Cleaning up the framebuffer attachment
-	// Color attachment
-	vkDestroyImageView(device, offscreenPass.color.view, nullptr);
-	vkDestroyImage(device, offscreenPass.color.image, nullptr);
-	vkFreeMemory(device, offscreenPass.color.memory, nullptr);
-
-	// Depth attachment
-	vkDestroyImageView(device, offscreenPass.depth.view, nullptr);
-	vkDestroyImage(device, offscreenPass.depth.image, nullptr);
-	vkFreeMemory(device, offscreenPass.depth.memory, nullptr);
+	// Cleaning up the offscreen targets
+	for (auto& target : offscreenPass.targets) {
+		// Color attachment
+		vkDestroyImageView(device, target.color.view, nullptr);
+		vkDestroyImage(device, target.color.image, nullptr);
+		target.color.memory.free();
+
+		// Depth attachment
+		vkDestroyImageView(device, target.depth.view, nullptr);
+		vkDestroyImage(device, target.depth.image, nullptr);
+		target.depth.memory.free();
+
+		vkDestroyFramebuffer(device, target.frameBuffer, nullptr);
+	}
 
-	// Cleaning up the framebuffer, renderpass and semaphore
-	vkDestroyFramebuffer(device, offscreenPass.frameBuffer, nullptr);
+	// Cleaning up the renderpass and semaphores
 	vkDestroyRenderPass(device, offscreenPass.renderPass, nullptr);
 
-	vkDestroySemaphore(device, offscreenPass.semaphore, nullptr);
+	for (auto& semaphore : offscreenPass.semaphores) {
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
 }
 
-VkSemaphore Scene::getOffscreenSemaphore() {
-	return offscreenPass.semaphore;
+VkSemaphore Scene::getOffscreenSemaphore(uint32_t frameIndex) {
+	return offscreenPass.semaphores[frameIndex];
 }
 
-VkCommandBuffer Scene::getOffscreenCommandBuffer() {
-	return offscreenPass.commandBuffer;
+VkCommandBuffer Scene::getOffscreenCommandBuffer(uint32_t frameIndex) {
+	return offscreenPass.commandBuffers[frameIndex];
 }
 
 std::vector<std::pair<RenderableInformation, std::shared_ptr<Renderable>>> Scene::getRenderableObjects() {
 	return renderableObjects;
 }
 
-void Scene::updateUniformBuffers(glm::mat4 projectionMatrix, glm::mat4 viewMatrix) {
-	for (auto& renderable : renderableObjects) {
-		renderable.second->updateUniformBuffer(projectionMatrix, viewMatrix);
+void Scene::updateUniformBuffers(glm::mat4 projectionMatrix, glm::mat4 viewMatrix, uint32_t frameIndex) {
+	// Instances are written in batch order, so every batch reads a contiguous range
+	FrameRingBuffer* instanceRingBuffer = vulkanAPIHandler->getInstanceRingBuffer();
+	VkDeviceSize instanceOffset = instanceSlot;
+
+	for (auto& batch : instanceBatches) {
+		for (auto& renderable : batch.renderables) {
+			InstanceData instance = renderable->getInstanceData();
+			instanceRingBuffer->write(frameIndex, instanceOffset, &instance, sizeof(instance));
+			instanceOffset += sizeof(InstanceData);
+		}
 	}
 
-	for (int i = 0; i < shadowCubeMapImages.size(); i++) {
+	sceneUBO.cameraViewMatrix = viewMatrix;
+	sceneUBO.cameraProjectionMatrix = projectionMatrix;
+	updateCameraVisibility(projectionMatrix * viewMatrix);
+	sortSceneBatches(glm::vec3(glm::inverse(viewMatrix)[3]));
+
+	bool shadowAtlas = vulkanAPIHandler->getRenderSettings().shadowAtlas;
+
+	for (int i = 0; i < NUM_LIGHTS; i++) {
 		sceneUBO.lightOffsetMatrices[i] = glm::translate(glm::mat4(1.f), glm::vec3(-sceneUBO.lightPositions[i].x, -sceneUBO.lightPositions[i].y, -sceneUBO.lightPositions[i].z));
+		sceneUBO.lightShadowProjections[i].x = float(usesParaboloidShadows(i) ? SHADOW_PROJECTION_DUAL_PARABOLOID : shadowAtlas ? SHADOW_PROJECTION_CUBE_ATLAS : SHADOW_PROJECTION_CUBE);
 	}
 
-	void* data;
-	vkMapMemory(device, uniformStagingBufferMemory, 0, sizeof(sceneUBO), 0, &data);
-	memcpy(data, &sceneUBO, sizeof(sceneUBO));
-	vkUnmapMemory(device, uniformStagingBufferMemory);
+	// The tiles are part of the UBO, so they are laid out before it is written and the shadow pass is recorded
+	if (shadowAtlas) {
+		layoutShadowAtlas(glm::vec3(glm::inverse(viewMatrix)[3]));
+	}
 
-	vulkanAPIHandler->copyBuffer(uniformStagingBuffer, uniformBuffer, sizeof(sceneUBO));
+	// The frame's region is no longer in use by the GPU at this point, so it can be written directly
+	vulkanAPIHandler->getUniformRingBuffer()->write(frameIndex, uniformSlot, &sceneUBO, sizeof(sceneUBO));
 }
 
 void Scene::update(float deltaTime) {
@@ -101,12 +137,6 @@ void Scene::createTextureImages() {
 	}
 }
 
-void Scene::createTextureImageViews() {
-	for (auto& renderable : renderableObjects) {
-		renderable.second->createTextureImageView();
-	}
-}
-
 void Scene::createTextureSamplers() {
 	for (auto& renderable : renderableObjects) {
 		renderable.second->createTextureSampler();
@@ -120,23 +150,17 @@ void Scene::createVertexIndexBuffers() {
 }
 
 void Scene::createUniformBuffers() {
-	for (auto& renderable : renderableObjects) {
-		renderable.second->createUniformBuffers();
+	uniformSlot = vulkanAPIHandler->getUniformRingBuffer()->reserve(sizeof(SceneUBO));
+	// With dynamic uniforms the vertex shaders declare a fixed size array, which the slot has to cover
+	size_t instanceCount = renderableObjects.size();
+	if (vulkanAPIHandler->getRenderSettings().dynamicUniforms) {
+		if (instanceCount > MAX_UNIFORM_INSTANCES) {
+			throw std::runtime_error("too many renderables for dynamic uniforms!");
+		}
+		instanceCount = MAX_UNIFORM_INSTANCES;
 	}
 
-	VkDeviceSize bufferSize = sizeof(SceneUBO);
-
-	vulkanAPIHandler->createBuffer(bufferSize, 
-								   VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 
-								   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 
-								   uniformStagingBuffer, 
-								   uniformStagingBufferMemory);
-
-	vulkanAPIHandler->createBuffer(bufferSize, 
-								   VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-								   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 
-								   uniformBuffer, 
-								   uniformBufferMemory);
+	instanceSlot = vulkanAPIHandler->getInstanceRingBuffer()->reserve(sizeof(InstanceData) * instanceCount);
 }
 
 void Scene::createDescriptorSetLayouts() {
@@ -151,13 +175,31 @@ void Scene::createDescriptorSetLayouts() {
 	uboLayoutBinding.descriptorCount = 1;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
+	// The layered shadow pass projects into the cube faces in its geometry shader.
+	// The scene pass reads the shadow projection of every light
+	uboLayoutBinding.stageFlags |= VK_SHADER_STAGE_FRAGMENT_BIT;
+	if (vulkanAPIHandler->getRenderSettings().layeredShadows) {
+		uboLayoutBinding.stageFlags |= VK_SHADER_STAGE_GEOMETRY_BIT;
+	}
+
 	VkDescriptorSetLayoutBinding cubeMapLayoutBinding = {};
 	cubeMapLayoutBinding.binding = 1;
 	cubeMapLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	cubeMapLayoutBinding.descriptorCount = shadowCubeMapImages.size();
+	cubeMapLayoutBinding.descriptorCount = 1;
 	cubeMapLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	VkDescriptorSetLayoutBinding paraboloidLayoutBinding = cubeMapLayoutBinding;
+	paraboloidLayoutBinding.binding = 2;
+
+	VkDescriptorSetLayoutBinding atlasLayoutBinding = cubeMapLayoutBinding;
+	atlasLayoutBinding.binding = 3;
 	
-	std::array<VkDescriptorSetLayoutBinding, 2> layoutBindings = { uboLayoutBinding, cubeMapLayoutBinding };
+	// One cube map per light without cube map arrays
+	if (!vulkanAPIHandler->getRenderSettings().shadowCubeMapArray) {
+		cubeMapLayoutBinding.descriptorCount = NUM_LIGHTS;
+	}
+
+	std::array<VkDescriptorSetLayoutBinding, 4> layoutBindings = { uboLayoutBinding, cubeMapLayoutBinding, paraboloidLayoutBinding, atlasLayoutBinding };
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	layoutInfo.bindingCount = layoutBindings.size();
@@ -171,58 +213,94 @@ void Scene::createDescriptorSetLayouts() {
 }
 
 void Scene::createDescriptorSets(VkDescriptorPool descPool) {
+	// Renderable sets only hold the texture, so there is one per texture
+	std::map<std::string, VkDescriptorSet> sharedDescriptorSets;
+	
 	for (auto& renderable : renderableObjects) {
-		renderable.second->createDescriptorSet(descPool);
+		auto sharedSet = sharedDescriptorSets.find(renderable.second->getTexturePath());
+		
+		if (sharedSet != sharedDescriptorSets.end()) {
+			renderable.second->shareDescriptorSet(sharedSet->second);
+		}
+		else {
+			renderable.second->createDescriptorSet(descPool);
+			sharedDescriptorSets[renderable.second->getTexturePath()] = renderable.second->getDescriptorSet();
+		}
 	}
 	
-	// Creating the descriptor set for the scene UBO and shadow cube map
-	VkDescriptorSetLayout layouts[] = { descriptorSetLayout };
+	// Creating the descriptor sets for the scene UBO and shadow cube map
+	int numFrames = vulkanAPIHandler->getFramesInFlight();
+	std::vector<VkDescriptorSetLayout> layouts(numFrames, descriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descPool;
-	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = layouts;
+	allocInfo.descriptorSetCount = numFrames;
+	allocInfo.pSetLayouts = layouts.data();
 
-	VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet);
+	descriptorSets.resize(numFrames);
+	VkResult result = vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data());
 	if (result != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate descriptor set!");
 	}
 
-	VkDescriptorBufferInfo bufferInfo = {};
-	bufferInfo.buffer = uniformBuffer;
-	bufferInfo.offset = 0;
-	bufferInfo.range = sizeof(SceneUBO);
-
-	std::array<VkDescriptorImageInfo, NUM_LIGHTS> cubeMapInfo = {};
-	cubeMapInfo[0].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	cubeMapInfo[0].imageView = shadowCubeMapImageViews[0];
-	cubeMapInfo[0].sampler = shadowCubeMapSamplers[0];
-	
-	for (int i = 1; i < shadowCubeMapImages.size(); i++) {
-		cubeMapInfo[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		cubeMapInfo[i].imageView = shadowCubeMapImageViews[i];
-		cubeMapInfo[i].sampler = shadowCubeMapSamplers[i];
-	} 
-
-	std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
-
-	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[0].dstSet = descriptorSet;
-	descriptorWrites[0].dstBinding = 0;
-	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	descriptorWrites[0].descriptorCount = 1;
-	descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-	descriptorWrites[1].dstSet = descriptorSet;
-	descriptorWrites[1].dstBinding = 1;
-	descriptorWrites[1].dstArrayElement = 0;
-	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	descriptorWrites[1].descriptorCount = cubeMapInfo.size();
-	descriptorWrites[1].pImageInfo = cubeMapInfo.data();
+	VkDescriptorImageInfo cubeMapInfo = {};
+	cubeMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	cubeMapInfo.imageView = shadowCubeMapImageView;
+	cubeMapInfo.sampler = shadowCubeMapSampler;
+
+	// Without cube map arrays, the binding is an array of one cube map per light
+	std::vector<VkDescriptorImageInfo> cubeMapInfos(1, cubeMapInfo);
+	if (!vulkanAPIHandler->getRenderSettings().shadowCubeMapArray) {
+		cubeMapInfos.assign(NUM_LIGHTS, cubeMapInfo);
+		for (int i = 0; i < NUM_LIGHTS; i++) {
+			cubeMapInfos[i].imageView = shadowCubeMapLightViews[i];
+		}
+	}
 
-	vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr); 
+	VkDescriptorImageInfo paraboloidInfo = cubeMapInfo;
+	paraboloidInfo.imageView = shadowParaboloidImageView;
+
+	// Without the atlas, the paraboloid view has the same type and keeps the binding valid
+	VkDescriptorImageInfo atlasInfo = cubeMapInfo;
+	atlasInfo.imageView = vulkanAPIHandler->getRenderSettings().shadowAtlas ? shadowAtlasImageView : shadowParaboloidImageView;
+
+	FrameRingBuffer* uniformRingBuffer = vulkanAPIHandler->getUniformRingBuffer();
+
+	for (int frame = 0; frame < numFrames; frame++) {
+		VkDescriptorBufferInfo bufferInfo = {};
+		bufferInfo.buffer = uniformRingBuffer->getBuffer();
+		bufferInfo.offset = uniformRingBuffer->getOffset(frame, uniformSlot);
+		bufferInfo.range = sizeof(SceneUBO);
+
+		std::array<VkWriteDescriptorSet, 4> descriptorWrites = {};
+
+		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[0].dstSet = descriptorSets[frame];
+		descriptorWrites[0].dstBinding = 0;
+		descriptorWrites[0].dstArrayElement = 0;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].descriptorCount = 1;
+		descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[1].dstSet = descriptorSets[frame];
+		descriptorWrites[1].dstBinding = 1;
+		descriptorWrites[1].dstArrayElement = 0;
+		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[1].descriptorCount = cubeMapInfos.size();
+		descriptorWrites[1].pImageInfo = cubeMapInfos.data();
+
+		descriptorWrites[2] = descriptorWrites[1];
+		descriptorWrites[2].dstBinding = 2;
+		descriptorWrites[2].descriptorCount = 1;
+		descriptorWrites[2].pImageInfo = &paraboloidInfo;
+
+		descriptorWrites[3] = descriptorWrites[2];
+		descriptorWrites[3].dstBinding = 3;
+		descriptorWrites[3].pImageInfo = &atlasInfo;
+
+		vkUpdateDescriptorSets(device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr); 
+	}
 }
 
 void Scene::createRenderables() {
@@ -234,51 +312,390 @@ void Scene::createRenderables() {
 		ghosts.emplace_back(std::make_shared<Ghost>(&sceneUBO, pacman, maze, vulkanAPIHandler, i + 1, spawnPositions[i + 1], glm::vec3(30, 30, 30), ghostColors[i]));
 	}
 
-	renderableObjects.emplace_back(std::make_pair<RenderableInformation, std::shared_ptr<Renderable>>(RenderableInformation(RENDERABLE_MAZE), maze));
+	prepareAnalyticWallShadows();
+
+	renderableObjects.emplace_back(std::make_pair<RenderableInformation, std::shared_ptr<Renderable>>(RenderableInformation(RENDERABLE_MAZE, !analyticWallShadows), maze));
 	renderableObjects.emplace_back(std::make_pair<RenderableInformation, std::shared_ptr<Renderable>>(RenderableInformation(RENDERABLE_PACMAN), pacman));
 
 	for (auto& ghost : ghosts) {
 		renderableObjects.emplace_back(std::make_pair<RenderableInformation, std::shared_ptr<Renderable>>(RenderableInformation(RENDERABLE_GHOST, false), ghost));
 	}
+
+	createInstanceBatches();
+}
+
+// The walls are axis aligned boxes standing on the floor, which the scene fragment shader can intersect
+// directly. The maze then does not have to be rendered into the shadow maps at all
+void Scene::prepareAnalyticWallShadows() {
+	std::vector<CollisionRect> walls = maze->getWalls();
+	sceneUBO.wallParameters = glm::vec4(0.f, maze->getWallHeight(), 0.f, 0.f);
+
+	if (!vulkanAPIHandler->getRenderSettings().analyticWallShadows) {
+		return;
+	}
+
+	if (walls.size() > MAX_ANALYTIC_WALLS) {
+		printf("The maze has %u walls, analytic wall shadows support %d. The walls are rendered into the shadow maps\n", (uint32_t)walls.size(), MAX_ANALYTIC_WALLS);
+		return;
+	}
+
+	// The maze is not moved, so its walls are already in world space. The rects' y is the world's z axis
+	for (uint32_t i = 0; i < walls.size(); i++) {
+		sceneUBO.wallBounds[i] = glm::vec4(walls[i].x, walls[i].y, walls[i].x + walls[i].w, walls[i].y + walls[i].h);
+	}
+
+	sceneUBO.wallParameters.x = float(walls.size());
+	analyticWallShadows = true;
+	printf("Analytic wall shadows: %u walls, the shadow maps only contain the moving objects\n", (uint32_t)walls.size());
+}
+
+void Scene::createInstanceBatches() {
+	// Renderables can only share a draw call if they use the same mesh, texture and shadow setting,
+	// and if they either all move or all stay in place
+	std::map<std::tuple<Mesh*, std::string, bool, bool>, size_t> batchIndices;
+	std::map<std::string, uint32_t> materialIds;
+	std::map<Mesh*, uint32_t> meshIds;
+	bool instancing = vulkanAPIHandler->getRenderSettings().instancing;
+
+	instanceBatches.clear();
+	for (auto& renderable : renderableObjects) {
+		bool isStatic = dynamic_cast<Moveable*>(renderable.second.get()) == nullptr;
+		auto key = std::make_tuple(renderable.second->getMesh().get(), renderable.second->getTexturePath(), renderable.first.castShadows, isStatic);
+		auto batchIndex = batchIndices.find(key);
+
+		if (instancing && batchIndex != batchIndices.end()) {
+			instanceBatches[batchIndex->second].renderables.push_back(renderable.second);
+			continue;
+		}
+
+		batchIndices[key] = instanceBatches.size();
+		instanceBatches.emplace_back();
+		instanceBatches.back().renderables.push_back(renderable.second);
+		instanceBatches.back().castShadows = renderable.first.castShadows;
+		instanceBatches.back().isStatic = isStatic;
+		// Renderables with the same texture share their descriptor set, see createDescriptorSets
+		instanceBatches.back().materialId = materialIds.emplace(renderable.second->getTexturePath(), materialIds.size()).first->second;
+		instanceBatches.back().meshId = meshIds.emplace(renderable.second->getMesh().get(), meshIds.size()).first->second;
+	}
+
+	uint32_t firstInstance = 0;
+	for (auto& batch : instanceBatches) {
+		batch.firstInstance = firstInstance;
+		firstInstance += batch.renderables.size();
+	}
+
+	// Static renderables never move, their bounds are only written once
+	cameraCuller.resize(firstInstance);
+	for (auto& batch : instanceBatches) {
+		for (uint32_t i = 0; i < batch.renderables.size(); i++) {
+			cameraCuller.setBoundingSphere(batch.firstInstance + i, batch.renderables[i]->getBoundingSphere());
+		}
+	}
+
+	printf("Instancing: %zu renderables in %zu draw calls per pass\n", renderableObjects.size(), instanceBatches.size());
+
+	// The state of a batch never changes, only the scene pass has to be sorted by depth again
+	insertionBatchOrder.resize(instanceBatches.size());
+	sceneQueue.clear();
+	for (uint32_t i = 0; i < instanceBatches.size(); i++) {
+		insertionBatchOrder[i] = i;
+		sceneQueue.push(i, 0, instanceBatches[i].materialId, instanceBatches[i].meshId, 0.f);
+	}
+
+	sceneQueue.sort();
+	sceneQueue.getItems(stateBatchOrder);
+	sceneBatchOrder = stateBatchOrder;
+}
+
+// Every pass draws with a single pipeline, so the pipeline field of the keys stays 0. A batch is as far away as
+// its nearest instance, which puts the maze around everything first
+void Scene::sortSceneBatches(glm::vec3 cameraPosition) {
+	if (!vulkanAPIHandler->getRenderSettings().drawSorting) {
+		return;
+	}
+
+	sceneQueue.clear();
+	for (uint32_t i = 0; i < instanceBatches.size(); i++) {
+		float nearestDistance = Z_FAR;
+		for (auto& renderable : instanceBatches[i].renderables) {
+			glm::vec4 boundingSphere = renderable->getBoundingSphere();
+			nearestDistance = std::min(nearestDistance, glm::length(glm::vec3(boundingSphere) - cameraPosition) - boundingSphere.w);
+		}
+
+		sceneQueue.push(i, 0, instanceBatches[i].materialId, instanceBatches[i].meshId, nearestDistance / Z_FAR);
+	}
+
+	sceneQueue.sort();
+	sceneQueue.getItems(sceneBatchOrder);
+	sceneSortPasses += sceneQueue.getSortPasses();
+	sceneSorts++;
+}
+
+const std::vector<uint32_t>& Scene::getBatchOrder(bool scenePass) {
+	if (!vulkanAPIHandler->getRenderSettings().drawSorting) {
+		return insertionBatchOrder;
+	}
+
+	return scenePass ? sceneBatchOrder : stateBatchOrder;
+}
+
+uint32_t Scene::getNumInstanceBatches() {
+	return instanceBatches.size();
+}
+
+bool Scene::matchesFilter(const InstanceBatch& batch, InstanceBatchFilter filter) {
+	if (filter == DRAW_ALL) {
+		return true;
+	}
+	if (filter == DRAW_STATIC) {
+		return batch.isStatic;
+	}
+
+	return batch.castShadows &&
+		!(filter == DRAW_STATIC_SHADOW_CASTERS && !batch.isStatic) &&
+		!(filter == DRAW_DYNAMIC_SHADOW_CASTERS && batch.isStatic);
+}
+
+// Hands the instance batches to the culling shader. Needs the mesh data and the instance ring buffer
+void Scene::prepareGpuCulling() {
+	gpuCuller = std::make_unique<GpuCuller>(vulkanAPIHandler, vulkanAPIHandler->getFramesInFlight());
+
+	for (auto& batch : instanceBatches) {
+		gpuCuller->addBatch(batch.renderables[0]->getMesh().get(), batch.firstInstance, batch.renderables.size(), batch.isStatic);
+	}
+
+	// The culling shader always has a depth pyramid bound, it is only built with occlusion culling
+	depthPyramid = std::make_unique<DepthPyramid>(vulkanAPIHandler, getDescriptorSetLayout(DESC_LAYOUT_RENDERABLE));
+	depthPyramid->create();
+
+	gpuCuller->create(instanceSlot, depthPyramid.get());
+}
+
+// The scene pass, culled against the camera on the CPU or by the culling shader
+void Scene::drawSceneBatches(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frameIndex, uint32_t firstBatch, uint32_t batchCount) {
+	if (gpuCuller != nullptr) {
+		drawIndirectBatches(commandBuffer, pipelineLayout, frameIndex, CAMERA_CULLING_VIEW, DRAW_ALL, firstBatch, batchCount, true);
+		return;
+	}
+
+	// The visibility of an instance is a single bit, so it is selected like a single cube face
+	drawInstanceBatches(commandBuffer, pipelineLayout, frameIndex, DRAW_ALL, getCameraVisibility(), 1, firstBatch, batchCount, true);
+}
+
+// One indirect draw per batch. How many instances are drawn is only known on the GPU, so there are no statistics
+void Scene::drawIndirectBatches(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frameIndex, uint32_t view, InstanceBatchFilter filter, uint32_t firstBatch, uint32_t batchCount, bool scenePass) {
+	// All meshes are in the same buffers, the draw commands select them with firstIndex and vertexOffset
+	VkBuffer vertexBuffer = gpuCuller->getVertexBuffer();
+	VkDeviceSize offsets[] = { 0 };
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffer, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, gpuCuller->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+	vertexBufferBinds++;
+	indexBufferBinds++;
+
+	VkBuffer instanceBuffer = gpuCuller->getVisibleInstanceBuffer(frameIndex);
+	VkBuffer indirectBuffer = gpuCuller->getIndirectBuffer(frameIndex);
+	bool skipRedundantBinds = vulkanAPIHandler->getRenderSettings().drawSorting;
+	VkDescriptorSet boundDescriptorSet = VK_NULL_HANDLE;
+
+	const std::vector<uint32_t>& batchOrder = getBatchOrder(scenePass);
+	uint32_t lastBatch = std::min<uint64_t>(uint64_t(firstBatch) + batchCount, batchOrder.size());
+	for (uint32_t position = firstBatch; position < lastBatch; position++) {
+		uint32_t batchIndex = batchOrder[position];
+		auto& batch = instanceBatches[batchIndex];
+		if (!matchesFilter(batch, filter)) {
+			continue;
+		}
+
+		// Every batch has its own range of the visible instances
+		VkDeviceSize instanceOffset = gpuCuller->getVisibleInstanceOffset(view, batch.firstInstance);
+		vkCmdBindVertexBuffers(commandBuffer, 1, 1, &instanceBuffer, &instanceOffset);
+		vertexBufferBinds++;
+
+		if (!skipRedundantBinds || batch.renderables[0]->getDescriptorSet() != boundDescriptorSet) {
+			batch.renderables[0]->bindDescriptorSet(commandBuffer, pipelineLayout);
+			boundDescriptorSet = batch.renderables[0]->getDescriptorSet();
+			descriptorSetBinds++;
+		}
+
+		vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, gpuCuller->getIndirectOffset(view, batchIndex), 1, sizeof(VkDrawIndexedIndirectCommand));
+		drawCalls++;
+	}
+}
+
+// Draws the shadow casters of a light that reach one of the faces. With GPU culling the light's faces are
+// culled into the light's first view, the copy path renders every face separately and culls into one view per face
+void Scene::drawShadowCasters(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frameIndex, InstanceBatchFilter filter, uint32_t lightIndex, uint32_t faces, uint32_t viewFace) {
+	if (gpuCuller != nullptr) {
+		drawIndirectBatches(commandBuffer, pipelineLayout, frameIndex, GpuCuller::getShadowView(lightIndex, viewFace), filter);
+		return;
+	}
+
+	uint32_t drawn = drawInstanceBatches(commandBuffer, pipelineLayout, frameIndex, filter, getShadowCasterFaces(lightIndex), faces);
+	addFaceStatistics(faces, drawn, countInstances(filter));
+}
+
+// Sets the faces every light's shadow views are culled for, mirroring what recordOffscreenCommandBuffer draws
+void Scene::prepareCullingViews() {
+	RenderSettings settings = vulkanAPIHandler->getRenderSettings();
+	gpuCuller->clearShadowViews();
+
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		uint32_t faces = shadowMaps[i].dirtyFaces;
+		if (faces == 0) {
+			continue;
+		}
+
+		gpuCuller->setLightPosition(i, sceneUBO.lightPositions[i]);
+		CullingViewType type = !settings.shadowCasterCulling ? CULLING_VIEW_ALL : usesParaboloidShadows(i) ? CULLING_VIEW_PARABOLOID_HALVES : CULLING_VIEW_CUBE_FACES;
+
+		if (!settings.layeredShadows) {
+			for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+				if (faces & (1 << face)) {
+					gpuCuller->setShadowView(GpuCuller::getShadowView(i, face), i, type, 1 << face, 1 << face);
+				}
+			}
+			continue;
+		}
+
+		// The static layer of a cached light is rendered for all faces whenever the light has moved
+		bool staticLayer = settings.staticShadowCache && !usesParaboloidShadows(i);
+		gpuCuller->setShadowView(GpuCuller::getShadowView(i, 0), i, type, staticLayer ? ALL_CUBE_FACES : faces, faces);
+	}
+}
+
+// The static batches are the occluders. They never move, so the pyramid only changes with the camera
+void Scene::updateDepthPyramid(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	if (!vulkanAPIHandler->getRenderSettings().occlusionCulling) {
+		return;
+	}
+
+	depthPyramid->update(commandBuffer, cameraViewProjection, [&](VkCommandBuffer occluderCommandBuffer, VkPipelineLayout pipelineLayout) {
+		drawInstanceBatches(occluderCommandBuffer, pipelineLayout, frameIndex, DRAW_STATIC);
+	});
+	gpuCuller->setOcclusionCulling(depthPyramid->isReady());
+}
+
+// Records one instanced draw per batch. Used by the scene pass and every cube map face.
+// Only reads the scene, so several threads can record different batch ranges at the same time
+uint32_t Scene::drawInstanceBatches(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frameIndex, InstanceBatchFilter filter, const std::vector<uint32_t>* instanceFaces, uint32_t faces, uint32_t firstBatch, uint32_t batchCount, bool scenePass) {
+	// The instance buffer stays bound, batches select their range with firstInstance. With dynamic uniforms
+	// the same offset is passed with every renderable set instead
+	FrameRingBuffer* instanceRingBuffer = vulkanAPIHandler->getInstanceRingBuffer();
+	VkBuffer instanceBuffer = instanceRingBuffer->getBuffer();
+	VkDeviceSize instanceOffset = instanceRingBuffer->getOffset(frameIndex, instanceSlot);
+	if (!vulkanAPIHandler->getRenderSettings().dynamicUniforms) {
+		vkCmdBindVertexBuffers(commandBuffer, 1, 1, &instanceBuffer, &instanceOffset);
+		vertexBufferBinds++;
+	}
+
+	// What is bound in this command buffer. Sorted batches of the same mesh or texture follow each other
+	bool skipRedundantBinds = vulkanAPIHandler->getRenderSettings().drawSorting;
+	VkBuffer boundVertexBuffer = VK_NULL_HANDLE;
+	VkBuffer boundIndexBuffer = VK_NULL_HANDLE;
+	VkDescriptorSet boundDescriptorSet = VK_NULL_HANDLE;
+
+	VkDeviceSize offsets[] = { 0 };
+	uint32_t instancesDrawn = 0;
+	const std::vector<uint32_t>& batchOrder = getBatchOrder(scenePass);
+	uint32_t lastBatch = std::min<uint64_t>(uint64_t(firstBatch) + batchCount, batchOrder.size());
+	for (uint32_t position = firstBatch; position < lastBatch; position++) {
+		auto& batch = instanceBatches[batchOrder[position]];
+		if (!matchesFilter(batch, filter)) {
+			continue;
+		}
+
+		// Culled instances split the batch into runs of visible instances, one draw call each
+		std::vector<std::pair<uint32_t, uint32_t>> runs;
+		for (uint32_t i = 0; i < batch.renderables.size(); i++) {
+			if (instanceFaces != nullptr && ((*instanceFaces)[batch.firstInstance + i] & faces) == 0) {
+				continue;
+			}
+
+			if (!runs.empty() && runs.back().first + runs.back().second == batch.firstInstance + i) {
+				runs.back().second++;
+			}
+			else {
+				runs.emplace_back(batch.firstInstance + i, 1);
+			}
+		}
+
+		if (runs.empty()) {
+			continue;
+		}
+
+		// Everything that is bound is the same for all renderables of the batch
+		std::shared_ptr<Renderable>& renderable = batch.renderables[0];
+		VkBuffer currentVertexBuffer[] = { renderable->getVertexBuffer() };
+
+		if (!skipRedundantBinds || currentVertexBuffer[0] != boundVertexBuffer) {
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, currentVertexBuffer, offsets);
+			boundVertexBuffer = currentVertexBuffer[0];
+			vertexBufferBinds++;
+		}
+		if (!skipRedundantBinds || renderable->getIndexBuffer() != boundIndexBuffer) {
+			vkCmdBindIndexBuffer(commandBuffer, renderable->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+			boundIndexBuffer = renderable->getIndexBuffer();
+			indexBufferBinds++;
+		}
+		if (!skipRedundantBinds || renderable->getDescriptorSet() != boundDescriptorSet) {
+			renderable->bindDescriptorSet(commandBuffer, pipelineLayout, (uint32_t)instanceOffset);
+			boundDescriptorSet = renderable->getDescriptorSet();
+			descriptorSetBinds++;
+		}
+
+		for (auto& run : runs) {
+			vkCmdDrawIndexed(commandBuffer, renderable->numIndices(), run.second, 0, 0, run.first);
+			instancesDrawn += run.second;
+			drawCalls++;
+		}
+	}
+
+	return instancesDrawn;
 }
 
 // Based on https://github.com/SaschaWillems/Vulkan/blob/master/shadowmappingomni/shadowmappingomni.cpp
 void Scene::prepareCubeMaps() {
-	// 32 bit float format for higher precision
-	VkFormat format = OFFSCREEN_FB_COLOR_FORMAT;
+	// 32 bit float distances, or depth-only distances divided by Z_FAR
+	VkFormat format = vulkanAPIHandler->getShadowMapFormat();
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
 
-	// Cube map image description
+	// Cube map array description, six layers per light
 	VkImageCreateInfo imageCreateInfo = {};
 	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
 	imageCreateInfo.format = format;
 	imageCreateInfo.extent = { CUBE_MAP_TEX_DIM, CUBE_MAP_TEX_DIM, 1 };
 	imageCreateInfo.mipLevels = 1;
-	imageCreateInfo.arrayLayers = NUM_CUBE_FACES;
+	imageCreateInfo.arrayLayers = NUM_SHADOW_MAP_LAYERS;
 	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
 	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
 	imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
 	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	imageCreateInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-	
-	// Setting up and recording the command buffer
-	VkCommandBuffer layoutCmd = vulkanAPIHandler->beginSingleTimeCommands();
 
-	// Create cube map images
-	for (int i = 0; i < shadowCubeMapImages.size(); i++) {
-		vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowCubeMapImages[i], shadowCubeMapMemories[i]);
+	// Layered rendering uses the cube maps as color or depth attachments directly
+	if (vulkanAPIHandler->getRenderSettings().layeredShadows) {
+		imageCreateInfo.usage |= depthShadowMaps ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 	}
 
-	// Image barrier for optimal image (target). The cube map has 6 array layers, one for each face
-	for (int i = 0; i < shadowCubeMapImages.size(); i++) {
-		vulkanAPIHandler->transitionImageLayout(layoutCmd, shadowCubeMapImages[i], format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, NUM_CUBE_FACES);
+	// The shadow atlas replaces the cube maps, they are only created for the descriptor set
+	if (vulkanAPIHandler->getRenderSettings().shadowAtlas) {
+		imageCreateInfo.extent = { 1, 1, 1 };
 	}
+	
+	// Recording into the shared upload batch
+	VkCommandBuffer layoutCmd = vulkanAPIHandler->getUploadBatcher()->getCommandBuffer();
 
-	// Flush command buffer
-	vulkanAPIHandler->endSingleTimeCommands(layoutCmd);
+	// Create cube map array image
+	vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowCubeMapImage, shadowCubeMapMemory);
 
-	// Create samplers
+	// Image barrier for optimal image (target), covering the faces of all lights
+	vulkanAPIHandler->transitionImageLayout(layoutCmd, shadowCubeMapImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, NUM_SHADOW_MAP_LAYERS);
+
+	vulkanAPIHandler->getUploadBatcher()->commit();
+
+	// Create sampler
 	VkSamplerCreateInfo sampler = {};
 	sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 	sampler.magFilter = CUBE_MAP_TEX_FILTER;
@@ -294,35 +711,104 @@ void Scene::prepareCubeMaps() {
 	sampler.minLod = 0.0f;
 	sampler.maxLod = 1.0f;
 	sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+
+	// Linear filtering of depth formats is optional
+	if (depthShadowMaps && !(vulkanAPIHandler->getFormatProperties(format).optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+		sampler.magFilter = VK_FILTER_NEAREST;
+		sampler.minFilter = VK_FILTER_NEAREST;
+	}
 	
-	for (int i = 0; i < shadowCubeMapImages.size(); i++) {
-		if (vkCreateSampler(device, &sampler, nullptr, shadowCubeMapSamplers[i].replace()) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create cubemap sampler");
+	if (vkCreateSampler(device, &sampler, nullptr, shadowCubeMapSampler.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create cubemap sampler");
+	}
+
+	// Create image view. The fragment shader selects a light's cube map by its index in the array
+	VkImageViewCreateInfo view = {};
+	view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view.viewType = VK_IMAGE_VIEW_TYPE_CUBE_ARRAY;
+	view.format = format;
+	view.components = { VK_COMPONENT_SWIZZLE_R };
+	view.subresourceRange = { depthShadowMaps ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	view.subresourceRange.layerCount = NUM_SHADOW_MAP_LAYERS;
+	view.image = shadowCubeMapImage;
+
+	if (vulkanAPIHandler->getRenderSettings().shadowCubeMapArray) {
+		vulkanAPIHandler->createImageView(view, shadowCubeMapImageView);
+	}
+	else {
+		// The same layers, one cube map per light. Rendering and copies still address the whole image
+		VkImageViewCreateInfo lightView = view;
+		lightView.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
+		lightView.subresourceRange.layerCount = NUM_CUBE_FACES;
+
+		shadowCubeMapLightViews.reserve(NUM_LIGHTS);
+		for (int i = 0; i < NUM_LIGHTS; i++) {
+			shadowCubeMapLightViews.emplace_back(VDeleter<VkImageView>{ device, vkDestroyImageView });
+		}
+
+		for (int i = 0; i < NUM_LIGHTS; i++) {
+			lightView.subresourceRange.baseArrayLayer = i * NUM_CUBE_FACES;
+			vulkanAPIHandler->createImageView(lightView, shadowCubeMapLightViews[i]);
 		}
 	}
 
-	// Create image views
-	for (int i = 0; i < shadowCubeMapImages.size(); i++) {
-		VkImageViewCreateInfo view = {};
-		view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		view.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
-		view.format = format;
-		view.components = { VK_COMPONENT_SWIZZLE_R };
-		view.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-		view.subresourceRange.layerCount = NUM_CUBE_FACES;
-		view.image = shadowCubeMapImages[i];
+	// Dual-paraboloid lights sample their first two layers as 2D textures
+	view.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	vulkanAPIHandler->createImageView(view, shadowParaboloidImageView);
 
-		vulkanAPIHandler->createImageView(view, shadowCubeMapImageViews[i]);
+	if (vulkanAPIHandler->getRenderSettings().shadowAtlas) {
+		prepareShadowAtlas();
 	}
 }
 
-// Prepare a new framebuffer for offscreen rendering
-// The contents of this framebuffer are then
+// The atlas is a single 2D image in the shadow map format, sampled with the cube map sampler
+void Scene::prepareShadowAtlas() {
+	VkFormat format = vulkanAPIHandler->getShadowMapFormat();
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.format = format;
+	imageCreateInfo.extent = { SHADOW_ATLAS_DIM, SHADOW_ATLAS_DIM, 1 };
+	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | (depthShadowMaps ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowAtlasImage, shadowAtlasMemory);
+
+	VkCommandBuffer layoutCmd = vulkanAPIHandler->getUploadBatcher()->getCommandBuffer();
+	vulkanAPIHandler->transitionImageLayout(layoutCmd, shadowAtlasImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	vulkanAPIHandler->getUploadBatcher()->commit();
+
+	// A 2D array with one layer, so it can share the sampler type with the paraboloid view it replaces
+	VkImageViewCreateInfo view = {};
+	view.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	view.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+	view.format = format;
+	view.subresourceRange = { depthShadowMaps ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	view.image = shadowAtlasImage;
+
+	vulkanAPIHandler->createImageView(view, shadowAtlasImageView);
+}
+
+// Prepare the framebuffers for offscreen rendering
+// The contents of these framebuffers are then
 // copied to the different cube map faces
 void Scene::prepareOffscreenFramebuffer() {
 	offscreenPass.width = OFFSCREEN_FB_TEX_DIM;
 	offscreenPass.height = OFFSCREEN_FB_TEX_DIM;
 
+	// Nothing is copied with layered rendering, so the intermediate framebuffers are not needed
+	if (vulkanAPIHandler->getRenderSettings().layeredShadows) {
+		prepareLayeredFramebuffers();
+		return;
+	}
+
 	// Color attachment
 	VkImageCreateInfo imageCreateInfo = {};
 	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -352,20 +838,10 @@ void Scene::prepareOffscreenFramebuffer() {
 	colorImageView.subresourceRange.baseArrayLayer = 0;
 	colorImageView.subresourceRange.layerCount = 1;
 
-	vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, offscreenPass.color.image, offscreenPass.color.memory);
-	
-	// Start recording command buffer
-	VkCommandBuffer layoutCmd = vulkanAPIHandler->beginSingleTimeCommands();
-
-	vulkanAPIHandler->transitionImageLayout(layoutCmd, offscreenPass.color.image, OFFSCREEN_FB_COLOR_FORMAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-
-	colorImageView.image = offscreenPass.color.image;
-
-	vulkanAPIHandler->createImageView(colorImageView, offscreenPass.color.view);
-
 	// Depth stencil attachment
-	imageCreateInfo.format = frameBufferDepthFormat;
-	imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	VkImageCreateInfo depthImageCreateInfo = imageCreateInfo;
+	depthImageCreateInfo.format = frameBufferDepthFormat;
+	depthImageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
 
 	VkImageViewCreateInfo depthStencilView = {};
 	depthStencilView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -379,117 +855,131 @@ void Scene::prepareOffscreenFramebuffer() {
 	depthStencilView.subresourceRange.baseArrayLayer = 0;
 	depthStencilView.subresourceRange.layerCount = 1;
 
-	vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, offscreenPass.depth.image, offscreenPass.depth.memory);
+	// Recording into the shared upload batch
+	VkCommandBuffer layoutCmd = vulkanAPIHandler->getUploadBatcher()->getCommandBuffer();
 
-	vulkanAPIHandler->transitionImageLayout(layoutCmd, offscreenPass.depth.image, frameBufferDepthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1, true);
+	// Every target has its own depth attachment as well, otherwise the faces would wait for each other's depth tests.
+	// The color attachments start out UNDEFINED, the render pass clears them anyway
+	offscreenPass.targets.resize(NUM_OFFSCREEN_TARGETS);
 
-	// Stop commandBuffer recording
-	vulkanAPIHandler->endSingleTimeCommands(layoutCmd);
+	for (auto& target : offscreenPass.targets) {
+		vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, target.color.image, target.color.memory);
 
-	depthStencilView.image = offscreenPass.depth.image;
-	vulkanAPIHandler->createImageView(depthStencilView, offscreenPass.depth.view);
+		colorImageView.image = target.color.image;
+		vulkanAPIHandler->createImageView(colorImageView, target.color.view);
 
-	VkImageView attachments[2];
-	attachments[0] = offscreenPass.color.view;
-	attachments[1] = offscreenPass.depth.view;
+		vulkanAPIHandler->createImage(depthImageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, target.depth.image, target.depth.memory);
+		vulkanAPIHandler->transitionImageLayout(layoutCmd, target.depth.image, frameBufferDepthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1, true);
 
-	VkFramebufferCreateInfo fbufCreateInfo = {};
-	fbufCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	fbufCreateInfo.renderPass = offscreenPass.renderPass;
-	fbufCreateInfo.attachmentCount = 2;
-	fbufCreateInfo.pAttachments = attachments;
-	fbufCreateInfo.width = offscreenPass.width;
-	fbufCreateInfo.height = offscreenPass.height;
-	fbufCreateInfo.layers = 1;
+		depthStencilView.image = target.depth.image;
+		vulkanAPIHandler->createImageView(depthStencilView, target.depth.view);
+
+		VkImageView attachments[2];
+		attachments[0] = target.color.view;
+		attachments[1] = target.depth.view;
+
+		VkFramebufferCreateInfo fbufCreateInfo = {};
+		fbufCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		fbufCreateInfo.renderPass = offscreenPass.renderPass;
+		fbufCreateInfo.attachmentCount = 2;
+		fbufCreateInfo.pAttachments = attachments;
+		fbufCreateInfo.width = offscreenPass.width;
+		fbufCreateInfo.height = offscreenPass.height;
+		fbufCreateInfo.layers = 1;
+
+		if (vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &target.frameBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create offscreen framebuffer");
+		}
+	}
 
-	if (vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, &offscreenPass.frameBuffer) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create offscreen framebuffer");
+	vulkanAPIHandler->getUploadBatcher()->commit();
+}
+
+// Renders the dirty faces in batches, one face per offscreen target. The passes of a batch only wait for the
+// previous batch's copies, and the copies of a batch wait for its passes, both through the render pass dependencies
+void Scene::updateCubeFaces(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	std::vector<std::pair<uint32_t, uint32_t>> dirtyFaces;
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+			if (shadowMaps[i].dirtyFaces & (1 << face)) {
+				dirtyFaces.push_back({ i, face });
+			}
+		}
+	}
+
+	if (dirtyFaces.empty()) {
+		return;
+	}
+
+	// Change image layout for the faces of all lights to transfer destination in one barrier. The transition keeps the faces
+	// that are not copied. The barrier also waits for the previous frame's scene pass to stop sampling the shadow maps
+	vulkanAPIHandler->transitionImageLayout(commandBuffer, shadowCubeMapImage, OFFSCREEN_FB_COLOR_FORMAT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, NUM_SHADOW_MAP_LAYERS);
+
+	size_t batchSize = offscreenPass.targets.size();
+	for (size_t batchStart = 0; batchStart < dirtyFaces.size(); batchStart += batchSize) {
+		size_t batchEnd = std::min(dirtyFaces.size(), batchStart + batchSize);
+
+		for (size_t i = batchStart; i < batchEnd; i++) {
+			renderCubeFace(commandBuffer, dirtyFaces[i].second, dirtyFaces[i].first, frameIndex, offscreenPass.targets[i - batchStart]);
+		}
+
+		for (size_t i = batchStart; i < batchEnd; i++) {
+			copyCubeFace(commandBuffer, dirtyFaces[i].second, dirtyFaces[i].first, offscreenPass.targets[i - batchStart]);
+		}
 	}
+
+	// Change image layout for all cubemap faces to shader read after they have been copied
+	vulkanAPIHandler->transitionImageLayout(commandBuffer, shadowCubeMapImage, OFFSCREEN_FB_COLOR_FORMAT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, NUM_SHADOW_MAP_LAYERS);
 }
 
-// Updates a single cube map face
-// Renders the scene with face's view and does 
-// a copy from framebuffer to cube face
+// Renders the scene with face's view into one of the offscreen targets
 // Uses push constants for quick update of
 // view matrix for the current cube map face
-void Scene::updateCubeFace(uint32_t faceIndex, uint32_t lightIndex) {
+void Scene::renderCubeFace(VkCommandBuffer commandBuffer, uint32_t faceIndex, uint32_t lightIndex, uint32_t frameIndex, const OffscreenTarget& target) {
+	// Where nothing is drawn, nothing is between the light and the fragment
 	VkClearValue clearValues[2];
-	clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+	clearValues[0].color = { { std::numeric_limits<float>::max(), 0.0f, 0.0f, 1.0f } };
 	clearValues[1].depthStencil = { 1.0f, 0 };
 
 	VkRenderPassBeginInfo renderPassBeginInfo = {};
 	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	// Reuse render pass from example pass
 	renderPassBeginInfo.renderPass = offscreenPass.renderPass;
-	renderPassBeginInfo.framebuffer = offscreenPass.frameBuffer;
+	renderPassBeginInfo.framebuffer = target.frameBuffer;
 	renderPassBeginInfo.renderArea.extent.width = offscreenPass.width;
 	renderPassBeginInfo.renderArea.extent.height = offscreenPass.height;
 	renderPassBeginInfo.clearValueCount = 2;
 	renderPassBeginInfo.pClearValues = clearValues;
 
 	// Update view matrix via push constant
-	glm::mat4 viewMatrix = glm::mat4();
-	glm::vec3 lightPosition = glm::vec3(0, 0, 0);
-	
-	// Cube map faces generally have to use -y as their up axis. http://stackoverflow.com/questions/11685608/convention-of-faces-in-opengl-cubemapping
-	// The math is also inverted due to this.
-	switch (faceIndex) {
-	case 0: // POSITIVE_X 
-		viewMatrix = glm::lookAt(lightPosition, lightPosition - glm::vec3(1, 0, 0), glm::vec3(0, -1, 0));
-		break;
-	case 1:	// NEGATIVE_X
-		viewMatrix = glm::lookAt(lightPosition, lightPosition + glm::vec3(1, 0, 0), glm::vec3(0, -1, 0));
-		break;
-	case 2:	// POSITIVE_Y
-		viewMatrix = glm::lookAt(lightPosition, lightPosition - glm::vec3(0, 1, 0), glm::vec3(0, 0, 1));
-		break;
-	case 3:	// NEGATIVE_Y
-		viewMatrix = glm::lookAt(lightPosition, lightPosition + glm::vec3(0, 1, 0), glm::vec3(0, 0, -1));
-		break;
-	case 4:	// POSITIVE_Z
-		viewMatrix = glm::lookAt(lightPosition, lightPosition - glm::vec3(0, 0, 1), glm::vec3(0, -1, 0));
-		break;
-	case 5:	// NEGATIVE_Z
-		viewMatrix = glm::lookAt(lightPosition, lightPosition + glm::vec3(0, 0, 1), glm::vec3(0, -1, 0));
-		break;
-	} 
+	glm::mat4 viewMatrix = getCubeFaceViewMatrix(faceIndex);
 
 	// Render scene from cube face's point of view
-	vkCmdBeginRenderPass(offscreenPass.commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 	PushConstants pushConstant(viewMatrix, lightIndex);
 
 	// Update shader push constant block
 	// Contains current face view matrix
-	vkCmdPushConstants(offscreenPass.commandBuffer,
+	vkCmdPushConstants(commandBuffer,
 					   offscreenPipelineLayout,
 					   VK_SHADER_STAGE_VERTEX_BIT,
 					   0,
 					   sizeof(PushConstants),
 					   &pushConstant);
 
-	// Binding buffers and issuing draw calls per renderable
-	vkCmdBindPipeline(offscreenPass.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, offscreenPipeline);
-	vkCmdBindDescriptorSets(offscreenPass.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, offscreenPipelineLayout, SCENE_UBO, 1, &descriptorSet, 0, nullptr);
+	// Binding buffers and issuing draw calls per instance batch
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, offscreenPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, offscreenPipelineLayout, SCENE_UBO, 1, &descriptorSets[frameIndex], 0, nullptr);
 	
-	VkDeviceSize offsets[] = { 0 };
-	for (std::vector<int>::size_type i = 0; i != renderableObjects.size(); i++) {
-		if (renderableObjects[i].first.castShadows) {
-			VkBuffer currentVertexBuffer[] = { renderableObjects[i].second->getVertexBuffer() };
-			VkDescriptorSet currentDescriptorSet = renderableObjects[i].second->getDescriptorSet();
-
-			vkCmdBindVertexBuffers(offscreenPass.commandBuffer, 0, 1, currentVertexBuffer, offsets);
-			vkCmdBindIndexBuffer(offscreenPass.commandBuffer, renderableObjects[i].second->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-			vkCmdBindDescriptorSets(offscreenPass.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, offscreenPipelineLayout, RENDERABLE_UBO, 1, &currentDescriptorSet, 0, nullptr);
-
-			vkCmdDrawIndexed(offscreenPass.commandBuffer, renderableObjects[i].second->numIndices(), 1, 0, 0, 0);
-		}
-	} 
+	drawShadowCasters(commandBuffer, offscreenPipelineLayout, frameIndex, DRAW_SHADOW_CASTERS, lightIndex, 1 << faceIndex, faceIndex);
 
-	vkCmdEndRenderPass(offscreenPass.commandBuffer);
-	// Make sure color writes to the framebuffer are finished before using it as transfer source
-	vulkanAPIHandler->transitionImageLayout(offscreenPass.commandBuffer, offscreenPass.color.image, OFFSCREEN_FB_COLOR_FORMAT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+	// The render pass leaves the color attachment in TRANSFER_SRC_OPTIMAL and makes its writes visible to the copy
+	vkCmdEndRenderPass(commandBuffer);
+}
 
+// Copies an offscreen target into the face's layer of the cube map array
+void Scene::copyCubeFace(VkCommandBuffer commandBuffer, uint32_t faceIndex, uint32_t lightIndex, const OffscreenTarget& target) {
 	// Copy region for the transfer from framebuffer to cube face
 	VkImageCopy copyRegion = {};
 
@@ -500,7 +990,7 @@ void Scene::updateCubeFace(uint32_t faceIndex, uint32_t lightIndex) {
 	copyRegion.srcOffset = { 0, 0, 0 };
 
 	copyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	copyRegion.dstSubresource.baseArrayLayer = faceIndex;
+	copyRegion.dstSubresource.baseArrayLayer = lightIndex * NUM_CUBE_FACES + faceIndex;
 	copyRegion.dstSubresource.mipLevel = 0;
 	copyRegion.dstSubresource.layerCount = 1;
 	copyRegion.dstOffset = { 0, 0, 0 };
@@ -510,58 +1000,340 @@ void Scene::updateCubeFace(uint32_t faceIndex, uint32_t lightIndex) {
 	copyRegion.extent.depth = 1;
 	
 	// Put image copy into command buffer
-	vkCmdCopyImage(offscreenPass.commandBuffer,
-				   offscreenPass.color.image,
+	vkCmdCopyImage(commandBuffer,
+				   target.color.image,
 				   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-				   shadowCubeMapImages[lightIndex],
+				   shadowCubeMapImage,
 				   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 				   1,
 				   &copyRegion);
-
-	// Transform framebuffer color attachment back 
-	vulkanAPIHandler->transitionImageLayout(offscreenPass.commandBuffer, offscreenPass.color.image, OFFSCREEN_FB_COLOR_FORMAT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
 }
 
-// Command buffer for rendering and copying all cube map faces
-void Scene::buildOffscreenCommandBuffer() {
-	if (offscreenPass.commandBuffer == VK_NULL_HANDLE) {
-		offscreenPass.commandBuffer = vulkanAPIHandler->beginSingleTimeCommands(false);
-	}
-	
-	if (offscreenPass.semaphore == VK_NULL_HANDLE) {
-		// The semaphore is used to synchronize offscreen rendering. This happens before the color/main rendering
-		VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-		semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-		
-		if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &offscreenPass.semaphore) != VK_SUCCESS) {
-			throw std::runtime_error("failed to create offscreen semaphore");
-		}
-	}
+// Renders all six faces of a light's cube map in one render pass. The geometry shader sends every
+// triangle to each face with gl_Layer, so nothing has to be copied afterwards. Dual-paraboloid
+// lights render their two halves into the first two layers the same way
+void Scene::updateLayeredCubeMap(VkCommandBuffer commandBuffer, uint32_t lightIndex, uint32_t frameIndex, uint32_t faces) {
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = layeredRenderPass;
+	renderPassBeginInfo.framebuffer = layeredFrameBuffers[lightIndex];
+	renderPassBeginInfo.renderArea.extent.width = CUBE_MAP_TEX_DIM;
+	renderPassBeginInfo.renderArea.extent.height = CUBE_MAP_TEX_DIM;
 
-	VkCommandBufferBeginInfo cmdBufInfo = {};
-	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-	if (vkBeginCommandBuffer(offscreenPass.commandBuffer, &cmdBufInfo) != VK_SUCCESS) {
-		throw std::runtime_error("failed to begin offscreen command buffer");
-	}
+	// The pass loads the cube map, only the faces that are rendered again are cleared
+	clearCubeFaces(commandBuffer, faces, true);
 
-	// Change image layout for all cubemap faces to transfer destination
-	for (int i = 0; i < shadowCubeMapImages.size(); i++) {
-		vulkanAPIHandler->transitionImageLayout(offscreenPass.commandBuffer, shadowCubeMapImages[i], OFFSCREEN_FB_COLOR_FORMAT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, NUM_CUBE_FACES);
-	}
+	// The face view matrices are in the scene UBO, only the light index and the faces to render are pushed
+	PushConstants pushConstant(glm::mat4(), lightIndex, faces);
+	vkCmdPushConstants(commandBuffer,
+					   layeredPipelineLayout,
+					   VK_SHADER_STAGE_GEOMETRY_BIT,
+					   0,
+					   sizeof(PushConstants),
+					   &pushConstant);
 
-	for (uint32_t i = 0; i < shadowCubeMapImages.size(); i++) {
-		for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
-			updateCubeFace(face, i);
-		}
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, usesParaboloidShadows(lightIndex) ? paraboloidPipeline : layeredPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layeredPipelineLayout, SCENE_UBO, 1, &descriptorSets[frameIndex], 0, nullptr);
+
+	// All faces are drawn by the same draw calls, so a caster is drawn if it reaches any of them
+	drawShadowCasters(commandBuffer, layeredPipelineLayout, frameIndex, DRAW_SHADOW_CASTERS, lightIndex, faces);
+
+	// The render pass leaves the cube map in SHADER_READ_ONLY_OPTIMAL
+	vkCmdEndRenderPass(commandBuffer);
+}
+
+// Builds the dirty cube maps from their cached static layers and the moving shadow casters. The copies
+// of all lights share one pair of barriers on the cube map array
+void Scene::updateCachedCubeMaps(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	VkFormat shadowMapFormat = vulkanAPIHandler->getShadowMapFormat();
+	std::vector<uint32_t> cachedLights;
+
+	// Dual-paraboloid lights have no static layer and are rendered in one pass
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		if (shadowMaps[i].dirtyFaces == 0) {
+			continue;
+		}
+
+		if (usesParaboloidShadows(i)) {
+			updateLayeredCubeMap(commandBuffer, i, frameIndex, shadowMaps[i].dirtyFaces);
+		}
+		else {
+			updateStaticShadowLayer(commandBuffer, i, frameIndex);
+			cachedLights.push_back(i);
+		}
 	}
 
-	// Change image layout for all cubemap faces to shader read after they have been copied
-	for (int i = 0; i < shadowCubeMapImages.size(); i++) {
-		vulkanAPIHandler->transitionImageLayout(offscreenPass.commandBuffer, shadowCubeMapImages[i], OFFSCREEN_FB_COLOR_FORMAT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, NUM_CUBE_FACES);
+	if (cachedLights.empty()) {
+		return;
+	}
+
+	// The barrier also waits for the previous frame's scene pass to stop sampling the cube maps
+	vulkanAPIHandler->transitionImageLayout(commandBuffer, shadowCubeMapImage, shadowMapFormat, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, NUM_SHADOW_MAP_LAYERS);
+
+	for (uint32_t i : cachedLights) {
+		copyStaticShadowLayer(commandBuffer, i, shadowMaps[i].dirtyFaces);
+	}
+
+	// Lights that were not copied keep their contents through the transition
+	vulkanAPIHandler->transitionImageLayout(commandBuffer, shadowCubeMapImage, shadowMapFormat, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, NUM_SHADOW_MAP_LAYERS);
+
+	// The moving objects keep the copied distances wherever they are further away from the light.
+	// The pass is the same as for uncached rendering, except that the dirty faces are not cleared
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+
+	for (uint32_t i : cachedLights) {
+		uint32_t faces = shadowMaps[i].dirtyFaces;
+
+		VkRenderPassBeginInfo renderPassBeginInfo = {};
+		renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		renderPassBeginInfo.renderPass = layeredRenderPass;
+		renderPassBeginInfo.framebuffer = layeredFrameBuffers[i];
+		renderPassBeginInfo.renderArea.extent.width = CUBE_MAP_TEX_DIM;
+		renderPassBeginInfo.renderArea.extent.height = CUBE_MAP_TEX_DIM;
+
+		PushConstants pushConstant(glm::mat4(), i, faces);
+
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		clearCubeFaces(commandBuffer, faces, false);
+		vkCmdPushConstants(commandBuffer, layeredPipelineLayout, VK_SHADER_STAGE_GEOMETRY_BIT, 0, sizeof(PushConstants), &pushConstant);
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, depthShadowMaps ? layeredPipeline : dynamicLayerPipeline);
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layeredPipelineLayout, SCENE_UBO, 1, &descriptorSets[frameIndex], 0, nullptr);
+
+		drawShadowCasters(commandBuffer, layeredPipelineLayout, frameIndex, DRAW_DYNAMIC_SHADOW_CASTERS, i, faces);
+
+		vkCmdEndRenderPass(commandBuffer);
 	}
+}
+
+// The static layer is only rendered again if the light has moved since it was last rendered
+void Scene::updateStaticShadowLayer(VkCommandBuffer commandBuffer, uint32_t lightIndex, uint32_t frameIndex) {
+	StaticShadowLayer& staticLayer = staticLayers[lightIndex];
+	glm::vec4 lightPosition = sceneUBO.lightPositions[lightIndex];
+
+	if (staticLayer.valid && staticLayer.lightPosition == lightPosition) {
+		staticLayerReuses++;
+		return;
+	}
+
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+
+	// Nothing is drawn where no static geometry is hit, so the layer is cleared to the largest distance
+	// for the MIN blend of the dynamic layer to work. Depth-only layers are cleared to the far plane
+	VkClearValue clearValues[2];
+	clearValues[0].color = { { std::numeric_limits<float>::max(), 0.0f, 0.0f, 1.0f } };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	if (depthShadowMaps) {
+		clearValues[0].depthStencil = { 1.0f, 0 };
+	}
+
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = staticLayerRenderPass;
+	renderPassBeginInfo.framebuffer = staticLayerFrameBuffers[lightIndex];
+	renderPassBeginInfo.renderArea.extent.width = CUBE_MAP_TEX_DIM;
+	renderPassBeginInfo.renderArea.extent.height = CUBE_MAP_TEX_DIM;
+	renderPassBeginInfo.clearValueCount = depthShadowMaps ? 1 : 2;
+	renderPassBeginInfo.pClearValues = clearValues;
+
+	PushConstants pushConstant(glm::mat4(), lightIndex);
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdPushConstants(commandBuffer, layeredPipelineLayout, VK_SHADER_STAGE_GEOMETRY_BIT, 0, sizeof(PushConstants), &pushConstant);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layeredPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layeredPipelineLayout, SCENE_UBO, 1, &descriptorSets[frameIndex], 0, nullptr);
+
+	drawShadowCasters(commandBuffer, layeredPipelineLayout, frameIndex, DRAW_STATIC_SHADOW_CASTERS, lightIndex, ALL_CUBE_FACES);
+
+	// The render pass leaves the static layer in TRANSFER_SRC_OPTIMAL, where it stays until it is rendered again
+	vkCmdEndRenderPass(commandBuffer);
+
+	staticLayer.valid = true;
+	staticLayer.lightPosition = lightPosition;
+	staticLayerRenders++;
+}
+
+// Only the dirty faces are reset to the static layer, the others keep their moving objects
+void Scene::copyStaticShadowLayer(VkCommandBuffer commandBuffer, uint32_t lightIndex, uint32_t faces) {
+	VkImageAspectFlags shadowMapAspect = vulkanAPIHandler->hasDepthShadowMaps() ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+
+	std::vector<VkImageCopy> copyRegions;
+	for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+		if ((faces & (1 << face)) == 0) {
+			continue;
+		}
+
+		VkImageCopy copyRegion = {};
+		copyRegion.srcSubresource = { shadowMapAspect, 0, face, 1 };
+		copyRegion.dstSubresource = { shadowMapAspect, 0, lightIndex * NUM_CUBE_FACES + face, 1 };
+		copyRegion.extent = { CUBE_MAP_TEX_DIM, CUBE_MAP_TEX_DIM, 1 };
+		copyRegions.push_back(copyRegion);
+	}
+
+	vkCmdCopyImage(commandBuffer,
+				   staticLayerImages[lightIndex],
+				   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				   shadowCubeMapImage,
+				   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				   copyRegions.size(),
+				   copyRegions.data());
+}
+
+// Every light sets its six tiles as the viewports of the atlas pipeline, the geometry shader picks the face's
+// viewport with gl_ViewportIndex. Only the dirty tiles are cleared, the others keep their shadows
+void Scene::updateShadowAtlas(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	bool anyDirty = std::any_of(shadowMaps.begin(), shadowMaps.end(), [](const ShadowMapState& shadowMap) {
+		return shadowMap.dirtyFaces != 0;
+	});
+
+	if (!anyDirty) {
+		return;
+	}
+
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+
+	VkRenderPassBeginInfo renderPassBeginInfo = {};
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = layeredRenderPass;
+	renderPassBeginInfo.framebuffer = shadowAtlasFrameBuffer;
+	renderPassBeginInfo.renderArea.extent.width = SHADOW_ATLAS_DIM;
+	renderPassBeginInfo.renderArea.extent.height = SHADOW_ATLAS_DIM;
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowAtlasPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layeredPipelineLayout, SCENE_UBO, 1, &descriptorSets[frameIndex], 0, nullptr);
+
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		uint32_t faces = shadowMaps[i].dirtyFaces;
+		if (faces == 0) {
+			continue;
+		}
 
-	if (vkEndCommandBuffer(offscreenPass.commandBuffer) != VK_SUCCESS) {
+		uint32_t tileSize = getShadowAtlasTileSize(shadowMaps[i].atlasLevel);
+		std::array<VkViewport, NUM_CUBE_FACES> viewports;
+		std::array<VkRect2D, NUM_CUBE_FACES> scissors;
+		std::vector<VkClearRect> clearRects;
+
+		for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+			glm::uvec2 offset = shadowMaps[i].atlasTileOffsets[face];
+			viewports[face] = { float(offset.x), float(offset.y), float(tileSize), float(tileSize), 0.0f, 1.0f };
+			scissors[face] = { { int32_t(offset.x), int32_t(offset.y) }, { tileSize, tileSize } };
+
+			if (faces & (1 << face)) {
+				VkClearRect clearRect = {};
+				clearRect.rect = scissors[face];
+				clearRect.layerCount = 1;
+				clearRects.push_back(clearRect);
+			}
+		}
+
+		vkCmdSetViewport(commandBuffer, 0, viewports.size(), viewports.data());
+		vkCmdSetScissor(commandBuffer, 0, scissors.size(), scissors.data());
+
+		// The depth attachment of R32 distances is shared by all tiles and cleared with them
+		std::vector<VkClearAttachment> clearAttachments(1);
+		clearAttachments[0].aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+		clearAttachments[0].clearValue.depthStencil = { 1.0f, 0 };
+
+		if (!depthShadowMaps) {
+			VkClearAttachment colorAttachment = {};
+			colorAttachment.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			colorAttachment.colorAttachment = 0;
+			colorAttachment.clearValue.color = { { std::numeric_limits<float>::max(), 0.0f, 0.0f, 1.0f } };
+			clearAttachments.push_back(colorAttachment);
+		}
+
+		vkCmdClearAttachments(commandBuffer, clearAttachments.size(), clearAttachments.data(), clearRects.size(), clearRects.data());
+
+		PushConstants pushConstant(glm::mat4(), i, faces);
+		vkCmdPushConstants(commandBuffer, layeredPipelineLayout, VK_SHADER_STAGE_GEOMETRY_BIT, 0, sizeof(PushConstants), &pushConstant);
+
+		drawShadowCasters(commandBuffer, layeredPipelineLayout, frameIndex, DRAW_SHADOW_CASTERS, i, faces);
+	}
+
+	// The render pass leaves the atlas in SHADER_READ_ONLY_OPTIMAL
+	vkCmdEndRenderPass(commandBuffer);
+}
+
+// Command buffers for rendering the shadow maps, one per frame in flight
+void Scene::createOffscreenCommandBuffers() {
+	int numFrames = vulkanAPIHandler->getFramesInFlight();
+	offscreenPass.commandBuffers.resize(numFrames, VK_NULL_HANDLE);
+	offscreenPass.semaphores.resize(numFrames, VK_NULL_HANDLE);
+
+	for (int frame = 0; frame < numFrames; frame++) {
+		if (offscreenPass.commandBuffers[frame] == VK_NULL_HANDLE) {
+			offscreenPass.commandBuffers[frame] = vulkanAPIHandler->allocateCommandBuffer();
+		}
+		
+		if (offscreenPass.semaphores[frame] == VK_NULL_HANDLE) {
+			// The semaphore is used to synchronize offscreen rendering. This happens before the color/main rendering
+			VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+			semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+			
+			if (vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &offscreenPass.semaphores[frame]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create offscreen semaphore");
+			}
+		}
+	}
+}
+
+void Scene::recordOffscreenCommandBuffer(uint32_t frameIndex) {
+	VkCommandBuffer commandBuffer = offscreenPass.commandBuffers[frameIndex];
+
+	VkCommandBufferBeginInfo cmdBufInfo = {};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	if (vkBeginCommandBuffer(commandBuffer, &cmdBufInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin offscreen command buffer");
+	}
+
+	// The offscreen pass is the first work of every frame, so the frame's timestamps are reset here
+	vulkanAPIHandler->resetFrameTimestamps(commandBuffer, frameIndex);
+	vulkanAPIHandler->writeFrameTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frameIndex, TIMESTAMP_OFFSCREEN_BEGIN);
+
+	updateDirtyShadowFaces();
+	scheduleShadowFaces();
+	updateShadowCasterFaces();
+
+	// The draw commands of every view drawn this frame are written before anything is drawn
+	if (gpuCuller != nullptr) {
+		prepareCullingViews();
+		updateDepthPyramid(commandBuffer, frameIndex);
+		gpuCuller->recordCulling(commandBuffer, frameIndex);
+	}
+
+	if (vulkanAPIHandler->getRenderSettings().layeredShadows) {
+		// Layout transitions and the wait for the previous frame's scene pass are part of the render pass
+		if (vulkanAPIHandler->getRenderSettings().shadowAtlas) {
+			updateShadowAtlas(commandBuffer, frameIndex);
+		}
+		else if (vulkanAPIHandler->getRenderSettings().staticShadowCache) {
+			updateCachedCubeMaps(commandBuffer, frameIndex);
+		}
+		else {
+			for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+				if (shadowMaps[i].dirtyFaces != 0) {
+					updateLayeredCubeMap(commandBuffer, i, frameIndex, shadowMaps[i].dirtyFaces);
+				}
+			}
+		}
+
+		vulkanAPIHandler->writeFrameTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frameIndex, TIMESTAMP_OFFSCREEN_END);
+
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to end offscreen command buffer");
+		}
+		return;
+	}
+
+	updateCubeFaces(commandBuffer, frameIndex);
+
+	vulkanAPIHandler->writeFrameTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frameIndex, TIMESTAMP_OFFSCREEN_END);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
 		throw std::runtime_error("failed to end offscreen command buffer");
 	}
 }
@@ -585,6 +1357,17 @@ void Scene::createOffscreenPipelineLayout() {
 	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, offscreenPipelineLayout.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create offscreen pipeline layout!");
 	}
+
+	if (!vulkanAPIHandler->getRenderSettings().layeredShadows) {
+		return;
+	}
+
+	// Same push constant block, read by the geometry shader
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_GEOMETRY_BIT;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, layeredPipelineLayout.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create layered pipeline layout!");
+	}
 }
 
 void Scene::prepareOffscreenRenderpass() {
@@ -596,14 +1379,15 @@ void Scene::prepareOffscreenRenderpass() {
 	osAttachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	osAttachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	osAttachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	osAttachments[0].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-	osAttachments[0].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	// The whole face is cleared, and it is only rendered to be copied into the cube map
+	osAttachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	osAttachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
 
 	// Depth attachment
 	osAttachments[1].format = frameBufferDepthFormat;
 	osAttachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
 	osAttachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	osAttachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	osAttachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	osAttachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	osAttachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	osAttachments[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
@@ -623,20 +1407,936 @@ void Scene::prepareOffscreenRenderpass() {
 	subpass.pColorAttachments = &colorReference;
 	subpass.pDepthStencilAttachment = &depthReference;
 
+	std::array<VkSubpassDependency, 2> dependencies = {};
+
+	// The offscreen target may still be copied from by the previous batch of faces, and its depth
+	// attachment may still be written by the face that was rendered into it before
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Makes the distances visible to the copy into the cube map
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
 	VkRenderPassCreateInfo renderPassCreateInfo = {};
 	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
 	renderPassCreateInfo.attachmentCount = 2;
 	renderPassCreateInfo.pAttachments = osAttachments;
 	renderPassCreateInfo.subpassCount = 1;
 	renderPassCreateInfo.pSubpasses = &subpass;
+	renderPassCreateInfo.dependencyCount = dependencies.size();
+	renderPassCreateInfo.pDependencies = dependencies.data();
 
 	if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, &offscreenPass.renderPass) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create offscreen render pass!");
 	}
+
+	// The layered framebuffers are created once and have to stay compatible, so the pass is not recreated
+	if (!vulkanAPIHandler->getRenderSettings().layeredShadows || layeredRenderPass != VK_NULL_HANDLE) {
+		return;
+	}
+
+	if (vulkanAPIHandler->hasDepthShadowMaps()) {
+		prepareDepthShadowRenderpasses();
+		return;
+	}
+
+	// Faces that are not dirty keep their contents, the dirty ones are cleared inside the pass.
+	// Depth is only needed while a light is rendered
+	osAttachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	osAttachments[0].initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	osAttachments[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	osAttachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	osAttachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+	// Waits for the previous frame's scene pass to stop sampling the cube map,
+	// and for the previous light's pass to finish with the shared depth attachment
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Makes the distances visible to the scene pass
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, layeredRenderPass.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create layered render pass!");
+	}
+
+	if (!vulkanAPIHandler->getRenderSettings().staticShadowCache) {
+		return;
+	}
+
+	// The static layer is only read by the copies into the cube map. Its previous contents may still be
+	// copied by the last frame, and the depth attachment may still be used by the previous light's pass.
+	// It is always rendered from scratch, with all six faces
+	osAttachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	osAttachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	osAttachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	osAttachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, staticLayerRenderPass.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create static shadow layer render pass!");
+	}
+
+	// The dynamic layer is blended on top of the copied static layer with layeredRenderPass. The copies
+	// end with a barrier into SHADER_READ_ONLY_OPTIMAL, which the pass waits for
+}
+
+// Same passes as for the R32 distances, with the depth-only shadow map as the only attachment
+void Scene::prepareDepthShadowRenderpasses() {
+	VkAttachmentDescription shadowMapAttachment = {};
+	shadowMapAttachment.format = vulkanAPIHandler->getShadowMapFormat();
+	shadowMapAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	shadowMapAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	shadowMapAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	shadowMapAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	shadowMapAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	shadowMapAttachment.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	shadowMapAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference depthReference = {};
+	depthReference.attachment = 0;
+	depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.pDepthStencilAttachment = &depthReference;
+
+	std::array<VkSubpassDependency, 2> dependencies = {};
+
+	// Waits for the previous frame's scene pass to stop sampling the cube map
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = 0;
+	dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Makes the distances visible to the scene pass
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassCreateInfo = {};
+	renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassCreateInfo.attachmentCount = 1;
+	renderPassCreateInfo.pAttachments = &shadowMapAttachment;
+	renderPassCreateInfo.subpassCount = 1;
+	renderPassCreateInfo.pSubpasses = &subpass;
+	renderPassCreateInfo.dependencyCount = dependencies.size();
+	renderPassCreateInfo.pDependencies = dependencies.data();
+
+	if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, layeredRenderPass.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create layered render pass!");
+	}
+
+	if (!vulkanAPIHandler->getRenderSettings().staticShadowCache) {
+		return;
+	}
+
+	// The static layer is rendered from scratch and only read by the copies into the cube map
+	shadowMapAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	shadowMapAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	shadowMapAttachment.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	if (vkCreateRenderPass(device, &renderPassCreateInfo, nullptr, staticLayerRenderPass.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create static shadow layer render pass!");
+	}
+
+	// The moving objects are depth tested against the static layer that was copied into the cube map
+	// with layeredRenderPass, which keeps the smaller distance without blending
+}
+
+void Scene::prepareLayeredFramebuffers() {
+	// All lights render into the one atlas framebuffer
+	if (vulkanAPIHandler->getRenderSettings().shadowAtlas) {
+		prepareShadowAtlasFramebuffer();
+		return;
+	}
+
+	VkFormat shadowMapFormat = vulkanAPIHandler->getShadowMapFormat();
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+
+	// Depth attachment with one layer per face. Depth-only shadow maps are depth tested against themselves
+	if (!depthShadowMaps) {
+		VkImageCreateInfo imageCreateInfo = {};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.format = frameBufferDepthFormat;
+		imageCreateInfo.extent = { CUBE_MAP_TEX_DIM, CUBE_MAP_TEX_DIM, 1 };
+		imageCreateInfo.mipLevels = 1;
+		imageCreateInfo.arrayLayers = NUM_CUBE_FACES;
+		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, layeredDepthImage, layeredDepthImageMemory);
+		vulkanAPIHandler->transitionImageLayout(layeredDepthImage, frameBufferDepthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, NUM_CUBE_FACES, true);
+
+		VkImageViewCreateInfo depthStencilView = {};
+		depthStencilView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		depthStencilView.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		depthStencilView.format = frameBufferDepthFormat;
+		depthStencilView.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, 0, 1, 0, NUM_CUBE_FACES };
+		depthStencilView.image = layeredDepthImage;
+
+		vulkanAPIHandler->createImageView(depthStencilView, layeredDepthImageView);
+	}
+
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		// The light's cube map seen as an array of six 2D layers, which a framebuffer can render into
+		VkImageViewCreateInfo cubeMapView = {};
+		cubeMapView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		cubeMapView.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		cubeMapView.format = shadowMapFormat;
+		cubeMapView.subresourceRange = { depthShadowMaps ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, i * NUM_CUBE_FACES, NUM_CUBE_FACES };
+		cubeMapView.image = shadowCubeMapImage;
+
+		vulkanAPIHandler->createImageView(cubeMapView, layeredCubeMapViews[i]);
+
+		VkImageView attachments[2];
+		attachments[0] = layeredCubeMapViews[i];
+		attachments[1] = layeredDepthImageView;
+
+		VkFramebufferCreateInfo fbufCreateInfo = {};
+		fbufCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		fbufCreateInfo.renderPass = layeredRenderPass;
+		fbufCreateInfo.attachmentCount = depthShadowMaps ? 1 : 2;
+		fbufCreateInfo.pAttachments = attachments;
+		fbufCreateInfo.width = CUBE_MAP_TEX_DIM;
+		fbufCreateInfo.height = CUBE_MAP_TEX_DIM;
+		fbufCreateInfo.layers = NUM_CUBE_FACES;
+
+		if (vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, layeredFrameBuffers[i].replace()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create layered framebuffer");
+		}
+	}
+
+	if (vulkanAPIHandler->getRenderSettings().staticShadowCache) {
+		prepareStaticShadowLayers();
+	}
+}
+
+// The atlas as the framebuffer of the layered render pass. R32 distances get a depth attachment of the same size,
+// which the tiles share the same way the lights share the layered depth attachment
+void Scene::prepareShadowAtlasFramebuffer() {
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+
+	if (!depthShadowMaps) {
+		VkImageCreateInfo imageCreateInfo = {};
+		imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageCreateInfo.format = frameBufferDepthFormat;
+		imageCreateInfo.extent = { SHADOW_ATLAS_DIM, SHADOW_ATLAS_DIM, 1 };
+		imageCreateInfo.mipLevels = 1;
+		imageCreateInfo.arrayLayers = 1;
+		imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageCreateInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+		imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+		vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, shadowAtlasDepthImage, shadowAtlasDepthMemory);
+		vulkanAPIHandler->transitionImageLayout(shadowAtlasDepthImage, frameBufferDepthFormat, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, 1, true);
+
+		VkImageViewCreateInfo depthStencilView = {};
+		depthStencilView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		depthStencilView.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		depthStencilView.format = frameBufferDepthFormat;
+		depthStencilView.subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT, 0, 1, 0, 1 };
+		depthStencilView.image = shadowAtlasDepthImage;
+
+		vulkanAPIHandler->createImageView(depthStencilView, shadowAtlasDepthImageView);
+	}
+
+	VkImageView attachments[2];
+	attachments[0] = shadowAtlasImageView;
+	attachments[1] = shadowAtlasDepthImageView;
+
+	VkFramebufferCreateInfo fbufCreateInfo = {};
+	fbufCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	fbufCreateInfo.renderPass = layeredRenderPass;
+	fbufCreateInfo.attachmentCount = depthShadowMaps ? 1 : 2;
+	fbufCreateInfo.pAttachments = attachments;
+	fbufCreateInfo.width = SHADOW_ATLAS_DIM;
+	fbufCreateInfo.height = SHADOW_ATLAS_DIM;
+	fbufCreateInfo.layers = 1;
+
+	if (vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, shadowAtlasFrameBuffer.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create shadow atlas framebuffer");
+	}
+}
+
+// One layer of six faces per light that the static shadow casters are rendered into
+void Scene::prepareStaticShadowLayers() {
+	VkFormat shadowMapFormat = vulkanAPIHandler->getShadowMapFormat();
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.format = shadowMapFormat;
+	imageCreateInfo.extent = { CUBE_MAP_TEX_DIM, CUBE_MAP_TEX_DIM, 1 };
+	imageCreateInfo.mipLevels = 1;
+	imageCreateInfo.arrayLayers = NUM_CUBE_FACES;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = (depthShadowMaps ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT) | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	for (int i = 0; i < staticLayerImages.size(); i++) {
+		vulkanAPIHandler->createImage(imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, staticLayerImages[i], staticLayerMemories[i]);
+
+		VkImageViewCreateInfo layerView = {};
+		layerView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		layerView.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+		layerView.format = shadowMapFormat;
+		layerView.subresourceRange = { depthShadowMaps ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, NUM_CUBE_FACES };
+		layerView.image = staticLayerImages[i];
+
+		vulkanAPIHandler->createImageView(layerView, staticLayerImageViews[i]);
+
+		VkImageView attachments[2];
+		attachments[0] = staticLayerImageViews[i];
+		attachments[1] = layeredDepthImageView;
+
+		VkFramebufferCreateInfo fbufCreateInfo = {};
+		fbufCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		fbufCreateInfo.renderPass = staticLayerRenderPass;
+		fbufCreateInfo.attachmentCount = depthShadowMaps ? 1 : 2;
+		fbufCreateInfo.pAttachments = attachments;
+		fbufCreateInfo.width = CUBE_MAP_TEX_DIM;
+		fbufCreateInfo.height = CUBE_MAP_TEX_DIM;
+		fbufCreateInfo.layers = NUM_CUBE_FACES;
+
+		if (vkCreateFramebuffer(device, &fbufCreateInfo, nullptr, staticLayerFrameBuffers[i].replace()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create static shadow layer framebuffer");
+		}
+	}
+
+	// The new images have no contents yet
+	invalidateShadows();
+}
+
+void Scene::invalidateShadows() {
+	for (auto& staticLayer : staticLayers) {
+		staticLayer.valid = false;
+	}
+
+	for (auto& shadowMap : shadowMaps) {
+		shadowMap.valid = false;
+		shadowMap.renderedFaces = 0;
+	}
+}
+
+void Scene::printShadowMapStatistics() {
+	VkDeviceSize shadowMapBytes = shadowCubeMapMemory.getSize() + shadowAtlasMemory.getSize();
+
+	// Everything else the shadow pass renders into
+	VkDeviceSize attachmentBytes = layeredDepthImageMemory.getSize() + shadowAtlasDepthMemory.getSize();
+	for (auto& target : offscreenPass.targets) {
+		attachmentBytes += target.color.memory.getSize() + target.depth.memory.getSize();
+	}
+	for (auto& memory : staticLayerMemories) {
+		attachmentBytes += memory.getSize();
+	}
+
+	// Smallest distance difference that can be stored at the edge of a light's range
+	float range = LIGHT_ATTENUATION_RADIUS;
+	float resolution;
+	switch (vulkanAPIHandler->getRenderSettings().shadowFormat) {
+	case SHADOW_FORMAT_D32:
+		resolution = (std::nextafter(range / Z_FAR, 2.f) - range / Z_FAR) * Z_FAR;
+		break;
+	case SHADOW_FORMAT_D16:
+		resolution = Z_FAR / 65535.f;
+		break;
+	default:
+		resolution = std::nextafter(range, 2.f * range) - range;
+		break;
+	}
+
+	printf("Shadow maps: %s, %llu KB sampled, %llu KB of other attachments, distance resolution %g at %g\n",
+		   getShadowMapFormatName(),
+		   (unsigned long long)shadowMapBytes / 1024,
+		   (unsigned long long)attachmentBytes / 1024,
+		   resolution,
+		   range);
+
+	if (vulkanAPIHandler->getRenderSettings().shadowAtlas) {
+		printf("Shadow atlas: %ux%u, face tiles from %u to %u texels\n",
+			   SHADOW_ATLAS_DIM,
+			   SHADOW_ATLAS_DIM,
+			   getShadowAtlasTileSize(0),
+			   getShadowAtlasTileSize(SHADOW_ATLAS_LEVELS - 1));
+	}
+
+	printShadowProjections();
+}
+
+void Scene::printShadowProjections() {
+	const char* cubeProjection = vulkanAPIHandler->getRenderSettings().shadowAtlas ? "atlas cube" : "cube";
+
+	printf("Shadow projections:");
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		printf(" light %u %s%s", i, usesParaboloidShadows(i) ? "dual-paraboloid" : cubeProjection, i + 1 < NUM_LIGHTS ? "," : "\n");
+	}
+}
+
+const char* Scene::getShadowMapFormatName() {
+	switch (vulkanAPIHandler->getRenderSettings().shadowFormat) {
+	case SHADOW_FORMAT_D32:
+		return "D32_SFLOAT depth";
+	case SHADOW_FORMAT_D16:
+		return "D16_UNORM depth";
+	default:
+		return "R32_SFLOAT distance";
+	}
+}
+
+void Scene::collectCullingStatistics(uint32_t frameIndex) {
+	if (gpuCuller != nullptr) {
+		gpuCuller->collectStatistics(frameIndex);
+	}
+}
+
+void Scene::printCullingStatistics() {
+	if (instancesTested > 0) {
+		printf("  Frustum culling: %u instances tested, %u culled, %u drawn (%.1f%% culled)\n", instancesTested, instancesCulled, instancesTested - instancesCulled, 100.f * instancesCulled / instancesTested);
+	}
+
+	instancesTested = 0;
+	instancesCulled = 0;
+
+	if (gpuCuller == nullptr) {
+		return;
+	}
+
+	// Counted for the camera view only
+	const CullingStatistics& statistics = gpuCuller->getStatistics();
+	if (statistics.instancesTested > 0) {
+		uint32_t drawn = statistics.instancesTested - statistics.frustumCulled - statistics.occlusionCulled;
+		printf("  GPU culling: %u instances tested, %u outside the frustum, %u occluded, %u drawn (%.1f%% occluded)\n", statistics.instancesTested, statistics.frustumCulled, statistics.occlusionCulled, drawn, 100.f * statistics.occlusionCulled / statistics.instancesTested);
+	}
+	if (vulkanAPIHandler->getRenderSettings().occlusionCulling) {
+		printf("  Depth pyramid: %u builds in total\n", depthPyramid->getUpdateCount());
+	}
+
+	gpuCuller->resetStatistics();
+}
+
+void Scene::printDrawStatistics(int numberOfFrames) {
+	bool drawSorting = vulkanAPIHandler->getRenderSettings().drawSorting;
+	printf("  Draws: %.1f draw calls, %.1f descriptor set, %.1f vertex buffer and %.1f index buffer binds per frame (%s)\n",
+		   float(drawCalls) / numberOfFrames,
+		   float(descriptorSetBinds) / numberOfFrames,
+		   float(vertexBufferBinds) / numberOfFrames,
+		   float(indexBufferBinds) / numberOfFrames,
+		   drawSorting ? "sorted, redundant binds skipped" : "creation order");
+
+	if (drawSorting && sceneSorts > 0) {
+		printf("  Draw sorting: %u batches, %.1f radix passes per sort\n", (uint32_t)sceneBatchOrder.size(), float(sceneSortPasses) / sceneSorts);
+	}
+
+	drawCalls = 0;
+	descriptorSetBinds = 0;
+	vertexBufferBinds = 0;
+	indexBufferBinds = 0;
+	sceneSortPasses = 0;
+	sceneSorts = 0;
+}
+
+void Scene::printShadowStatistics() {
+	uint32_t totalFaces = shadowFacesRendered + shadowFacesSkipped + shadowFacesDeferred;
+	if (totalFaces > 0) {
+		printf("  Shadow faces: %u rendered, %u skipped (%.1f%% not dirty)\n", shadowFacesRendered, shadowFacesSkipped, 100.f * shadowFacesSkipped / totalFaces);
+	}
+
+	uint32_t budget = vulkanAPIHandler->getRenderSettings().shadowFaceBudget;
+	if (budget > 0) {
+		printf("  Shadow face budget %u: %u faces deferred, longest wait %u frames\n", budget, shadowFacesDeferred, maxFaceWaitFrames);
+	}
+
+	for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+		if (faceCastersDrawn[face] + faceCastersCulled[face] > 0) {
+			printf("  Shadow face %u: %u casters drawn, %u culled\n", face, faceCastersDrawn[face], faceCastersCulled[face]);
+		}
+	}
+
+	if (vulkanAPIHandler->getRenderSettings().shadowAtlas) {
+		printf("  Shadow atlas: %u relayouts, face tiles", shadowAtlasRelayouts);
+		for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+			printf(" %u%s", getShadowAtlasTileSize(shadowMaps[i].atlasLevel), i + 1 < NUM_LIGHTS ? "," : "\n");
+		}
+	}
+
+	uint32_t totalLayers = staticLayerRenders + staticLayerReuses;
+	if (totalLayers > 0) {
+		printf("  Static shadow layers: %u rendered, %u reused (%.1f%% cached)\n", staticLayerRenders, staticLayerReuses, 100.f * staticLayerReuses / totalLayers);
+	}
+
+	shadowFacesRendered = 0;
+	shadowFacesSkipped = 0;
+	shadowFacesDeferred = 0;
+	maxFaceWaitFrames = 0;
+	faceCastersDrawn.fill(0);
+	faceCastersCulled.fill(0);
+	staticLayerRenders = 0;
+	staticLayerReuses = 0;
+	shadowAtlasRelayouts = 0;
+}
+
+// A face has to be rendered again if the light moved, or if a moving shadow caster was or is now inside it
+void Scene::updateDirtyShadowFaces() {
+	std::vector<glm::vec4> casterBounds;
+	for (auto& batch : instanceBatches) {
+		if (!batch.castShadows || batch.isStatic) {
+			continue;
+		}
+
+		for (auto& renderable : batch.renderables) {
+			casterBounds.push_back(renderable->getBoundingSphere());
+		}
+	}
+
+	bool tracking = vulkanAPIHandler->getRenderSettings().shadowDirtyTracking;
+	bool castersChanged = casterBounds.size() != shadowCasterBounds.size();
+
+	for (uint32_t i = 0; i < shadowMaps.size(); i++) {
+		ShadowMapState& shadowMap = shadowMaps[i];
+		glm::vec4 lightPosition = sceneUBO.lightPositions[i];
+
+		if (!tracking || castersChanged || !shadowMap.valid || shadowMap.lightPosition != lightPosition) {
+			shadowMap.dirtyFaces = getShadowFaceMask(i);
+		}
+		else {
+			shadowMap.dirtyFaces = 0;
+			for (uint32_t caster = 0; caster < casterBounds.size(); caster++) {
+				if (casterBounds[caster] != shadowCasterBounds[caster]) {
+					shadowMap.dirtyFaces |= getAffectedShadowFaces(i, shadowCasterBounds[caster]);
+					shadowMap.dirtyFaces |= getAffectedShadowFaces(i, casterBounds[caster]);
+				}
+			}
+		}
+
+		shadowMap.valid = true;
+		shadowMap.lightPosition = lightPosition;
+	}
+
+	shadowCasterBounds = casterBounds;
+}
+
+// Picks the dirty faces that are rendered this frame. Faces of lights close to the camera, faces that were
+// dirtied this frame and faces that have been waiting the longest go first, the rest stay pending
+void Scene::scheduleShadowFaces() {
+	struct ScheduledFace {
+		uint32_t lightIndex;
+		uint32_t face;
+		float priority;
+	};
+
+	uint32_t budget = vulkanAPIHandler->getRenderSettings().shadowFaceBudget;
+	glm::vec3 cameraPosition = glm::vec3(glm::inverse(sceneUBO.cameraViewMatrix)[3]);
+
+	std::vector<ScheduledFace> candidates;
+	uint32_t requiredFaces = 0;
+
+	for (uint32_t i = 0; i < shadowMaps.size(); i++) {
+		ShadowMapState& shadowMap = shadowMaps[i];
+		uint32_t movedFaces = shadowMap.dirtyFaces;
+
+		shadowMap.pendingFaces |= movedFaces;
+		// Faces without contents are always rendered
+		shadowMap.dirtyFaces = shadowMap.pendingFaces & ~shadowMap.renderedFaces;
+
+		float cameraDistance = glm::length(glm::vec3(sceneUBO.lightPositions[i]) - cameraPosition);
+		float lightWeight = 1.f / (1.f + cameraDistance / LIGHT_ATTENUATION_RADIUS);
+
+		for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+			uint32_t bit = 1 << face;
+			if (shadowMap.dirtyFaces & bit) {
+				requiredFaces++;
+			}
+			else if (shadowMap.pendingFaces & bit) {
+				float motionWeight = (movedFaces & bit) ? 2.f : 1.f;
+				candidates.push_back({ i, face, lightWeight * motionWeight * (1 + shadowMap.faceWaitFrames[face]) });
+			}
+		}
+	}
+
+	size_t scheduled = candidates.size();
+	if (budget > 0) {
+		scheduled = std::min<size_t>(scheduled, budget > requiredFaces ? budget - requiredFaces : 0);
+		std::sort(candidates.begin(), candidates.end(), [](const ScheduledFace& a, const ScheduledFace& b) {
+			return a.priority > b.priority;
+		});
+	}
+
+	for (size_t candidate = 0; candidate < scheduled; candidate++) {
+		shadowMaps[candidates[candidate].lightIndex].dirtyFaces |= 1 << candidates[candidate].face;
+	}
+
+	for (uint32_t i = 0; i < shadowMaps.size(); i++) {
+		ShadowMapState& shadowMap = shadowMaps[i];
+		shadowMap.pendingFaces &= ~shadowMap.dirtyFaces;
+		shadowMap.renderedFaces |= shadowMap.dirtyFaces;
+
+		for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+			if ((getShadowFaceMask(i) & (1 << face)) == 0) {
+				continue;
+			}
+
+			if (shadowMap.dirtyFaces & (1 << face)) {
+				shadowMap.faceWaitFrames[face] = 0;
+				shadowFacesRendered++;
+			}
+			else if (shadowMap.pendingFaces & (1 << face)) {
+				shadowMap.faceWaitFrames[face]++;
+				maxFaceWaitFrames = std::max(maxFaceWaitFrames, shadowMap.faceWaitFrames[face]);
+				shadowFacesDeferred++;
+			}
+			else {
+				shadowFacesSkipped++;
+			}
+		}
+	}
+}
+
+// Tests every shadow caster against the six face frustums and the range of every light
+void Scene::updateShadowCasterFaces() {
+	if (!vulkanAPIHandler->getRenderSettings().shadowCasterCulling || gpuCuller != nullptr) {
+		return;
+	}
+
+	std::vector<glm::vec4> bounds;
+	std::vector<bool> castsShadows;
+	for (auto& batch : instanceBatches) {
+		for (auto& renderable : batch.renderables) {
+			bounds.push_back(renderable->getBoundingSphere());
+			castsShadows.push_back(batch.castShadows);
+		}
+	}
+
+	for (uint32_t i = 0; i < shadowMaps.size(); i++) {
+		std::vector<uint32_t>& instanceFaces = shadowMaps[i].instanceFaces;
+		instanceFaces.resize(bounds.size());
+
+		for (uint32_t instance = 0; instance < bounds.size(); instance++) {
+			instanceFaces[instance] = castsShadows[instance] ? getAffectedShadowFaces(i, bounds[instance]) : 0;
+		}
+	}
+}
+
+// Tests every instance against the camera frustum, four bounding spheres at a time
+void Scene::updateCameraVisibility(const glm::mat4& viewProjection) {
+	bool frustumCulling = vulkanAPIHandler->getRenderSettings().frustumCulling;
+
+	// The culling shader reads the instance transforms itself, it only needs the planes
+	// and the matrix to project the bounds onto the depth pyramid
+	cameraViewProjection = viewProjection;
+	if (gpuCuller != nullptr) {
+		cameraCuller.setFrustum(viewProjection);
+		gpuCuller->setCamera(viewProjection, cameraCuller.getPlanes(), frustumCulling);
+		return;
+	}
+
+	if (!frustumCulling) {
+		return;
+	}
+
+	for (auto& batch : instanceBatches) {
+		if (batch.isStatic) {
+			continue;
+		}
+
+		for (uint32_t i = 0; i < batch.renderables.size(); i++) {
+			cameraCuller.setBoundingSphere(batch.firstInstance + i, batch.renderables[i]->getBoundingSphere());
+		}
+	}
+
+	cameraCuller.setFrustum(viewProjection);
+	uint32_t visible = cameraCuller.cull(cameraVisibility);
+
+	instancesTested += cameraCuller.size();
+	instancesCulled += cameraCuller.size() - visible;
+}
+
+const std::vector<uint32_t>* Scene::getCameraVisibility() {
+	return vulkanAPIHandler->getRenderSettings().frustumCulling ? &cameraVisibility : nullptr;
+}
+
+const std::vector<uint32_t>* Scene::getShadowCasterFaces(uint32_t lightIndex) {
+	return vulkanAPIHandler->getRenderSettings().shadowCasterCulling ? &shadowMaps[lightIndex].instanceFaces : nullptr;
+}
+
+uint32_t Scene::countInstances(InstanceBatchFilter filter) {
+	uint32_t count = 0;
+	for (auto& batch : instanceBatches) {
+		if (matchesFilter(batch, filter)) {
+			count += batch.renderables.size();
+		}
+	}
+
+	return count;
+}
+
+void Scene::addFaceStatistics(uint32_t faces, uint32_t drawn, uint32_t casters) {
+	for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+		if (faces & (1 << face)) {
+			faceCastersDrawn[face] += drawn;
+			faceCastersCulled[face] += casters - drawn;
+		}
+	}
+}
+
+// Faces of the light's cube map the sphere can be seen in. Nothing outside of the light's range casts a visible shadow
+uint32_t Scene::getAffectedCubeFaces(glm::vec3 lightPosition, glm::vec4 boundingSphere) {
+	glm::vec3 offset = glm::vec3(boundingSphere) - lightPosition;
+	float radius = boundingSphere.w;
+
+	if (glm::length(offset) - radius > LIGHT_ATTENUATION_RADIUS) {
+		return 0;
+	}
+
+	// Every face is bounded by four planes through the light at 45 degrees to its axis. Face 2n looks
+	// down the negative and face 2n + 1 down the positive n axis, see getCubeFaceViewMatrix
+	float planeDistance = radius * float(M_SQRT2);
+	uint32_t faces = 0;
+
+	for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+		int axis = face / 2;
+		float forward = (face % 2 == 0) ? -offset[axis] : offset[axis];
+		bool inside = true;
+
+		for (int other = 0; other < 3; other++) {
+			if (other != axis && (forward - offset[other] < -planeDistance || forward + offset[other] < -planeDistance)) {
+				inside = false;
+			}
+		}
+
+		if (inside) {
+			faces |= 1 << face;
+		}
+	}
+
+	return faces;
+}
+
+// Half 0 looks up and half 1 down from the light, see paraboloidGeometryShader.geom
+uint32_t Scene::getAffectedParaboloidHalves(glm::vec3 lightPosition, glm::vec4 boundingSphere) {
+	glm::vec3 offset = glm::vec3(boundingSphere) - lightPosition;
+	float radius = boundingSphere.w;
+
+	if (glm::length(offset) - radius > LIGHT_ATTENUATION_RADIUS) {
+		return 0;
+	}
+
+	uint32_t halves = 0;
+	if (offset.y + radius >= 0) {
+		halves |= 1 << 0;
+	}
+	if (offset.y - radius <= 0) {
+		halves |= 1 << 1;
+	}
+
+	return halves;
+}
+
+uint32_t Scene::getAffectedShadowFaces(uint32_t lightIndex, glm::vec4 boundingSphere) {
+	glm::vec3 lightPosition = sceneUBO.lightPositions[lightIndex];
+	return usesParaboloidShadows(lightIndex) ? getAffectedParaboloidHalves(lightPosition, boundingSphere) : getAffectedCubeFaces(lightPosition, boundingSphere);
+}
+
+uint32_t Scene::getShadowFaceMask(uint32_t lightIndex) {
+	return usesParaboloidShadows(lightIndex) ? ALL_PARABOLOID_HALVES : ALL_CUBE_FACES;
+}
+
+bool Scene::usesParaboloidShadows(uint32_t lightIndex) {
+	return (vulkanAPIHandler->getRenderSettings().paraboloidShadowLights & (1 << lightIndex)) != 0;
+}
+
+// Clears the layers of the framebuffer's attachments that belong to the given faces. The separate depth
+// attachment of R32 shadow maps is always cleared, the shadow map itself only if clearShadowMap is set
+void Scene::clearCubeFaces(VkCommandBuffer commandBuffer, uint32_t faces, bool clearShadowMap) {
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+	if (depthShadowMaps && !clearShadowMap) {
+		return;
+	}
+
+	std::vector<VkClearRect> clearRects;
+	for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+		if (faces & (1 << face)) {
+			VkClearRect clearRect = {};
+			clearRect.rect.extent = { CUBE_MAP_TEX_DIM, CUBE_MAP_TEX_DIM };
+			clearRect.baseArrayLayer = face;
+			clearRect.layerCount = 1;
+			clearRects.push_back(clearRect);
+		}
+	}
+
+	std::vector<VkClearAttachment> clearAttachments(1);
+	clearAttachments[0].aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+	clearAttachments[0].clearValue.depthStencil = { 1.0f, 0 };
+
+	if (clearShadowMap && !depthShadowMaps) {
+		VkClearAttachment colorAttachment = {};
+		colorAttachment.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		colorAttachment.colorAttachment = 0;
+		colorAttachment.clearValue.color = { { std::numeric_limits<float>::max(), 0.0f, 0.0f, 1.0f } };
+		clearAttachments.push_back(colorAttachment);
+	}
+
+	vkCmdClearAttachments(commandBuffer, clearAttachments.size(), clearAttachments.data(), clearRects.size(), clearRects.data());
+}
+
+// Lights close to the camera cover more of the screen and get the largest tiles. If all tiles do not fit,
+// the lights furthest from the camera give up resolution first
+void Scene::layoutShadowAtlas(glm::vec3 cameraPosition) {
+	std::array<float, NUM_LIGHTS> cameraDistances;
+	std::array<uint32_t, NUM_LIGHTS> levels;
+
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		cameraDistances[i] = glm::length(glm::vec3(sceneUBO.lightPositions[i]) - cameraPosition);
+		uint32_t previousLevel = shadowMaps[i].atlasLevel;
+		levels[i] = getShadowAtlasLevel(cameraDistances[i]);
+
+		// A light close to a level boundary keeps its tiles instead of rendering them again every few frames
+		float margin = levels[i] < previousLevel ? 1.f + SHADOW_ATLAS_HYSTERESIS : 1.f - SHADOW_ATLAS_HYSTERESIS;
+		if (getShadowAtlasLevel(cameraDistances[i] * margin) == previousLevel) {
+			levels[i] = previousLevel;
+		}
+	}
+
+	// Tiles are counted in cells of the smallest tile size
+	uint32_t cellSize = getShadowAtlasTileSize(SHADOW_ATLAS_LEVELS - 1);
+	uint32_t atlasCells = (SHADOW_ATLAS_DIM / cellSize) * (SHADOW_ATLAS_DIM / cellSize);
+	auto getLightCells = [this, cellSize](uint32_t level) {
+		uint32_t tileCells = getShadowAtlasTileSize(level) / cellSize;
+		return tileCells * tileCells * NUM_CUBE_FACES;
+	};
+
+	std::array<uint32_t, NUM_LIGHTS> lightsByDistance;
+	uint32_t usedCells = 0;
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		lightsByDistance[i] = i;
+		usedCells += getLightCells(levels[i]);
+	}
+
+	std::sort(lightsByDistance.begin(), lightsByDistance.end(), [&cameraDistances](uint32_t a, uint32_t b) {
+		return cameraDistances[a] > cameraDistances[b];
+	});
+
+	while (usedCells > atlasCells) {
+		auto light = std::find_if(lightsByDistance.begin(), lightsByDistance.end(), [&levels](uint32_t i) {
+			return levels[i] + 1 < SHADOW_ATLAS_LEVELS;
+		});
+
+		if (light == lightsByDistance.end()) {
+			throw std::runtime_error("the shadow atlas can not hold the smallest tiles of all lights!");
+		}
+
+		usedCells -= getLightCells(levels[*light]);
+		levels[*light]++;
+		usedCells += getLightCells(levels[*light]);
+	}
+
+	struct AtlasTile {
+		uint32_t lightIndex;
+		uint32_t face;
+		uint32_t level;
+	};
+
+	std::vector<AtlasTile> tiles;
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		for (uint32_t face = 0; face < NUM_CUBE_FACES; face++) {
+			tiles.push_back({ i, face, levels[i] });
+		}
+	}
+
+	std::stable_sort(tiles.begin(), tiles.end(), [](const AtlasTile& a, const AtlasTile& b) {
+		return a.level < b.level;
+	});
+
+	// Largest tiles first along a Z-order curve over the cells. Every tile starts at a multiple of its own
+	// cell count, which makes it an aligned square that does not overlap the tiles before it
+	uint32_t cell = 0;
+	bool relayout = false;
+
+	for (auto& tile : tiles) {
+		uint32_t tileSize = getShadowAtlasTileSize(tile.level);
+		glm::uvec2 offset(0, 0);
+
+		for (uint32_t bit = 0; (1u << (2 * bit)) < atlasCells; bit++) {
+			offset.x |= ((cell >> (2 * bit)) & 1) << bit;
+			offset.y |= ((cell >> (2 * bit + 1)) & 1) << bit;
+		}
+		offset *= cellSize;
+		cell += (tileSize / cellSize) * (tileSize / cellSize);
+
+		// A face whose tile moved or changed size has nothing valid in its new tile
+		ShadowMapState& shadowMap = shadowMaps[tile.lightIndex];
+		if (shadowMap.atlasLevel != tile.level || shadowMap.atlasTileOffsets[tile.face] != offset) {
+			shadowMap.atlasTileOffsets[tile.face] = offset;
+			shadowMap.renderedFaces &= ~(1 << tile.face);
+			shadowMap.pendingFaces |= 1 << tile.face;
+			relayout = true;
+		}
+
+		sceneUBO.shadowAtlasTiles[tile.lightIndex * NUM_CUBE_FACES + tile.face] = glm::vec4(glm::vec2(offset) / float(SHADOW_ATLAS_DIM), float(tileSize) / SHADOW_ATLAS_DIM, float(tileSize));
+	}
+
+	for (uint32_t i = 0; i < NUM_LIGHTS; i++) {
+		shadowMaps[i].atlasLevel = levels[i];
+	}
+
+	if (relayout) {
+		shadowAtlasRelayouts++;
+	}
+}
+
+uint32_t Scene::getShadowAtlasLevel(float cameraDistance) {
+	return std::min(SHADOW_ATLAS_LEVELS - 1, uint32_t(cameraDistance / SHADOW_ATLAS_LEVEL_DISTANCE));
+}
+
+uint32_t Scene::getShadowAtlasTileSize(uint32_t level) {
+	return CUBE_MAP_TEX_DIM >> level;
 }
 
 void Scene::prepareOffscreenPipeline(VkGraphicsPipelineCreateInfo pipelineInfo) {
-	auto vertShaderCode = ShaderHandler::readFile("Shaders/Offscreen/vert.spv");
+	bool dynamicUniforms = vulkanAPIHandler->getRenderSettings().dynamicUniforms;
+	auto vertShaderCode = ShaderHandler::readFile(dynamicUniforms ? "Shaders/Offscreen/vertDynamic.spv" : "Shaders/Offscreen/vert.spv");
 	auto fragShaderCode = ShaderHandler::readFile("Shaders/Offscreen/frag.spv");
 	
 	VDeleter<VkShaderModule> vertShaderModule{ device, vkDestroyShaderModule };
@@ -702,6 +2402,184 @@ void Scene::prepareOffscreenPipeline(VkGraphicsPipelineCreateInfo pipelineInfo)
 	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, offscreenPipeline.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create offscreen pipeline!");
 	}
+
+	if (vulkanAPIHandler->getRenderSettings().layeredShadows) {
+		prepareLayeredPipeline(pipelineInfo);
+	}
+}
+
+// Same state as the offscreen pipeline, with a geometry shader that replicates every triangle into the six faces
+void Scene::prepareLayeredPipeline(VkGraphicsPipelineCreateInfo pipelineInfo) {
+	bool depthShadowMaps = vulkanAPIHandler->hasDepthShadowMaps();
+
+	// Depth-only shadow maps write the distance as the fragment's depth
+	bool dynamicUniforms = vulkanAPIHandler->getRenderSettings().dynamicUniforms;
+	auto vertShaderCode = ShaderHandler::readFile(dynamicUniforms ? "Shaders/Offscreen/layeredVertDynamic.spv" : "Shaders/Offscreen/layeredVert.spv");
+	auto geomShaderCode = ShaderHandler::readFile("Shaders/Offscreen/layeredGeom.spv");
+	auto fragShaderCode = ShaderHandler::readFile(depthShadowMaps ? "Shaders/Offscreen/depthFrag.spv" : "Shaders/Offscreen/frag.spv");
+
+	VDeleter<VkShaderModule> vertShaderModule{ device, vkDestroyShaderModule };
+	VDeleter<VkShaderModule> geomShaderModule{ device, vkDestroyShaderModule };
+	VDeleter<VkShaderModule> fragShaderModule{ device, vkDestroyShaderModule };
+	vulkanAPIHandler->createShaderModule(vertShaderCode, vertShaderModule);
+	vulkanAPIHandler->createShaderModule(geomShaderCode, geomShaderModule);
+	vulkanAPIHandler->createShaderModule(fragShaderCode, fragShaderModule);
+
+	std::array<VkPipelineShaderStageCreateInfo, 3> shaderStages = {};
+	for (auto& stage : shaderStages) {
+		stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		stage.pName = "main";
+	}
+
+	shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	shaderStages[0].module = vertShaderModule;
+	shaderStages[1].stage = VK_SHADER_STAGE_GEOMETRY_BIT;
+	shaderStages[1].module = geomShaderModule;
+	shaderStages[2].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	shaderStages[2].module = fragShaderModule;
+
+	pipelineInfo.stageCount = shaderStages.size();
+	pipelineInfo.pStages = shaderStages.data();
+	pipelineInfo.layout = layeredPipelineLayout;
+	pipelineInfo.renderPass = layeredRenderPass;
+
+	VkPipelineColorBlendStateCreateInfo noBlending = *pipelineInfo.pColorBlendState;
+	noBlending.attachmentCount = 0;
+	noBlending.pAttachments = nullptr;
+
+	if (depthShadowMaps) {
+		pipelineInfo.pColorBlendState = &noBlending;
+	}
+
+	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, layeredPipeline.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create layered pipeline!");
+	}
+
+	if (vulkanAPIHandler->getRenderSettings().paraboloidShadowLights != 0) {
+		prepareParaboloidPipeline(pipelineInfo);
+	}
+
+	if (vulkanAPIHandler->getRenderSettings().shadowAtlas) {
+		prepareShadowAtlasPipeline(pipelineInfo);
+	}
+
+	// Depth-only shadow layers are merged by the depth test of the layered pipeline
+	if (!vulkanAPIHandler->getRenderSettings().staticShadowCache || depthShadowMaps) {
+		return;
+	}
+
+	// The dynamic layer keeps the smaller of its own and the static layer's distance
+	VkPipelineColorBlendAttachmentState minBlendAttachment = {};
+	minBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+	minBlendAttachment.blendEnable = VK_TRUE;
+	minBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	minBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+	minBlendAttachment.colorBlendOp = VK_BLEND_OP_MIN;
+	minBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	minBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	minBlendAttachment.alphaBlendOp = VK_BLEND_OP_MIN;
+
+	VkPipelineColorBlendStateCreateInfo minBlending = *pipelineInfo.pColorBlendState;
+	minBlending.attachmentCount = 1;
+	minBlending.pAttachments = &minBlendAttachment;
+
+	pipelineInfo.pColorBlendState = &minBlending;
+
+	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, dynamicLayerPipeline.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create dynamic shadow layer pipeline!");
+	}
+}
+
+// Same as the layered pipeline with a different geometry shader. Mirroring the lower half flips the
+// winding of its triangles, so nothing is culled
+void Scene::prepareParaboloidPipeline(VkGraphicsPipelineCreateInfo pipelineInfo) {
+	auto geomShaderCode = ShaderHandler::readFile("Shaders/Offscreen/paraboloidGeom.spv");
+
+	VDeleter<VkShaderModule> geomShaderModule{ device, vkDestroyShaderModule };
+	vulkanAPIHandler->createShaderModule(geomShaderCode, geomShaderModule);
+
+	std::vector<VkPipelineShaderStageCreateInfo> shaderStages(pipelineInfo.pStages, pipelineInfo.pStages + pipelineInfo.stageCount);
+	for (auto& stage : shaderStages) {
+		if (stage.stage == VK_SHADER_STAGE_GEOMETRY_BIT) {
+			stage.module = geomShaderModule;
+		}
+	}
+
+	VkPipelineRasterizationStateCreateInfo rasterizer = *pipelineInfo.pRasterizationState;
+	rasterizer.cullMode = VK_CULL_MODE_NONE;
+
+	pipelineInfo.pStages = shaderStages.data();
+	pipelineInfo.pRasterizationState = &rasterizer;
+
+	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, paraboloidPipeline.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create paraboloid pipeline!");
+	}
+}
+
+// Same as the layered pipeline with a geometry shader that writes gl_ViewportIndex instead of gl_Layer.
+// The viewports and scissors are the tiles of the light that is drawn, so they are dynamic
+void Scene::prepareShadowAtlasPipeline(VkGraphicsPipelineCreateInfo pipelineInfo) {
+	auto geomShaderCode = ShaderHandler::readFile("Shaders/Offscreen/atlasGeom.spv");
+
+	VDeleter<VkShaderModule> geomShaderModule{ device, vkDestroyShaderModule };
+	vulkanAPIHandler->createShaderModule(geomShaderCode, geomShaderModule);
+
+	std::vector<VkPipelineShaderStageCreateInfo> shaderStages(pipelineInfo.pStages, pipelineInfo.pStages + pipelineInfo.stageCount);
+	for (auto& stage : shaderStages) {
+		if (stage.stage == VK_SHADER_STAGE_GEOMETRY_BIT) {
+			stage.module = geomShaderModule;
+		}
+	}
+
+	VkPipelineViewportStateCreateInfo viewportState = *pipelineInfo.pViewportState;
+	viewportState.viewportCount = NUM_CUBE_FACES;
+	viewportState.pViewports = nullptr;
+	viewportState.scissorCount = NUM_CUBE_FACES;
+	viewportState.pScissors = nullptr;
+
+	std::array<VkDynamicState, 2> dynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicState = {};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = dynamicStates.size();
+	dynamicState.pDynamicStates = dynamicStates.data();
+
+	pipelineInfo.pStages = shaderStages.data();
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pDynamicState = &dynamicState;
+
+	if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, shadowAtlasPipeline.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create shadow atlas pipeline!");
+	}
+}
+
+glm::mat4 Scene::getCubeFaceViewMatrix(uint32_t faceIndex) {
+	glm::mat4 viewMatrix = glm::mat4();
+	glm::vec3 lightPosition = glm::vec3(0, 0, 0);
+	
+	// Cube map faces generally have to use -y as their up axis. http://stackoverflow.com/questions/11685608/convention-of-faces-in-opengl-cubemapping
+	// The math is also inverted due to this.
+	switch (faceIndex) {
+	case 0: // POSITIVE_X 
+		viewMatrix = glm::lookAt(lightPosition, lightPosition - glm::vec3(1, 0, 0), glm::vec3(0, -1, 0));
+		break;
+	case 1:	// NEGATIVE_X
+		viewMatrix = glm::lookAt(lightPosition, lightPosition + glm::vec3(1, 0, 0), glm::vec3(0, -1, 0));
+		break;
+	case 2:	// POSITIVE_Y
+		viewMatrix = glm::lookAt(lightPosition, lightPosition - glm::vec3(0, 1, 0), glm::vec3(0, 0, 1));
+		break;
+	case 3:	// NEGATIVE_Y
+		viewMatrix = glm::lookAt(lightPosition, lightPosition + glm::vec3(0, 1, 0), glm::vec3(0, 0, -1));
+		break;
+	case 4:	// POSITIVE_Z
+		viewMatrix = glm::lookAt(lightPosition, lightPosition - glm::vec3(0, 0, 1), glm::vec3(0, -1, 0));
+		break;
+	case 5:	// NEGATIVE_Z
+		viewMatrix = glm::lookAt(lightPosition, lightPosition + glm::vec3(0, 0, 1), glm::vec3(0, -1, 0));
+		break;
+	} 
+
+	return viewMatrix;
 }
 
 VkDescriptorSetLayout Scene::getDescriptorSetLayout(DescriptorLayoutType type) {
@@ -716,6 +2594,16 @@ VkDescriptorSetLayout Scene::getDescriptorSetLayout(DescriptorLayoutType type) {
 	}
 }
 
-VkDescriptorSet Scene::getDescriptorSet() {
-	return descriptorSet;
+VkDescriptorSet Scene::getDescriptorSet(uint32_t frameIndex) {
+	return descriptorSets[frameIndex];
+}
+
+uint32_t Scene::getNumRenderableDescriptorSets() {
+	// One shared set per texture
+	std::set<std::string> texturePaths;
+	for (auto& renderable : renderableObjects) {
+		texturePaths.insert(renderable.second->getTexturePath());
+	}
+
+	return texturePaths.size();
 }
\ No newline at end of file
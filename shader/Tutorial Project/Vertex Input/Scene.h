@@ -3,12 +3,20 @@
 #include <memory>
 #include <vector>
 #include <random>
+#include <map>
+#include <set>
+#include <tuple>
+#include <atomic>
 #include <glm\glm.hpp>
 #include "Renderable.h"
 #include "RenderableMaze.h"
 #include "Moveable.h"
 #include "Pacman.h"
 #include "Ghost.h"
+#include "FrustumCuller.h"
+#include "GpuCuller.h"
+#include "DepthPyramid.h"
+#include "RenderQueue.h"
 
 class VulkanAPIHandler;
 
@@ -17,44 +25,137 @@ enum DescriptorLayoutType {
 	DESC_LAYOUT_SCENE
 };
 
+// Selects which instance batches drawInstanceBatches records
+enum InstanceBatchFilter {
+	DRAW_ALL = 0,
+	DRAW_SHADOW_CASTERS,
+	// Shadow casters that never move, their shadows can be cached
+	DRAW_STATIC_SHADOW_CASTERS,
+	DRAW_DYNAMIC_SHADOW_CASTERS,
+	// Batches that never move, whether or not they cast shadows. The occluders of occlusion culling
+	DRAW_STATIC
+};
+
+// Renderables that are drawn with one instanced draw call. Their instance data is stored
+// contiguously in the instance buffer, starting at firstInstance
+struct InstanceBatch {
+	std::vector<std::shared_ptr<Renderable>> renderables;
+	uint32_t firstInstance{0};
+	bool castShadows{true};
+	// Nothing in the batch is a Moveable
+	bool isStatic{false};
+	// Dense ids of the texture and the mesh, for the draw sort keys
+	uint32_t materialId{0};
+	uint32_t meshId{0};
+};
+
+// The static shadow layer of a light is valid as long as the light stays where it was rendered from
+struct StaticShadowLayer {
+	bool valid{false};
+	glm::vec4 lightPosition;
+};
+
+// Where a light's cube map was last rendered from, and which of its faces have to be rendered this frame
+struct ShadowMapState {
+	bool valid{false};
+	glm::vec4 lightPosition;
+	uint32_t dirtyFaces{ALL_CUBE_FACES};
+	// Dirty faces the face budget has left for a later frame, and how many frames each has been waiting
+	uint32_t pendingFaces{0};
+	std::array<uint32_t, NUM_CUBE_FACES> faceWaitFrames{};
+	// Faces that hold a rendered shadow map. The others can not be reused and ignore the budget
+	uint32_t renderedFaces{0};
+	// Shadow atlas level of the light, and the texel offset of every face's tile
+	uint32_t atlasLevel{0};
+	std::array<glm::uvec2, NUM_CUBE_FACES> atlasTileOffsets{};
+	// The faces every instance can cast a shadow into, indexed like the instance buffer
+	std::vector<uint32_t> instanceFaces;
+};
+
 class Scene {
 public:
 	Scene(VulkanAPIHandler* vulkanAPI);
 	~Scene();
 
-	void updateUniformBuffers(glm::mat4 projectionMatrix, glm::mat4 viewMatrix);
+	void updateUniformBuffers(glm::mat4 projectionMatrix, glm::mat4 viewMatrix, uint32_t frameIndex);
 	void update(float deltaTime);
 	void handleInput(GLFWKeyEvent event);
 	
 	void createTextureImages();
-	void createTextureImageViews();
 	void createTextureSamplers();
 	void createVertexIndexBuffers();
 	void createUniformBuffers();
 	void createDescriptorSetLayouts();
 	void createDescriptorSets(VkDescriptorPool descPool);
 	void createRenderables();
+	void createInstanceBatches();
+	void prepareAnalyticWallShadows();
+	// Returns how many instances were drawn. With instanceFaces, only instances that reach one of the faces are drawn.
+	// firstBatch and batchCount select a range of the batch order, for splitting the recording over threads
+	uint32_t drawInstanceBatches(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frameIndex, InstanceBatchFilter filter, const std::vector<uint32_t>* instanceFaces = nullptr, uint32_t faces = ALL_CUBE_FACES, uint32_t firstBatch = 0, uint32_t batchCount = UINT32_MAX, bool scenePass = false);
+	uint32_t getNumInstanceBatches();
+	// Draws a range of the batches in the scene pass
+	void drawSceneBatches(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frameIndex, uint32_t firstBatch, uint32_t batchCount);
+	// Creates the culling shader resources. Without it, everything is culled and drawn from the CPU
+	void prepareGpuCulling();
 	void prepareCubeMaps();
 	void prepareOffscreenFramebuffer();
-	void updateCubeFace(uint32_t faceIndex, uint32_t lightIndex);
-	void buildOffscreenCommandBuffer();
+	// Copy path. The dirty faces are rendered into the offscreen targets and copied into the cube map array
+	void updateCubeFaces(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	void renderCubeFace(VkCommandBuffer commandBuffer, uint32_t faceIndex, uint32_t lightIndex, uint32_t frameIndex, const OffscreenTarget& target);
+	void copyCubeFace(VkCommandBuffer commandBuffer, uint32_t faceIndex, uint32_t lightIndex, const OffscreenTarget& target);
+	void updateLayeredCubeMap(VkCommandBuffer commandBuffer, uint32_t lightIndex, uint32_t frameIndex, uint32_t faces);
+	void updateCachedCubeMaps(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	void updateStaticShadowLayer(VkCommandBuffer commandBuffer, uint32_t lightIndex, uint32_t frameIndex);
+	void copyStaticShadowLayer(VkCommandBuffer commandBuffer, uint32_t lightIndex, uint32_t faces);
+	void createOffscreenCommandBuffers();
+	// Records the frame's shadow pass. Only the dirty faces are rendered, so this is done every frame
+	void recordOffscreenCommandBuffer(uint32_t frameIndex);
+	// Forces every shadow map to be rendered again, e.g. after the level changed
+	void invalidateShadows();
+	void printShadowStatistics();
+	// Reads back what the culling shader counted. Only call after the frame's fence has signaled
+	void collectCullingStatistics(uint32_t frameIndex);
+	void printCullingStatistics();
+	void printDrawStatistics(int numberOfFrames);
+	// Format, memory use and distance resolution of the shadow maps
+	void printShadowMapStatistics();
+	void printShadowProjections();
+	const char* getShadowMapFormatName();
 	void createOffscreenPipelineLayout();
 	void prepareOffscreenRenderpass();
 	void prepareOffscreenPipeline(VkGraphicsPipelineCreateInfo pipelineInfo);
+	void prepareLayeredFramebuffers();
+	void prepareLayeredPipeline(VkGraphicsPipelineCreateInfo pipelineInfo);
+	void prepareParaboloidPipeline(VkGraphicsPipelineCreateInfo pipelineInfo);
+	void prepareShadowAtlas();
+	void prepareShadowAtlasFramebuffer();
+	void prepareShadowAtlasPipeline(VkGraphicsPipelineCreateInfo pipelineInfo);
+	// Renders the dirty faces of all lights into their atlas tiles in one render pass
+	void updateShadowAtlas(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	void prepareStaticShadowLayers();
+	void prepareDepthShadowRenderpasses();
 
-	VkSemaphore getOffscreenSemaphore();
-	VkCommandBuffer getOffscreenCommandBuffer();
+	VkSemaphore getOffscreenSemaphore(uint32_t frameIndex);
+	VkCommandBuffer getOffscreenCommandBuffer(uint32_t frameIndex);
 	std::vector<std::pair<RenderableInformation, std::shared_ptr<Renderable>>> getRenderableObjects();
 	VkDescriptorSetLayout getDescriptorSetLayout(DescriptorLayoutType type);
-	VkDescriptorSet getDescriptorSet();
+	VkDescriptorSet getDescriptorSet(uint32_t frameIndex);
+	uint32_t getNumRenderableDescriptorSets();
+	// One entry per instance in batch order, 1 if it is inside the camera frustum. nullptr without frustum culling
+	const std::vector<uint32_t>* getCameraVisibility();
 private:
 	VulkanAPIHandler* vulkanAPIHandler;
-	VkDescriptorSet descriptorSet;
+	// One descriptor set per frame in flight, each pointing at that frame's uniform buffer
+	std::vector<VkDescriptorSet> descriptorSets;
 
 	std::vector<std::pair<RenderableInformation, std::shared_ptr<Renderable>>> renderableObjects{};
 	std::shared_ptr<RenderableMaze> maze;
 	std::shared_ptr<Pacman> pacman;
 	std::vector<std::shared_ptr<Ghost>> ghosts;
+	std::vector<InstanceBatch> instanceBatches;
+	// The maze walls are in the scene UBO instead of the shadow maps
+	bool analyticWallShadows{false};
 
 	SceneUBO sceneUBO;
 
@@ -64,19 +165,132 @@ private:
 	VDeleter<VkDevice> device;
 	VDeleter<VkDescriptorSetLayout> descriptorSetLayout{ device, vkDestroyDescriptorSetLayout };
 
-	std::vector<VDeleter<VkImage>> shadowCubeMapImages;
-	std::vector<VDeleter<VkImageView>> shadowCubeMapImageViews;
-	std::vector<VDeleter<VkSampler>> shadowCubeMapSamplers;
-	std::vector<VDeleter<VkDeviceMemory>> shadowCubeMapMemories;
+	// One cube map array for the shadows of all lights, sampled through a single descriptor
+	VDeleter<VkImage> shadowCubeMapImage{ device, vkDestroyImage };
+	VDeleter<VkImageView> shadowCubeMapImageView{ device, vkDestroyImageView };
+	// Without cube map arrays, one cube view of every light's six layers, sampled through one descriptor each
+	std::vector<VDeleter<VkImageView>> shadowCubeMapLightViews;
+	VDeleter<VkSampler> shadowCubeMapSampler{ device, vkDestroySampler };
+	MemoryAllocation shadowCubeMapMemory;
+	// The same layers as 2D textures, for the lights with dual-paraboloid shadows
+	VDeleter<VkImageView> shadowParaboloidImageView{ device, vkDestroyImageView };
 
-	VDeleter<VkBuffer> uniformStagingBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> uniformStagingBufferMemory{ device, vkFreeMemory };
-	VDeleter<VkBuffer> uniformBuffer{ device, vkDestroyBuffer };
-	VDeleter<VkDeviceMemory> uniformBufferMemory{ device, vkFreeMemory };
+	// Shadow atlas. Takes the place of the cube map array, which shrinks to a single texel per face. The
+	// tiles are laid out again whenever a light's level changes, faces with a new tile are rendered again
+	VDeleter<VkImage> shadowAtlasImage{ device, vkDestroyImage };
+	VDeleter<VkImageView> shadowAtlasImageView{ device, vkDestroyImageView };
+	MemoryAllocation shadowAtlasMemory;
+	VDeleter<VkImage> shadowAtlasDepthImage{ device, vkDestroyImage };
+	VDeleter<VkImageView> shadowAtlasDepthImageView{ device, vkDestroyImageView };
+	MemoryAllocation shadowAtlasDepthMemory;
+	VDeleter<VkFramebuffer> shadowAtlasFrameBuffer{ device, vkDestroyFramebuffer };
+	// The layered pipeline with one viewport per face, set for every light from its tiles
+	VDeleter<VkPipeline> shadowAtlasPipeline{ device, vkDestroyPipeline };
+	uint32_t shadowAtlasRelayouts{0};
+
+	// Offset of the SceneUBO inside every frame region of the uniform ring buffer
+	VkDeviceSize uniformSlot{0};
+	// Offset of the instance array inside every frame region of the instance ring buffer
+	VkDeviceSize instanceSlot{0};
 
 	VDeleter<VkPipelineLayout> offscreenPipelineLayout{ device, vkDestroyPipelineLayout };
 	VDeleter<VkPipeline> offscreenPipeline{ device, vkDestroyPipeline };
 
+	// Layered shadow rendering draws straight into the cube maps, all six faces in one render pass.
+	// The depth attachment is shared by the lights, their passes run one after another
+	VDeleter<VkRenderPass> layeredRenderPass{ device, vkDestroyRenderPass };
+	VDeleter<VkPipelineLayout> layeredPipelineLayout{ device, vkDestroyPipelineLayout };
+	VDeleter<VkPipeline> layeredPipeline{ device, vkDestroyPipeline };
+	// Renders into the two paraboloid halves instead of the six cube faces, with the same render pass
+	VDeleter<VkPipeline> paraboloidPipeline{ device, vkDestroyPipeline };
+	VDeleter<VkImage> layeredDepthImage{ device, vkDestroyImage };
+	VDeleter<VkImageView> layeredDepthImageView{ device, vkDestroyImageView };
+	MemoryAllocation layeredDepthImageMemory;
+	// One 2D array view of every light's six layers of the cube map array, and one framebuffer per light.
+	// Depth-only shadow maps are the framebuffer's only attachment and do not use layeredDepthImage
+	std::vector<VDeleter<VkImageView>> layeredCubeMapViews;
+	std::vector<VDeleter<VkFramebuffer>> layeredFrameBuffers;
+
+	// Static shadow caching. The static layers are rendered with staticLayerRenderPass and stay in
+	// TRANSFER_SRC_OPTIMAL, every frame copies them into the cube maps and layeredRenderPass adds
+	// the moving objects with a MIN blend. Both passes are compatible
+	VDeleter<VkRenderPass> staticLayerRenderPass{ device, vkDestroyRenderPass };
+	VDeleter<VkPipeline> dynamicLayerPipeline{ device, vkDestroyPipeline };
+	std::vector<VDeleter<VkImage>> staticLayerImages;
+	std::vector<VDeleter<VkImageView>> staticLayerImageViews;
+	std::vector<MemoryAllocation> staticLayerMemories;
+	std::vector<VDeleter<VkFramebuffer>> staticLayerFrameBuffers;
+	std::vector<StaticShadowLayer> staticLayers;
+	uint32_t staticLayerRenders{0};
+	uint32_t staticLayerReuses{0};
+
+	// Dirty tracking. The bounds of the moving shadow casters are kept in instance batch order
+	std::vector<ShadowMapState> shadowMaps;
+	std::vector<glm::vec4> shadowCasterBounds;
+	uint32_t shadowFacesRendered{0};
+	uint32_t shadowFacesSkipped{0};
+	uint32_t shadowFacesDeferred{0};
+	uint32_t maxFaceWaitFrames{0};
+
+	// Camera culling. The bounding spheres are kept in instance batch order, only the moving ones change
+	FrustumCuller cameraCuller;
+	glm::mat4 cameraViewProjection;
+	std::vector<uint32_t> cameraVisibility;
+	uint32_t instancesTested{0};
+	uint32_t instancesCulled{0};
+
+	// Draw order. The shadow passes draw sorted by state only, the scene pass also by depth, which is sorted again
+	// every frame. Without drawSorting both are the order the batches were created in
+	RenderQueue sceneQueue;
+	std::vector<uint32_t> stateBatchOrder;
+	std::vector<uint32_t> sceneBatchOrder;
+	std::vector<uint32_t> insertionBatchOrder;
+	uint32_t sceneSortPasses{0};
+	uint32_t sceneSorts{0};
+	void sortSceneBatches(glm::vec3 cameraPosition);
+	const std::vector<uint32_t>& getBatchOrder(bool scenePass);
+
+	// Binds and draws recorded by drawInstanceBatches and drawIndirectBatches, which run on several threads
+	std::atomic<uint32_t> descriptorSetBinds{0};
+	std::atomic<uint32_t> vertexBufferBinds{0};
+	std::atomic<uint32_t> indexBufferBinds{0};
+	std::atomic<uint32_t> drawCalls{0};
+
+	// Culling statistics, shadow caster instances per cube map face
+	std::array<uint32_t, NUM_CUBE_FACES> faceCastersDrawn{};
+	std::array<uint32_t, NUM_CUBE_FACES> faceCastersCulled{};
+
+	void updateDirtyShadowFaces();
+	void scheduleShadowFaces();
+	void updateShadowCasterFaces();
+	void updateCameraVisibility(const glm::mat4& viewProjection);
+
+	// GPU driven drawing, only exists with the gpuCulling setting
+	std::unique_ptr<GpuCuller> gpuCuller;
+	// The static batches seen from the camera, for occlusion culling
+	std::unique_ptr<DepthPyramid> depthPyramid;
+	void prepareCullingViews();
+	void updateDepthPyramid(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	void drawIndirectBatches(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frameIndex, uint32_t view, InstanceBatchFilter filter, uint32_t firstBatch = 0, uint32_t batchCount = UINT32_MAX, bool scenePass = false);
+	void drawShadowCasters(VkCommandBuffer commandBuffer, VkPipelineLayout pipelineLayout, uint32_t frameIndex, InstanceBatchFilter filter, uint32_t lightIndex, uint32_t faces, uint32_t viewFace = 0);
+	static bool matchesFilter(const InstanceBatch& batch, InstanceBatchFilter filter);
+	const std::vector<uint32_t>* getShadowCasterFaces(uint32_t lightIndex);
+	uint32_t countInstances(InstanceBatchFilter filter);
+	void addFaceStatistics(uint32_t faces, uint32_t drawn, uint32_t casters);
+	uint32_t getAffectedCubeFaces(glm::vec3 lightPosition, glm::vec4 boundingSphere);
+	uint32_t getAffectedParaboloidHalves(glm::vec3 lightPosition, glm::vec4 boundingSphere);
+	// Cube faces or paraboloid halves, depending on the light's shadow projection
+	uint32_t getAffectedShadowFaces(uint32_t lightIndex, glm::vec4 boundingSphere);
+	uint32_t getShadowFaceMask(uint32_t lightIndex);
+	bool usesParaboloidShadows(uint32_t lightIndex);
+	void clearCubeFaces(VkCommandBuffer commandBuffer, uint32_t faces, bool clearShadowMap);
+	// Picks every light's atlas level from its distance to the camera and packs the tiles
+	void layoutShadowAtlas(glm::vec3 cameraPosition);
+	uint32_t getShadowAtlasLevel(float cameraDistance);
+	uint32_t getShadowAtlasTileSize(uint32_t level);
+
+	glm::mat4 getCubeFaceViewMatrix(uint32_t faceIndex);
+
 	std::vector<glm::vec4> spawnPositions {
 		glm::vec4(350.f, 30.f, 400.f, 1.f),
 		glm::vec4(100.f, 30.f, 100.f, 1.f),
@@ -1,3 +1,10 @@
 C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V offscreenVertexShader.vert
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V offscreenVertexShader.vert -DDYNAMIC_UNIFORMS -o vertDynamic.spv
 C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V offscreenFragmentShader.frag
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V layeredVertexShader.vert -o layeredVert.spv
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V layeredVertexShader.vert -DDYNAMIC_UNIFORMS -o layeredVertDynamic.spv
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V layeredGeometryShader.geom -o layeredGeom.spv
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V paraboloidGeometryShader.geom -o paraboloidGeom.spv
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V depthFragmentShader.frag -o depthFrag.spv
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V atlasGeometryShader.geom -o atlasGeom.spv
 pause
\ No newline at end of file
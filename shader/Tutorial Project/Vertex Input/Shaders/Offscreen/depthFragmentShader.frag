@@ -0,0 +1,13 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+// Has to match Z_FAR in consts.h
+#define Z_FAR                     1024.0
+
+layout (location = 0) in vec4 inPos;
+layout (location = 1) in vec4 inLightPos;
+
+void main()  {
+	// Store distance to light as the depth of the fragment, normalized by the far plane
+    vec3 lightVec = inPos.xyz - inLightPos.xyz;
+    gl_FragDepth = length(lightVec) / Z_FAR;
+}
@@ -0,0 +1,34 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#define RENDERABLE_UBO		0
+
+// Input values
+layout(location = 0) in vec4 vertexPosition_modelspace;
+
+// Per instance values
+#ifdef DYNAMIC_UNIFORMS
+// Has to match MAX_UNIFORM_INSTANCES in consts.h
+#define MAX_UNIFORM_INSTANCES 128
+
+struct InstanceData {
+	mat4 modelMatrix;
+	vec4 color;
+	vec4 material;
+};
+
+// The frame's instances, selected with a dynamic offset. Batches start at their firstInstance
+layout(set = RENDERABLE_UBO, binding = 0) uniform InstanceUBO {
+	InstanceData instances[MAX_UNIFORM_INSTANCES];
+} instanceUBO;
+
+#define instanceModelMatrix instanceUBO.instances[gl_InstanceIndex].modelMatrix
+#else
+layout(location = 4) in mat4 instanceModelMatrix;
+#endif
+
+// Output values. The geometry shader projects the vertex into every cube face
+layout(location = 0) out vec4 vertexPosition_worldspace;
+
+void main() {
+	vertexPosition_worldspace = instanceModelMatrix * vertexPosition_modelspace;
+}
@@ -5,13 +5,6 @@
 #define NUM_LIGHTS                4
 
 // Uniforms
-layout(set = RENDERABLE_UBO, binding = 0) uniform RenderableUBO {
-    mat4 MVP;
-	mat4 ProjectionMatrix;
-	mat4 ViewMatrix;
-	mat4 ModelMatrix;
-} renderableUBO;
-
 layout(set = SCENE_UBO, binding = 0) uniform SceneUBO {
 	mat4 ProjectionMatrix;
 	mat4 lightOffsetMatrices[NUM_LIGHTS];
@@ -27,13 +20,34 @@ layout(push_constant) uniform PushConsts  {
 // Input values
 layout(location = 0) in vec4 vertexPosition_modelspace;
 
+// Per instance values
+#ifdef DYNAMIC_UNIFORMS
+// Has to match MAX_UNIFORM_INSTANCES in consts.h
+#define MAX_UNIFORM_INSTANCES 128
+
+struct InstanceData {
+	mat4 modelMatrix;
+	vec4 color;
+	vec4 material;
+};
+
+// The frame's instances, selected with a dynamic offset. Batches start at their firstInstance
+layout(set = RENDERABLE_UBO, binding = 0) uniform InstanceUBO {
+	InstanceData instances[MAX_UNIFORM_INSTANCES];
+} instanceUBO;
+
+#define instanceModelMatrix instanceUBO.instances[gl_InstanceIndex].modelMatrix
+#else
+layout(location = 4) in mat4 instanceModelMatrix;
+#endif
+
 // Output values.
 layout(location = 0) out vec4 vertexPosition_worldspace;
 layout(location = 1) out vec4 lightPosition_worldspace;
 
 void main() {
-    gl_Position = sceneUBO.ProjectionMatrix * pushConsts.view * sceneUBO.lightOffsetMatrices[pushConsts.currentMatrixIndex] * renderableUBO.ModelMatrix  * vertexPosition_modelspace;
+    gl_Position = sceneUBO.ProjectionMatrix * pushConsts.view * sceneUBO.lightOffsetMatrices[pushConsts.currentMatrixIndex] * instanceModelMatrix  * vertexPosition_modelspace;
 	
-	vertexPosition_worldspace = renderableUBO.ModelMatrix  * vertexPosition_modelspace;
+	vertexPosition_worldspace = instanceModelMatrix  * vertexPosition_modelspace;
 	lightPosition_worldspace = sceneUBO.lightPositions_worldspace[pushConsts.currentMatrixIndex];
 }
\ No newline at end of file
@@ -1,3 +1,8 @@
 C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V vertexShader.vert
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V vertexShader.vert -DDYNAMIC_UNIFORMS -o vertDynamic.spv
 C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V fragmentShader.frag
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V fragmentShader.frag -DSHADOW_CUBE_MAPS -o fragCubeMaps.spv
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V cullInstances.comp -o cull.spv
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V occluders.vert -o occluders.spv
+C:\VulkanSDK\1.0.39.1\Bin32\glslangValidator.exe -V depthPyramid.comp -o depthPyramid.spv
 pause
\ No newline at end of file
@@ -3,19 +3,48 @@
 #define RENDERABLE_UBO		0
 #define SCENE_UBO					1
 #define BINDING_SAMPLER       1
-#define BINDING_MATERIAL      2
 #define NUM_LIGHTS                4
+#define NUM_CUBE_FACES       6
+#define SHADOW_PROJECTION_DUAL_PARABOLOID 1
+#define SHADOW_PROJECTION_CUBE_ATLAS 2
+// Has to match MAX_ANALYTIC_WALLS in consts.h
+#define MAX_ANALYTIC_WALLS   32
 #define EPSILON                       0.5
 #define SHADOW_OPACITY       0.2
 
 layout(set = RENDERABLE_UBO, binding = BINDING_SAMPLER) uniform sampler2D textureSampler;
+layout(set = SCENE_UBO, binding = 0) uniform SceneUBO {
+	mat4 ProjectionMatrix;
+	mat4 lightOffsetMatrices[NUM_LIGHTS];
+	vec4 lightPositions_worldspace[NUM_LIGHTS];
+	vec4 lightColors[NUM_LIGHTS];
+	mat4 ViewMatrix;
+	mat4 CameraProjectionMatrix;
+	mat4 cubeFaceViewMatrices[NUM_CUBE_FACES];
+	// ShadowProjection of every light in x
+	vec4 lightShadowProjections[NUM_LIGHTS];
+	// Min x, min z, max x and max z of every wall
+	vec4 wallBounds[MAX_ANALYTIC_WALLS];
+	// Number of walls and their height
+	vec4 wallParameters;
+	// Offset and size of every light's face tiles in the shadow atlas, size in texels in w
+	vec4 shadowAtlasTiles[NUM_LIGHTS * NUM_CUBE_FACES];
+} sceneUBO;
+
+#ifdef SHADOW_CUBE_MAPS
+// One cube map per light, for devices without cube map arrays
 layout(set = SCENE_UBO, binding = BINDING_SAMPLER) uniform samplerCube shadowSampler[NUM_LIGHTS];
-layout(set = RENDERABLE_UBO, binding = BINDING_MATERIAL) uniform RenderableMaterial {
-	float specularExponent;
-	float specularGain;
-	float diffuseGain;
-	bool selfShadowEnabled;
-} renderableMaterial;
+#else
+// One cube map per light
+layout(set = SCENE_UBO, binding = BINDING_SAMPLER) uniform samplerCubeArray shadowSampler;
+#endif
+// The same layers, dual-paraboloid lights use the first two of their six
+layout(set = SCENE_UBO, binding = 2) uniform sampler2DArray paraboloidShadowSampler;
+// The cube faces of all lights as tiles of one layer
+layout(set = SCENE_UBO, binding = 3) uniform sampler2DArray shadowAtlasSampler;
+
+// Depth-only shadow maps store the distance divided by the far plane
+layout(constant_id = 0) const float SHADOW_DISTANCE_SCALE = 1.0;
 
 layout(location = 0) in vec4 vertexPosition_cameraspace;
 layout(location = 1) in vec4 fragmentColor;
@@ -25,9 +54,54 @@ layout(location = 4) in vec4 vertexPosition_worldspace;
 layout(location = 5) in vec4 lightPositions_worldspace[NUM_LIGHTS];
 layout(location = 10) in vec4 lightPositions_cameraspace[NUM_LIGHTS];
 layout(location = 15) in vec4 lightColors[NUM_LIGHTS];
+// Specular exponent, specular gain, diffuse gain and self shadowing
+layout(location = 19) flat in vec4 material;
 
 layout(location = 0) out vec4 outColor;
 
+// Whether a maze wall is between the fragment and the light. Walls are boxes from the floor up to the
+// wall height, hits right at the fragment are its own wall
+bool isBehindWall(vec3 fragmentPosition, vec3 lightPosition) {
+	vec3 ray = lightPosition - fragmentPosition;
+	// Keeps the divisions finite for rays along an axis
+	vec3 inverseRay = 1.0 / (ray + vec3(1e-6));
+	float minimumT = EPSILON / length(ray);
+
+	for (int wall = 0; wall < int(sceneUBO.wallParameters.x); wall++) {
+		vec4 bounds = sceneUBO.wallBounds[wall];
+		vec3 boxMin = vec3(bounds.x, 0.0, bounds.y);
+		vec3 boxMax = vec3(bounds.z, sceneUBO.wallParameters.y, bounds.w);
+
+		vec3 t0 = (boxMin - fragmentPosition) * inverseRay;
+		vec3 t1 = (boxMax - fragmentPosition) * inverseRay;
+		vec3 tNear = min(t0, t1);
+		vec3 tFar = max(t0, t1);
+		float enter = max(max(tNear.x, tNear.y), tNear.z);
+		float exit = min(min(tFar.x, tFar.y), tFar.z);
+
+		if (enter < exit && enter > minimumT && enter < 1.0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Samples the atlas tile of the cube face the direction points at. The face is selected the same way a cube map
+// does, the fragment is then projected with the face's matrix exactly like the atlas geometry shader did
+float sampleShadowAtlas(int light, vec3 lightDirection, vec4 fragmentPosition) {
+	vec3 axes = abs(lightDirection);
+	int axis = axes.x >= axes.y && axes.x >= axes.z ? 0 : (axes.y >= axes.z ? 1 : 2);
+	int face = axis * 2 + (lightDirection[axis] >= 0.0 ? 0 : 1);
+
+	vec4 facePosition = sceneUBO.ProjectionMatrix * sceneUBO.cubeFaceViewMatrices[face] * sceneUBO.lightOffsetMatrices[light] * fragmentPosition;
+	vec4 tile = sceneUBO.shadowAtlasTiles[light * NUM_CUBE_FACES + face];
+
+	// Half a texel from the edge, so filtering does not read the neighbouring tiles
+	vec2 tileCoordinates = clamp(facePosition.xy / facePosition.w * 0.5 + 0.5, 0.5 / tile.w, 1.0 - 0.5 / tile.w);
+	return texture(shadowAtlasSampler, vec3(tile.xy + tileCoordinates * tile.z, 0)).r;
+}
+
 // The color white
 const vec4 WHITE = vec4(1.0, 1.0, 1.0, 1.0);
 
@@ -85,25 +159,43 @@ void main() {
 		float dist = length(lightDirection);
 		lightDirection = normalize(lightDirection);
 		vec4 diffuseColor = calculateDiffuseColor(materialDiffuseColor, normal, lightDirection, lightColors[i]);
-		vec4 specularColor = calculateSpecularColor(materialSpecularColor, normal, lightDirection, renderableMaterial.specularExponent, lightColors[i]);
+		vec4 specularColor = calculateSpecularColor(materialSpecularColor, normal, lightDirection, material.x, lightColors[i]);
 		
 		// Light attenuation. Based on information from http://gamedev.stackexchange.com/questions/56897/glsl-light-attenuation-color-and-intensity-formula
 		float attenuation = pow(clamp(1.0 - dist*dist /(attenuationRadius*attenuationRadius), 0.0, 1.0), 2);
-		outColor += materialAmbientColor + attenuation*(renderableMaterial.diffuseGain * diffuseColor + specularColor * renderableMaterial.specularGain); 
+		outColor += materialAmbientColor + attenuation*(material.z * diffuseColor + specularColor * material.y); 
 	}
 	
-	if(renderableMaterial.selfShadowEnabled) {
+	if(material.w > 0.5) {
 	    float lightAccumulation = 1.0;
 		bool isLit = false;
 		
 		for(int i = 0; i < NUM_LIGHTS; i++) {
 			// Shadows
 			vec4 lightDirection_worldspace = lightPositions_worldspace[i] - vertexPosition_worldspace;
-			float sampledDistance = texture(shadowSampler[i], lightDirection_worldspace.xyz).r;
+			float sampledDistance;
+			if (int(sceneUBO.lightShadowProjections[i].x) == SHADOW_PROJECTION_DUAL_PARABOLOID) {
+				// Same projection as paraboloidGeometryShader.geom, from NDC to texture coordinates
+				vec3 direction = normalize(-lightDirection_worldspace.xyz);
+				float side = direction.y >= 0.0 ? 1.0 : -1.0;
+				vec2 paraboloid = vec2(direction.x, direction.z * side) / (1.0 + direction.y * side);
+				float layer = i * NUM_CUBE_FACES + (side > 0.0 ? 0 : 1);
+				sampledDistance = texture(paraboloidShadowSampler, vec3(paraboloid * 0.5 + 0.5, layer)).r * SHADOW_DISTANCE_SCALE;
+			}
+			else if (int(sceneUBO.lightShadowProjections[i].x) == SHADOW_PROJECTION_CUBE_ATLAS) {
+				sampledDistance = sampleShadowAtlas(i, lightDirection_worldspace.xyz, vertexPosition_worldspace) * SHADOW_DISTANCE_SCALE;
+			}
+			else {
+#ifdef SHADOW_CUBE_MAPS
+				sampledDistance = texture(shadowSampler[i], lightDirection_worldspace.xyz).r * SHADOW_DISTANCE_SCALE;
+#else
+				sampledDistance = texture(shadowSampler, vec4(lightDirection_worldspace.xyz, i)).r * SHADOW_DISTANCE_SCALE;
+#endif
+			}
 			float distance = length(lightDirection_worldspace);
 			
-			// If we are in a shadowed area
-			if (distance >= sampledDistance + EPSILON) {
+			// If we are in a shadowed area. The walls are only in the shadow maps without analytic wall shadows
+			if (distance >= sampledDistance + EPSILON || isBehindWall(vertexPosition_worldspace.xyz, lightPositions_worldspace[i].xyz)) {
 				lightAccumulation -= SHADOW_OPACITY;
 			}  
 			else {
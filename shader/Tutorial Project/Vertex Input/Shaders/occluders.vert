@@ -0,0 +1,16 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Depth of the occluders for the depth pyramid. There is no fragment shader
+
+layout(push_constant) uniform PushConsts {
+	mat4 viewProjection;
+} pushConsts;
+
+// Input values
+layout(location = 0) in vec4 vertexPosition_modelspace;
+layout(location = 4) in mat4 instanceModelMatrix;
+
+void main() {
+	gl_Position = pushConsts.viewProjection * instanceModelMatrix * vertexPosition_modelspace;
+}
@@ -5,18 +5,13 @@
 #define NUM_LIGHTS                4
 
 // Uniforms
-layout(set = RENDERABLE_UBO, binding = 0) uniform RenderableUBO {
-    mat4 MVP;
-	mat4 ProjectionMatrix;
-	mat4 ViewMatrix;
-	mat4 ModelMatrix;
-} renderableUBO;
-
 layout(set = SCENE_UBO, binding = 0) uniform SceneUBO {
 	mat4 ProjectionMatrix;
 	mat4 lightOffsetMatrices[NUM_LIGHTS];
 	vec4 lightPositions_worldspace[NUM_LIGHTS];
 	vec4 lightColors[NUM_LIGHTS];
+	mat4 ViewMatrix;
+	mat4 CameraProjectionMatrix;
 } sceneUBO;
 
 // Input values
@@ -25,6 +20,31 @@ layout(location = 1) in vec4 vertexColor;
 layout(location = 2) in vec4 textureCoordinate;
 layout(location = 3) in vec4 vertexNormal_modelspace;
 
+// Per instance values
+#ifdef DYNAMIC_UNIFORMS
+// Has to match MAX_UNIFORM_INSTANCES in consts.h
+#define MAX_UNIFORM_INSTANCES 128
+
+struct InstanceData {
+	mat4 modelMatrix;
+	vec4 color;
+	vec4 material;
+};
+
+// The frame's instances, selected with a dynamic offset. Batches start at their firstInstance
+layout(set = RENDERABLE_UBO, binding = 0) uniform InstanceUBO {
+	InstanceData instances[MAX_UNIFORM_INSTANCES];
+} instanceUBO;
+
+#define instanceModelMatrix instanceUBO.instances[gl_InstanceIndex].modelMatrix
+#define instanceColor instanceUBO.instances[gl_InstanceIndex].color
+#define instanceMaterial instanceUBO.instances[gl_InstanceIndex].material
+#else
+layout(location = 4) in mat4 instanceModelMatrix;
+layout(location = 8) in vec4 instanceColor;
+layout(location = 9) in vec4 instanceMaterial;
+#endif
+
 // Output values. It seems like Vulkan requires these to be in separate locations to work properly
 layout(location = 0) out vec4 vertexPosition_cameraspace;
 layout(location = 1) out vec4 fragmentColor;
@@ -36,24 +56,26 @@ layout(location = 5) out vec4 lightPositions_worldspace[NUM_LIGHTS];
 
 layout(location = 10) out vec4 lightPositions_cameraspace[NUM_LIGHTS];
 layout(location = 15) out vec4 lightColors[NUM_LIGHTS];
+layout(location = 19) flat out vec4 material;
 
 void main() {
-    gl_Position = renderableUBO.MVP * vertexPosition_modelspace;
-    fragmentColor = vertexColor;
+    gl_Position = sceneUBO.CameraProjectionMatrix * sceneUBO.ViewMatrix * instanceModelMatrix * vertexPosition_modelspace;
+    fragmentColor = vertexColor * instanceColor;
+    material = instanceMaterial;
     fragmentTextureCoordinate = textureCoordinate;
 	
 	// Vector that goes from the vertex to the camera, in camera space.
 	// In camera space, the camera is at the origin (0,0,0).
-	vertexPosition_cameraspace =  renderableUBO.ViewMatrix * renderableUBO.ModelMatrix * vertexPosition_modelspace;
+	vertexPosition_cameraspace =  sceneUBO.ViewMatrix * instanceModelMatrix * vertexPosition_modelspace;
 		
 	// Normal of the the vertex, in camera space
-	normal_cameraspace = renderableUBO.ViewMatrix * renderableUBO.ModelMatrix * vertexNormal_modelspace;
+	normal_cameraspace = sceneUBO.ViewMatrix * instanceModelMatrix * vertexNormal_modelspace;
 	
 	for(int i = 0; i < NUM_LIGHTS; i++) {
-		lightPositions_cameraspace[i] = renderableUBO.ViewMatrix * sceneUBO.lightPositions_worldspace[i];
+		lightPositions_cameraspace[i] = sceneUBO.ViewMatrix * sceneUBO.lightPositions_worldspace[i];
 	} 
 	
 	lightColors = sceneUBO.lightColors;
-	vertexPosition_worldspace =  renderableUBO.ModelMatrix * vertexPosition_modelspace;
+	vertexPosition_worldspace =  instanceModelMatrix * vertexPosition_modelspace;
 	lightPositions_worldspace = sceneUBO.lightPositions_worldspace;
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include <sstream>
 #include "VulkanAPIHandler.h"
 #include "consts.h"
 
@@ -26,9 +27,113 @@ static void inputCallback(GLFWwindow* window, int key, int scancode, int action,
 	apiHandler->handleInput(GLFWKeyEvent(window, key, scancode, action, mods));
 }
 
-int main() {
+// Usage: "Pacman 3D in Vulkan.exe" [--frames-in-flight N] [--no-instancing] [--dynamic-uniforms] [--shadow-copy] [--no-shadow-cache] [--no-shadow-dirty-tracking] [--no-shadow-culling] [--no-cube-map-array] [--no-frustum-culling] [--gpu-culling] [--occlusion-culling] [--no-draw-sorting] [--shadow-face-budget N] [--shadow-format r32|d32|d16] [--paraboloid-shadows LIGHT,LIGHT,...] [--analytic-wall-shadows] [--shadow-atlas] [--recording-threads N] [--immediate-uploads] [--no-transfer-queue] [--allocator free-list|linear|dedicated]
+RenderSettings parseCommandLine(int argc, char* argv[]) {
+	RenderSettings settings;
+
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+
+		if (argument == "--frames-in-flight" && i + 1 < argc) {
+			settings.framesInFlight = std::max(1, std::min(MAX_FRAMES_IN_FLIGHT, std::atoi(argv[++i])));
+		}
+		else if (argument == "--no-instancing") {
+			settings.instancing = false;
+		}
+		else if (argument == "--dynamic-uniforms") {
+			settings.dynamicUniforms = true;
+		}
+		else if (argument == "--shadow-copy") {
+			settings.layeredShadows = false;
+		}
+		else if (argument == "--no-shadow-cache") {
+			settings.staticShadowCache = false;
+		}
+		else if (argument == "--no-shadow-dirty-tracking") {
+			settings.shadowDirtyTracking = false;
+		}
+		else if (argument == "--no-cube-map-array") {
+			settings.shadowCubeMapArray = false;
+		}
+		else if (argument == "--no-shadow-culling") {
+			settings.shadowCasterCulling = false;
+		}
+		else if (argument == "--no-frustum-culling") {
+			settings.frustumCulling = false;
+		}
+		else if (argument == "--gpu-culling") {
+			settings.gpuCulling = true;
+		}
+		else if (argument == "--occlusion-culling") {
+			settings.occlusionCulling = true;
+		}
+		else if (argument == "--no-draw-sorting") {
+			settings.drawSorting = false;
+		}
+		else if (argument == "--shadow-face-budget" && i + 1 < argc) {
+			settings.shadowFaceBudget = std::max(0, std::atoi(argv[++i]));
+		}
+		else if (argument == "--shadow-format" && i + 1 < argc) {
+			std::string format = argv[++i];
+			if (format == "d32") {
+				settings.shadowFormat = SHADOW_FORMAT_D32;
+			}
+			else if (format == "d16") {
+				settings.shadowFormat = SHADOW_FORMAT_D16;
+			}
+			else {
+				settings.shadowFormat = SHADOW_FORMAT_R32_DISTANCE;
+			}
+		}
+		else if (argument == "--paraboloid-shadows" && i + 1 < argc) {
+			std::stringstream lights(argv[++i]);
+			std::string light;
+			while (std::getline(lights, light, ',')) {
+				int lightIndex = std::atoi(light.c_str());
+				if (lightIndex >= 0 && lightIndex < NUM_LIGHTS) {
+					settings.paraboloidShadowLights |= 1 << lightIndex;
+				}
+			}
+		}
+		else if (argument == "--analytic-wall-shadows") {
+			settings.analyticWallShadows = true;
+		}
+		else if (argument == "--shadow-atlas") {
+			settings.shadowAtlas = true;
+		}
+		else if (argument == "--recording-threads" && i + 1 < argc) {
+			settings.recordingThreads = std::max(0, std::min(MAX_RECORDING_THREADS, std::atoi(argv[++i])));
+		}
+		else if (argument == "--immediate-uploads") {
+			settings.immediateUploads = true;
+		}
+		else if (argument == "--no-transfer-queue") {
+			settings.transferQueue = false;
+		}
+		else if (argument == "--allocator" && i + 1 < argc) {
+			std::string strategy = argv[++i];
+			if (strategy == "linear") {
+				settings.allocationStrategy = ALLOCATION_STRATEGY_LINEAR;
+			}
+			else if (strategy == "dedicated") {
+				settings.allocationStrategy = ALLOCATION_STRATEGY_DEDICATED;
+			}
+			else {
+				settings.allocationStrategy = ALLOCATION_STRATEGY_FREE_LIST;
+			}
+		}
+		else {
+			printf("Unknown argument: %s\n", argument.c_str());
+		}
+	}
+
+	return settings;
+}
+
+int main(int argc, char* argv[]) {
+	RenderSettings settings = parseCommandLine(argc, argv);
 	auto window = initWindow(WINDOW_WIDTH, WINDOW_HEIGHT);
-	VulkanAPIHandler vulkanAPIHandler(window);
+	VulkanAPIHandler vulkanAPIHandler(window, settings);
 	setupResizeCallback(window, vulkanAPIHandler);
 	glfwSetKeyCallback(window, inputCallback);
 	glfwSetWindowUserPointer(window, &vulkanAPIHandler);
@@ -46,12 +151,13 @@ int main() {
 		frameRateDisplayTimer += deltaTime;
 		if (frameRateDisplayTimer >= 1000.0) {
 			printf("%f ms/frame\n", 1000.0 / double(numberOfFrames));
+			vulkanAPIHandler.printFrameStatistics(numberOfFrames);
 			frameRateDisplayTimer = 0;
 			numberOfFrames = 0;
 		}
 
+		// Uniform buffers are written inside drawFrame once the frame's previous use has finished on the GPU
 		glfwPollEvents();
-		vulkanAPIHandler.updateUniformBuffers();
 		vulkanAPIHandler.update(deltaTime);
 		vulkanAPIHandler.drawFrame();
 	}
@@ -4,17 +4,12 @@
 #include <GLFW/glfw3.h>
 #include <glm\glm.hpp>
 #include <array>
+#include <vector>
 #include <glm/gtx/hash.hpp>
 #include "consts.h"
+#include "DeviceMemoryAllocator.h"
 
-struct RenderableUBO {
-	glm::mat4 mvp;
-	glm::mat4 projectionMatrix;
-	glm::mat4 viewMatrix;
-	glm::mat4 modelMatrix;
-};
-
-struct RenderableMaterialUBO {
+struct RenderableMaterial {
 	float specularExponent{128.0};
 	float specularGain{1};
 	float diffuseGain{1};
@@ -26,15 +21,88 @@ struct SceneUBO {
 	glm::mat4 lightOffsetMatrices[NUM_LIGHTS];
 	glm::vec4 lightPositions[NUM_LIGHTS];
 	glm::vec4 lightColors[NUM_LIGHTS];
+	// Camera of the main pass. The renderables only supply their model matrix
+	glm::mat4 cameraViewMatrix;
+	glm::mat4 cameraProjectionMatrix;
+	// Used by layered shadow rendering, where the geometry shader projects into every face
+	glm::mat4 cubeFaceViewMatrices[NUM_CUBE_FACES];
+	// The ShadowProjection of every light in x
+	glm::vec4 lightShadowProjections[NUM_LIGHTS];
+	// Maze walls as min x, min z, max x and max z, for analytic wall shadows
+	glm::vec4 wallBounds[MAX_ANALYTIC_WALLS];
+	// Number of walls in x (0 if analytic wall shadows are off) and their height in y
+	glm::vec4 wallParameters;
+	// Tile of every light's faces in the shadow atlas, indexed like the cube map array layers.
+	// Offset and size in texture coordinates in xyz, size in texels in w
+	glm::vec4 shadowAtlasTiles[NUM_SHADOW_MAP_LAYERS];
+};
+
+// How the culling shader decides whether an instance is visible in a view. Has to match cullInstances.comp
+enum CullingViewType {
+	// Nothing is visible, the view is not drawn this frame
+	CULLING_VIEW_NONE = 0,
+	CULLING_VIEW_ALL,
+	CULLING_VIEW_CAMERA,
+	// Reaches one of the view's faces of the light's cube map
+	CULLING_VIEW_CUBE_FACES,
+	CULLING_VIEW_PARABOLOID_HALVES
+};
+
+// Parameters of the culling shader, written every frame
+struct CullingUBO {
+	// Projects bounding boxes onto the depth pyramid
+	glm::mat4 cameraViewProjection;
+	glm::vec4 frustumPlanes[6];
+	glm::vec4 lightPositions[NUM_LIGHTS];
+	// Light index, faces tested for static batches, faces tested for moving batches and the CullingViewType.
+	// The camera view only uses x, 1 if the frustum is tested
+	glm::uvec4 views[NUM_CULLING_VIEWS];
+	// Number of instances and batches in xy
+	glm::uvec4 counts;
+	// Width and height of the depth pyramid's first level, its number of levels and whether occlusion culling is on
+	glm::uvec4 depthPyramid;
+};
+
+// Counted by the culling shader for the camera view, read back once the frame's fence has signaled
+struct CullingStatistics {
+	uint32_t instancesTested;
+	uint32_t frustumCulled;
+	uint32_t occlusionCulled;
+	uint32_t padding;
+};
+
+// An instance batch as the culling shader sees it, laid out for std430
+struct CullingBatch {
+	// Bounding sphere of the mesh in model space
+	glm::vec4 boundingSphere;
+	uint32_t indexCount;
+	uint32_t firstIndex;
+	int32_t vertexOffset;
+	uint32_t firstInstance;
+	uint32_t instanceCount;
+	uint32_t isStatic;
+	uint32_t padding[2];
+};
+
+// How a light's shadow map covers the sphere around it
+enum ShadowProjection {
+	SHADOW_PROJECTION_CUBE = 0,
+	// Two hemispheres in the first two layers of the light's cube map range
+	SHADOW_PROJECTION_DUAL_PARABOLOID,
+	// Six cube faces, each in its own tile of the shadow atlas
+	SHADOW_PROJECTION_CUBE_ATLAS
 };
 
 struct PushConstants {
 	glm::mat4 vireMatrix;
 	int currentMatrixIndex;
+	// Cube map faces the layered geometry shader emits triangles to
+	uint32_t faceMask;
 
-	PushConstants(glm::mat4 view, int index) {
+	PushConstants(glm::mat4 view, int index, uint32_t faces = ALL_CUBE_FACES) {
 		vireMatrix = view;
 		currentMatrixIndex = index;
+		faceMask = faces;
 	}
 };
 
@@ -85,10 +153,53 @@ struct Vertex {
 	}
 };
 
+// Everything that differs between renderables drawing the same mesh. Read from the instance buffer
+// at binding 1 once per instance, so all renderables of an instance batch are drawn with one call
+struct InstanceData {
+	glm::mat4 modelMatrix;
+	// Multiplied with the vertex colour
+	glm::vec4 color;
+	// Specular exponent, specular gain, diffuse gain and self shadowing (0 or 1)
+	glm::vec4 material;
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 1;
+		bindingDescription.stride = sizeof(InstanceData);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, NUM_INSTANCE_ATTRIBUTES> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, NUM_INSTANCE_ATTRIBUTES> attributeDescriptions = {};
+
+		// A mat4 input takes up one location per column. The instance locations follow the vertex locations
+		for (uint32_t column = 0; column < 4; column++) {
+			attributeDescriptions[column].binding = 1;
+			attributeDescriptions[column].location = NUM_VERTEX_ATTRIBUTES + column;
+			attributeDescriptions[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			attributeDescriptions[column].offset = offsetof(InstanceData, modelMatrix) + column * sizeof(glm::vec4);
+		}
+
+		attributeDescriptions[4].binding = 1;
+		attributeDescriptions[4].location = NUM_VERTEX_ATTRIBUTES + 4;
+		attributeDescriptions[4].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[4].offset = offsetof(InstanceData, color);
+
+		attributeDescriptions[5].binding = 1;
+		attributeDescriptions[5].location = NUM_VERTEX_ATTRIBUTES + 5;
+		attributeDescriptions[5].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[5].offset = offsetof(InstanceData, material);
+
+		return attributeDescriptions;
+	}
+};
+
 // OffscreenPass and FrameBufferAttachment are used for shadow mapping
 struct FrameBufferAttachment {
 	VkImage image;
-	VkDeviceMemory memory;
+	MemoryAllocation memory;
 	VkImageView view;
 };
 
@@ -112,14 +223,109 @@ struct RenderableInformation {
 	}
 };
 
-struct OffscreenPass {
-	int32_t width, height;
+// A framebuffer that single cube map faces are rendered into before they are copied into the cube map array
+struct OffscreenTarget {
 	VkFramebuffer frameBuffer;
 	FrameBufferAttachment color, depth;
+};
+
+struct OffscreenPass {
+	int32_t width, height;
+	// Faces rendered into different targets do not have to wait for each other's copies
+	std::vector<OffscreenTarget> targets;
 	VkRenderPass renderPass;
-	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
-	// Semaphore used to synchronize between offscreen and final scene render pass
-	VkSemaphore semaphore = VK_NULL_HANDLE;
+	// One command buffer and semaphore per frame in flight
+	std::vector<VkCommandBuffer> commandBuffers;
+	// Semaphores used to synchronize between offscreen and final scene render pass
+	std::vector<VkSemaphore> semaphores;
+};
+
+// What the shadow cube maps store
+enum ShadowMapFormat {
+	// Linear distance to the light in a 32 bit float color attachment, rendered with a separate depth attachment
+	SHADOW_FORMAT_R32_DISTANCE = 0,
+	// Linear distance divided by Z_FAR, written as the depth of a depth-only attachment
+	SHADOW_FORMAT_D32,
+	SHADOW_FORMAT_D16
+};
+
+// Settings that can be changed from the command line without recompiling
+struct RenderSettings {
+	int framesInFlight{DEFAULT_FRAMES_IN_FLIGHT};
+	// Renderables with the same mesh and texture are drawn with one instanced draw call
+	bool instancing{true};
+	// The vertex shaders read the instances from a uniform buffer selected with a dynamic offset, instead of
+	// the instance vertex buffer. Renderables still share one descriptor set per texture. Turns off GPU culling
+	bool dynamicUniforms{false};
+	// Submits and waits after every upload instead of batching them, for comparing startup times
+	bool immediateUploads{false};
+	// Streams mesh and texture uploads through a dedicated transfer queue family if the device has one
+	bool transferQueue{true};
+	AllocationStrategy allocationStrategy{ALLOCATION_STRATEGY_FREE_LIST};
+	// Renders every shadow cube map in one render pass with a geometry shader that selects the face with
+	// gl_Layer, instead of one pass and one copy per face. Turned off if geometry shaders are not supported
+	bool layeredShadows{true};
+	// Keeps the shadows of static geometry in a separate cube map per light that is only rendered again when
+	// the light moves. Every frame copies it and adds the moving objects on top. Needs layered shadows
+	bool staticShadowCache{true};
+	// Only renders the cube map faces whose contents can have changed since the last frame. Turning it
+	// off renders every face of every light each frame, which is how shadows used to be rendered
+	bool shadowDirtyTracking{true};
+	// Each cube map face only draws the shadow casters inside its frustum and the light's range
+	bool shadowCasterCulling{true};
+	// How many dirty cube map faces are rendered per frame, the others keep their stale contents until
+	// they are scheduled. 0 renders every dirty face
+	uint32_t shadowFaceBudget{0};
+	// Samples the shadows of all lights through one cube map array view. Turned off if cube map arrays are not
+	// supported, every light's six layers are then bound as a cube map of their own
+	bool shadowCubeMapArray{true};
+	// The depth-only formats need layered shadows
+	ShadowMapFormat shadowFormat{SHADOW_FORMAT_R32_DISTANCE};
+	// One bit per light index. These lights render two paraboloid halves instead of six cube faces and
+	// are not cached. Needs layered shadows and clip distances
+	uint32_t paraboloidShadowLights{0};
+	// Shadows of the maze walls are ray traced against their boxes in the scene fragment shader, the shadow
+	// maps only contain the moving objects. Turned off if the maze has more than MAX_ANALYTIC_WALLS walls
+	bool analyticWallShadows{false};
+	// All faces of all lights are tiles of one 2D shadow atlas. Tiles get smaller the further a light is from
+	// the camera. Needs layered shadows and multiple viewports, replaces static caching and paraboloid shadows
+	bool shadowAtlas{false};
+	// Threads that record the scene pass into secondary command buffers every frame. 0 uses one per hardware
+	// thread, 1 records the pass inline on the main thread
+	uint32_t recordingThreads{0};
+	// The scene pass only draws the instances whose bounding sphere intersects the camera frustum
+	bool frustumCulling{true};
+	// Culls the instances of the scene pass and of every shadow map face in a compute shader that writes indirect
+	// draw commands, so drawing costs the same on the CPU however many instances there are
+	bool gpuCulling{false};
+	// The culling shader also rejects instances hidden behind the maze, tested against a depth pyramid of the
+	// static geometry seen from the camera. Needs GPU culling
+	bool occlusionCulling{false};
+	// Batches are drawn sorted by material, mesh and depth, and binds that are already in place are skipped.
+	// Turning it off draws them in the order the renderables were created and binds everything for every batch
+	bool drawSorting{true};
+};
+
+// Timestamps written into the command buffers of every frame in flight
+enum FrameTimestamp {
+	TIMESTAMP_OFFSCREEN_BEGIN = 0,
+	TIMESTAMP_OFFSCREEN_END,
+	TIMESTAMP_SCENE_BEGIN,
+	TIMESTAMP_SCENE_END,
+	NUM_FRAME_TIMESTAMPS
+};
+
+// Accumulated timings, reset every time they are printed
+struct FrameStatistics {
+	// Time the CPU spent blocked on the fence of the frame it wanted to reuse
+	float cpuWaitTime{0};
+	// Time the GPU spent executing the offscreen and scene command buffers
+	float gpuBusyTime{0};
+	// The part of gpuBusyTime spent rendering the shadow cube maps
+	float shadowPassTime{0};
+	// CPU time spent recording the scene command buffer
+	float recordTime{0};
+	int gpuFramesMeasured{0};
 };
 
 struct CollisionRect{
@@ -0,0 +1,170 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "TextureCache.h"
+#include "VulkanAPIHandler.h"
+
+Texture::Texture(VulkanAPIHandler* vkAPIHandler) {
+	device = vkAPIHandler->getDevice();
+}
+
+VkImage Texture::getImage() {
+	return image;
+}
+
+VkImageView Texture::getImageView() {
+	return imageView;
+}
+
+VkDeviceSize Texture::getSize() {
+	return size;
+}
+
+TextureCache::TextureCache(VulkanAPIHandler* vkAPIHandler) {
+	vulkanAPIHandler = vkAPIHandler;
+	device = vkAPIHandler->getDevice();
+}
+
+TextureCache::~TextureCache() {
+	for (auto& bucket : samplers) {
+		for (auto& cached : bucket.second) {
+			vkDestroySampler(device, cached.sampler, nullptr);
+		}
+	}
+}
+
+std::shared_ptr<Texture> TextureCache::load(const std::string& texturePath) {
+	auto cached = textures.find(texturePath);
+	if (cached != textures.end()) {
+		if (std::shared_ptr<Texture> texture = cached->second.lock()) {
+			textureCacheHits++;
+			return texture;
+		}
+	}
+
+	auto texture = std::make_shared<Texture>(vulkanAPIHandler);
+	loadTexture(texture.get(), texturePath);
+	textures[texturePath] = texture;
+	texturesLoaded++;
+
+	return texture;
+}
+
+VkSampler TextureCache::getSampler(const VkSamplerCreateInfo& samplerInfo) {
+	if (samplerInfo.pNext != nullptr) {
+		throw std::runtime_error("cached samplers can not have a pNext chain!");
+	}
+
+	std::vector<CachedSampler>& bucket = samplers[hashSamplerInfo(samplerInfo)];
+	for (auto& cached : bucket) {
+		if (equalSamplerInfo(cached.info, samplerInfo)) {
+			samplerCacheHits++;
+			return cached.sampler;
+		}
+	}
+
+	CachedSampler cached = {};
+	cached.info = samplerInfo;
+
+	if (vkCreateSampler(device, &samplerInfo, nullptr, &cached.sampler) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create texture sampler!");
+	}
+
+	bucket.push_back(cached);
+	samplersCreated++;
+
+	return cached.sampler;
+}
+
+void TextureCache::printStatistics() {
+	// Every additional user of a live texture would have had its own copy before
+	VkDeviceSize bytesSaved = 0;
+	for (auto& texture : textures) {
+		if (std::shared_ptr<Texture> live = texture.second.lock()) {
+			// use_count includes the local reference, and the first user had to load the texture anyway
+			bytesSaved += live->getSize() * (live.use_count() - 2);
+		}
+	}
+
+	printf("Texture cache: %u textures loaded, %u loads shared an existing texture, %llu KB saved. %u samplers created, %u requests shared one\n",
+		   texturesLoaded,
+		   textureCacheHits,
+		   (unsigned long long)bytesSaved / 1024,
+		   samplersCreated,
+		   samplerCacheHits);
+}
+
+void TextureCache::loadTexture(Texture* texture, const std::string& texturePath) {
+	const int BYTES_PER_PIXEL = 4;
+	int texWidth, texHeight, texChannels;
+	stbi_uc* pixels = stbi_load(texturePath.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+
+	if (!pixels) {
+		throw std::runtime_error("failed to load texture image!");
+	}
+
+	texture->size = texWidth * texHeight * BYTES_PER_PIXEL;
+
+	vulkanAPIHandler->createImage(
+		texWidth,
+		texHeight,
+		VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		texture->image,
+		texture->imageMemory
+	);
+
+	// The pixels are copied into staging memory right away, so they can be freed before the upload executes
+	vulkanAPIHandler->getStreamingBatcher()->uploadImage(pixels, texture->size, texture->image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight);
+	stbi_image_free(pixels);
+
+	vulkanAPIHandler->createImageView(texture->image, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, texture->imageView);
+}
+
+size_t TextureCache::hashSamplerInfo(const VkSamplerCreateInfo& info) {
+	// http://www.boost.org/doc/libs/1_55_0/doc/html/hash/reference.html#boost.hash_combine
+	size_t seed = 0;
+	auto combine = [&seed](size_t value) {
+		seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+	};
+
+	combine(std::hash<uint32_t>()(info.flags));
+	combine(std::hash<uint32_t>()(info.magFilter));
+	combine(std::hash<uint32_t>()(info.minFilter));
+	combine(std::hash<uint32_t>()(info.mipmapMode));
+	combine(std::hash<uint32_t>()(info.addressModeU));
+	combine(std::hash<uint32_t>()(info.addressModeV));
+	combine(std::hash<uint32_t>()(info.addressModeW));
+	combine(std::hash<float>()(info.mipLodBias));
+	combine(std::hash<uint32_t>()(info.anisotropyEnable));
+	combine(std::hash<float>()(info.maxAnisotropy));
+	combine(std::hash<uint32_t>()(info.compareEnable));
+	combine(std::hash<uint32_t>()(info.compareOp));
+	combine(std::hash<float>()(info.minLod));
+	combine(std::hash<float>()(info.maxLod));
+	combine(std::hash<uint32_t>()(info.borderColor));
+	combine(std::hash<uint32_t>()(info.unnormalizedCoordinates));
+
+	return seed;
+}
+
+bool TextureCache::equalSamplerInfo(const VkSamplerCreateInfo& a, const VkSamplerCreateInfo& b) {
+	// Compared field by field, the padding inside the struct is not guaranteed to be zeroed
+	return a.flags == b.flags &&
+		   a.magFilter == b.magFilter &&
+		   a.minFilter == b.minFilter &&
+		   a.mipmapMode == b.mipmapMode &&
+		   a.addressModeU == b.addressModeU &&
+		   a.addressModeV == b.addressModeV &&
+		   a.addressModeW == b.addressModeW &&
+		   a.mipLodBias == b.mipLodBias &&
+		   a.anisotropyEnable == b.anisotropyEnable &&
+		   a.maxAnisotropy == b.maxAnisotropy &&
+		   a.compareEnable == b.compareEnable &&
+		   a.compareOp == b.compareOp &&
+		   a.minLod == b.minLod &&
+		   a.maxLod == b.maxLod &&
+		   a.borderColor == b.borderColor &&
+		   a.unnormalizedCoordinates == b.unnormalizedCoordinates;
+}
@@ -0,0 +1,68 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "VDeleter.h"
+#include "DeviceMemoryAllocator.h"
+
+class VulkanAPIHandler;
+
+// A decoded image file on the GPU together with its view. Shared by every renderable using the same file
+class Texture {
+public:
+	Texture(VulkanAPIHandler* vkAPIHandler);
+
+	VkImage getImage();
+	VkImageView getImageView();
+	VkDeviceSize getSize();
+private:
+	friend class TextureCache;
+
+	VDeleter<VkDevice> device;
+
+	VDeleter<VkImage> image{ device, vkDestroyImage };
+	VDeleter<VkImageView> imageView{ device, vkDestroyImageView };
+	MemoryAllocation imageMemory;
+	VkDeviceSize size{0};
+};
+
+// Decodes and uploads every texture file once. Like the mesh cache it only holds weak references,
+// so a texture is released as soon as the last renderable using it is destroyed.
+// Samplers are shared by their create info and live as long as the cache.
+class TextureCache {
+public:
+	TextureCache(VulkanAPIHandler* vkAPIHandler);
+	~TextureCache();
+
+	std::shared_ptr<Texture> load(const std::string& texturePath);
+	// Returns an existing sampler if one was created with the same parameters. pNext is not supported
+	VkSampler getSampler(const VkSamplerCreateInfo& samplerInfo);
+
+	void printStatistics();
+private:
+	struct CachedSampler {
+		VkSamplerCreateInfo info;
+		VkSampler sampler;
+	};
+
+	VulkanAPIHandler* vulkanAPIHandler;
+	VkDevice device;
+
+	std::map<std::string, std::weak_ptr<Texture>> textures;
+	// Keyed by the hash of the create info, colliding entries are compared field by field
+	std::unordered_map<size_t, std::vector<CachedSampler>> samplers;
+
+	uint32_t texturesLoaded{0};
+	uint32_t textureCacheHits{0};
+	uint32_t samplersCreated{0};
+	uint32_t samplerCacheHits{0};
+
+	void loadTexture(Texture* texture, const std::string& texturePath);
+
+	static size_t hashSamplerInfo(const VkSamplerCreateInfo& info);
+	static bool equalSamplerInfo(const VkSamplerCreateInfo& a, const VkSamplerCreateInfo& b);
+};
@@ -0,0 +1,302 @@
+#include "UploadBatcher.h"
+#include "VulkanAPIHandler.h"
+
+UploadBatcher::UploadBatcher(VulkanAPIHandler* vkAPIHandler, VkQueue uploadQueue, uint32_t uploadQueueFamily, VkCommandPool uploadCommandPool, bool immediate, UploadBatcher* ownerBatcher) {
+	vulkanAPIHandler = vkAPIHandler;
+	device = vkAPIHandler->getDevice();
+	queue = uploadQueue;
+	queueFamily = uploadQueueFamily;
+	commandPool = uploadCommandPool;
+	immediateMode = immediate;
+	owner = ownerBatcher;
+
+	// Buffer to image copies need an offset that is a multiple of the texel size, 16 covers every format we use
+	copyOffsetAlignment = std::max<VkDeviceSize>(copyOffsetAlignment, vkAPIHandler->getPhysicalDeviceProperties().limits.optimalBufferCopyOffsetAlignment);
+}
+
+UploadBatcher::~UploadBatcher() {
+	waitAll();
+}
+
+UploadTicket UploadBatcher::uploadBuffer(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset) {
+	StagingAllocation staging = allocateStaging(size);
+	memcpy(staging.mappedData, data, (size_t)size);
+
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = staging.offset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(getCommandBuffer(), staging.buffer, dstBuffer, 1, &copyRegion);
+	releaseBuffer(dstBuffer, dstOffset, size);
+
+	return commit();
+}
+
+UploadTicket UploadBatcher::uploadImage(const void* pixels, VkDeviceSize size, VkImage dstImage, VkFormat format, uint32_t width, uint32_t height) {
+	StagingAllocation staging = allocateStaging(size);
+	memcpy(staging.mappedData, pixels, (size_t)size);
+
+	VkCommandBuffer commandBuffer = getCommandBuffer();
+
+	// The previous contents of the image are irrelevant since the whole image is overwritten
+	vulkanAPIHandler->transitionImageLayout(commandBuffer, dstImage, format, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = staging.offset;
+	// Zero means the pixels are tightly packed
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { width, height, 1 };
+	vkCmdCopyBufferToImage(commandBuffer, staging.buffer, dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	if (!transfersOwnership()) {
+		vulkanAPIHandler->transitionImageLayout(commandBuffer, dstImage, format, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+		return commit();
+	}
+
+	// The release and the acquire barrier both have to describe the same layout transition
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcQueueFamilyIndex = queueFamily;
+	barrier.dstQueueFamilyIndex = owner->queueFamily;
+	barrier.image = dstImage;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	recordingBatch->acquireImageBarriers.push_back(barrier);
+
+	return commit();
+}
+
+UploadTicket UploadBatcher::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+	VkBufferCopy copyRegion = {};
+	copyRegion.size = size;
+	vkCmdCopyBuffer(getCommandBuffer(), srcBuffer, dstBuffer, 1, &copyRegion);
+	releaseBuffer(dstBuffer, 0, size);
+
+	return commit();
+}
+
+UploadTicket UploadBatcher::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int subResourceLayerCount, bool hasDepthStencilBit) {
+	vulkanAPIHandler->transitionImageLayout(getCommandBuffer(), image, format, oldLayout, newLayout, subResourceLayerCount, hasDepthStencilBit);
+
+	return commit();
+}
+
+VkCommandBuffer UploadBatcher::getCommandBuffer() {
+	return getRecordingBatch()->commandBuffer;
+}
+
+UploadTicket UploadBatcher::commit() {
+	if (recordingBatch == nullptr) {
+		return nextTicket - 1;
+	}
+
+	UploadTicket ticket = recordingBatch->ticket;
+
+	if (immediateMode) {
+		wait(flush());
+	}
+
+	return ticket;
+}
+
+UploadTicket UploadBatcher::flush() {
+	if (recordingBatch == nullptr) {
+		return nextTicket - 1;
+	}
+
+	VkCommandBuffer commandBuffer = recordingBatch->commandBuffer;
+
+	// Makes every transfer write of the batch visible to whatever is submitted after it
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkEndCommandBuffer(commandBuffer);
+
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	if (vkCreateFence(device, &fenceInfo, nullptr, recordingBatch->fence.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create upload fence!");
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, recordingBatch->fence) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit upload batch!");
+	}
+	submitCount++;
+
+	UploadTicket ticket = recordingBatch->ticket;
+	submittedBatches.push_back(std::move(recordingBatch));
+
+	return ticket;
+}
+
+void UploadBatcher::wait(UploadTicket ticket) {
+	if (ticket <= completedTicket) {
+		return;
+	}
+
+	if (recordingBatch != nullptr && ticket >= recordingBatch->ticket) {
+		flush();
+	}
+
+	// Batches are kept in submission order
+	while (!submittedBatches.empty() && submittedBatches.front()->ticket <= ticket) {
+		VkFence fence = submittedBatches.front()->fence;
+		vkWaitForFences(device, 1, &fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+
+		retire(submittedBatches.front().get());
+		submittedBatches.erase(submittedBatches.begin());
+	}
+}
+
+bool UploadBatcher::isComplete(UploadTicket ticket) {
+	collect();
+	return ticket <= completedTicket;
+}
+
+void UploadBatcher::waitAll() {
+	wait(nextTicket - 1);
+}
+
+void UploadBatcher::collect() {
+	while (!submittedBatches.empty() && vkGetFenceStatus(device, submittedBatches.front()->fence) == VK_SUCCESS) {
+		retire(submittedBatches.front().get());
+		submittedBatches.erase(submittedBatches.begin());
+	}
+}
+
+uint32_t UploadBatcher::getSubmitCount() {
+	return submitCount;
+}
+
+VkDeviceSize UploadBatcher::getStagingBytes() {
+	return stagingBytes;
+}
+
+UploadBatcher::Batch* UploadBatcher::getRecordingBatch() {
+	if (recordingBatch != nullptr) {
+		return recordingBatch.get();
+	}
+
+	recordingBatch = std::make_unique<Batch>(device);
+	recordingBatch->ticket = nextTicket++;
+
+	VkCommandBufferAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	allocInfo.commandPool = commandPool;
+	allocInfo.commandBufferCount = 1;
+
+	if (vkAllocateCommandBuffers(device, &allocInfo, &recordingBatch->commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate upload command buffer!");
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	vkBeginCommandBuffer(recordingBatch->commandBuffer, &beginInfo);
+
+	return recordingBatch.get();
+}
+
+UploadBatcher::StagingAllocation UploadBatcher::allocateStaging(VkDeviceSize size) {
+	Batch* batch = getRecordingBatch();
+
+	// Sub-allocating from the last block of the batch, a new block is only created if it is full
+	StagingBlock* block = batch->stagingBlocks.empty() ? nullptr : batch->stagingBlocks.back().get();
+	VkDeviceSize offset = block == nullptr ? 0 : (block->used + copyOffsetAlignment - 1) / copyOffsetAlignment * copyOffsetAlignment;
+
+	if (block == nullptr || offset + size > block->size) {
+		batch->stagingBlocks.push_back(std::make_unique<StagingBlock>(device));
+		block = batch->stagingBlocks.back().get();
+		block->size = std::max(size, STAGING_BLOCK_SIZE);
+		offset = 0;
+
+		vulkanAPIHandler->createBuffer(block->size,
+									   VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+									   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+									   block->buffer,
+									   block->memory);
+
+		block->mappedData = reinterpret_cast<uint8_t*>(block->memory.getMappedData());
+	}
+
+	block->used = offset + size;
+	stagingBytes += size;
+
+	return { block->buffer, offset, block->mappedData + offset };
+}
+
+void UploadBatcher::retire(Batch* batch) {
+	vkFreeCommandBuffers(device, commandPool, 1, &batch->commandBuffer);
+
+	if (!batch->acquireBufferBarriers.empty() || !batch->acquireImageBarriers.empty()) {
+		owner->acquireOwnership(batch->acquireBufferBarriers, batch->acquireImageBarriers);
+	}
+
+	completedTicket = std::max(completedTicket, batch->ticket);
+}
+
+bool UploadBatcher::transfersOwnership() {
+	return owner != nullptr && owner->queueFamily != queueFamily;
+}
+
+void UploadBatcher::releaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) {
+	if (!transfersOwnership()) {
+		return;
+	}
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = queueFamily;
+	barrier.dstQueueFamilyIndex = owner->queueFamily;
+	barrier.buffer = buffer;
+	barrier.offset = offset;
+	barrier.size = size;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(getCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	// Access masks of the release are ignored on the acquiring side and the other way round
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	recordingBatch->acquireBufferBarriers.push_back(barrier);
+}
+
+void UploadBatcher::acquireOwnership(const std::vector<VkBufferMemoryBarrier>& bufferBarriers, const std::vector<VkImageMemoryBarrier>& imageBarriers) {
+	// The release batch has already signaled its fence, so no semaphore is needed before the acquire
+	vkCmdPipelineBarrier(getCommandBuffer(),
+						 VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+						 0,
+						 0, nullptr,
+						 bufferBarriers.size(), bufferBarriers.data(),
+						 imageBarriers.size(), imageBarriers.data());
+
+	commit();
+}
@@ -0,0 +1,106 @@
+#pragma once
+#define GLFW_INCLUDE_VULKAN
+#include <GLFW/glfw3.h>
+#include <memory>
+#include <vector>
+#include "VDeleter.h"
+#include "DeviceMemoryAllocator.h"
+
+class VulkanAPIHandler;
+
+// Identifies the batch an upload was recorded into. Tickets increase monotonically,
+// so a finished ticket means every earlier ticket has finished as well.
+typedef uint64_t UploadTicket;
+
+// Collects buffer/image uploads and layout transitions into a single command buffer instead of
+// submitting and waiting on the queue for every operation. A batch is submitted with flush() and
+// signals its own fence; callers only block in wait() if they actually need the result on the CPU.
+// Work on the GPU is ordered by submission, so anything submitted after a flush sees the uploads.
+//
+// A batcher on a dedicated transfer queue is given the batcher of the queue that renders with the
+// uploaded resources as its owner. Every upload then ends with a queue family release barrier, and
+// once the GPU has finished the batch the matching acquire barriers are recorded into the owner.
+// Its tickets complete at that point, the resources can be used by anything the owner flushes before.
+class UploadBatcher {
+public:
+	UploadBatcher(VulkanAPIHandler* vkAPIHandler, VkQueue queue, uint32_t queueFamily, VkCommandPool commandPool, bool immediate, UploadBatcher* ownerBatcher = nullptr);
+	~UploadBatcher();
+
+	// Copies data into batcher owned staging memory and records a copy into dstBuffer
+	UploadTicket uploadBuffer(const void* data, VkDeviceSize size, VkBuffer dstBuffer, VkDeviceSize dstOffset = 0);
+	// Uploads tightly packed pixels into mip 0 / layer 0 and leaves the image in SHADER_READ_ONLY_OPTIMAL
+	UploadTicket uploadImage(const void* pixels, VkDeviceSize size, VkImage dstImage, VkFormat format, uint32_t width, uint32_t height);
+	// srcBuffer has to stay alive until the returned ticket has completed
+	UploadTicket copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+	UploadTicket transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int subResourceLayerCount = 1, bool hasDepthStencilBit = false);
+
+	// For recording arbitrary setup commands. Finish the recorded operation with commit()
+	VkCommandBuffer getCommandBuffer();
+	UploadTicket commit();
+
+	// Submits the batch that is currently being recorded, if there is one
+	UploadTicket flush();
+	void wait(UploadTicket ticket);
+	bool isComplete(UploadTicket ticket);
+	void waitAll();
+	// Frees command buffers and staging memory of batches the GPU has finished
+	void collect();
+
+	uint32_t getSubmitCount();
+	VkDeviceSize getStagingBytes();
+private:
+	struct StagingBlock {
+		VDeleter<VkBuffer> buffer;
+		MemoryAllocation memory;
+		uint8_t* mappedData{nullptr};
+		VkDeviceSize size{0};
+		VkDeviceSize used{0};
+
+		StagingBlock(const VDeleter<VkDevice>& device) : buffer{ device, vkDestroyBuffer } {}
+	};
+
+	struct Batch {
+		UploadTicket ticket{0};
+		VkCommandBuffer commandBuffer{VK_NULL_HANDLE};
+		VDeleter<VkFence> fence;
+		std::vector<std::unique_ptr<StagingBlock>> stagingBlocks;
+
+		// Recorded into the owner once the batch has finished
+		std::vector<VkBufferMemoryBarrier> acquireBufferBarriers;
+		std::vector<VkImageMemoryBarrier> acquireImageBarriers;
+
+		Batch(const VDeleter<VkDevice>& device) : fence{ device, vkDestroyFence } {}
+	};
+
+	struct StagingAllocation {
+		VkBuffer buffer;
+		VkDeviceSize offset;
+		uint8_t* mappedData;
+	};
+
+	VulkanAPIHandler* vulkanAPIHandler;
+	VDeleter<VkDevice> device;
+	VkQueue queue;
+	uint32_t queueFamily;
+	VkCommandPool commandPool;
+	UploadBatcher* owner;
+	// Submits and waits after every operation, which is how uploads used to work. Kept for comparison
+	bool immediateMode;
+	VkDeviceSize copyOffsetAlignment{16};
+
+	UploadTicket nextTicket{1};
+	UploadTicket completedTicket{0};
+	std::unique_ptr<Batch> recordingBatch;
+	std::vector<std::unique_ptr<Batch>> submittedBatches;
+
+	uint32_t submitCount{0};
+	VkDeviceSize stagingBytes{0};
+
+	Batch* getRecordingBatch();
+	StagingAllocation allocateStaging(VkDeviceSize size);
+	void retire(Batch* batch);
+
+	bool transfersOwnership();
+	void releaseBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+	void acquireOwnership(const std::vector<VkBufferMemoryBarrier>& bufferBarriers, const std::vector<VkImageMemoryBarrier>& imageBarriers);
+};
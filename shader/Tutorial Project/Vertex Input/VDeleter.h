@@ -1,5 +1,6 @@
 #pragma once
 #include <functional>
+#include <memory>
 
 // https://vulkan-tutorial.com/Drawing_a_triangle#page_General_structure
 // A Wrapper template that manages memory allocation for Vulkan 
@@ -20,6 +21,24 @@ public:
 		this->deleter = [&device, deletef](T obj) { deletef(device, obj, nullptr); };
 	}
 
+	// Copies would destroy the same handle twice, ownership can only be moved
+	VDeleter(const VDeleter&) = delete;
+	VDeleter& operator=(const VDeleter&) = delete;
+
+	VDeleter(VDeleter&& other) noexcept : object(other.object), deleter(std::move(other.deleter)) {
+		other.object = VK_NULL_HANDLE;
+	}
+
+	VDeleter& operator=(VDeleter&& other) noexcept {
+		if (this != std::addressof(other)) {
+			cleanup();
+			object = other.object;
+			deleter = std::move(other.deleter);
+			other.object = VK_NULL_HANDLE;
+		}
+		return *this;
+	}
+
 	~VDeleter() {
 		cleanup();
 	}
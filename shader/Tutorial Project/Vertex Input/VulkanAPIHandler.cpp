@@ -1,36 +1,77 @@
 #include "VulkanAPIHandler.h"
 
-VulkanAPIHandler::VulkanAPIHandler(GLFWwindow* GLFWwindow) {
+VulkanAPIHandler::VulkanAPIHandler(GLFWwindow* GLFWwindow, RenderSettings renderSettings) {
 	physicalDevice = VK_NULL_HANDLE;
 	window = GLFWwindow;
+	settings = renderSettings;
 
+	auto startupStart = std::chrono::high_resolution_clock::now();
 	initVulkan();
+	float startupTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - startupStart).count();
+
+	printf("Startup: %.1f ms, %u upload submissions, %llu KB staged (%s uploads)\n",
+		   startupTime,
+		   uploadBatcher->getSubmitCount(),
+		   (unsigned long long)uploadBatcher->getStagingBytes() / 1024,
+		   settings.immediateUploads ? "immediate" : "batched");
+	memoryAllocator->printStatistics();
+	meshCache->printStatistics();
+	textureCache->printStatistics();
 }
 
 
 VulkanAPIHandler::~VulkanAPIHandler() {
+	// Retiring transfer batches records acquires into the graphics batcher, so it goes first
+	if (transferBatcher != nullptr) {
+		transferBatcher->waitAll();
+	}
+	uploadBatcher->waitAll();
+
 	vkDeviceWaitIdle(device);
 	delete scene;
 }
 
 void VulkanAPIHandler::drawFrame() {
+	// Block until the GPU is done with the last frame that used this slot, so its
+	// command buffers and uniform storage can be reused. Everything the CPU does before
+	// this point overlaps with the GPU executing the previous frames.
+	auto waitStart = std::chrono::high_resolution_clock::now();
+	VkFence inFlightFence = inFlightFences[currentFrame];
+	vkWaitForFences(device, 1, &inFlightFence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+	frameStatistics.cpuWaitTime += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - waitStart).count();
+
+	collectFrameTimestamps(currentFrame);
+	scene->collectCullingStatistics(currentFrame);
+
+	// Streamed uploads that have finished are acquired by the graphics queue in its next batch
+	if (transferBatcher != nullptr) {
+		transferBatcher->flush();
+		transferBatcher->collect();
+	}
+
+	// Pending uploads have to be submitted before the frame that uses them
+	uploadBatcher->flush();
+	uploadBatcher->collect();
+
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+	vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+
+	updateUniformBuffers();
+	vkResetFences(device, 1, &inFlightFence);
+
+	// Which shadow map faces have to be rendered depends on where the lights and shadow casters are this frame
+	scene->recordOffscreenCommandBuffer(currentFrame);
+	recordCommandBuffer(currentFrame, imageIndex);
 	
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-
-	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &imageAvailableSemaphore;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &renderFinishedSemaphore;
 
-	// Offscreen rendering	
-	auto offscreenCommandBuffer = scene->getOffscreenCommandBuffer();
-	auto offscreenSemaphore = scene->getOffscreenSemaphore();
+	// Offscreen rendering. This does not touch the swap chain so it does not have to wait for the image
+	auto offscreenCommandBuffer = scene->getOffscreenCommandBuffer(currentFrame);
+	auto offscreenSemaphore = scene->getOffscreenSemaphore(currentFrame);
+	submitInfo.waitSemaphoreCount = 0;
 	submitInfo.pSignalSemaphores = &offscreenSemaphore;
 	submitInfo.pCommandBuffers = &offscreenCommandBuffer;
 
@@ -38,15 +79,25 @@ void VulkanAPIHandler::drawFrame() {
 		throw std::runtime_error("failed to submit draw command buffer!");
 	}
 
-	// Scene rendering
-	submitInfo.pWaitSemaphores = &offscreenSemaphore;
+	// Scene rendering. Waits for both the shadow maps and the swap chain image
+	VkSemaphore waitSemaphores[] = { offscreenSemaphore, imageAvailableSemaphores[currentFrame] };
+	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+	// With GPU culling the scene pass also draws from what the offscreen submission has culled
+	if (settings.gpuCulling) {
+		waitStages[0] |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+	}
+	VkSemaphore renderFinishedSemaphore = renderFinishedSemaphores[currentFrame];
+	submitInfo.waitSemaphoreCount = std::size(waitSemaphores);
+	submitInfo.pWaitSemaphores = waitSemaphores;
+	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.pSignalSemaphores = &renderFinishedSemaphore;
+	submitInfo.pCommandBuffers = &commandBuffers[currentFrame];
 
-	submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+	// The fence is signaled once both submissions of this frame have finished executing
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFence) != VK_SUCCESS) {
 		throw std::runtime_error("failed to submit draw command buffer!");
 	}
+	timestampsWritten[currentFrame] = timestampsSupported;
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -58,6 +109,8 @@ void VulkanAPIHandler::drawFrame() {
 	presentInfo.pResults = nullptr; // Optional
 
 	vkQueuePresentKHR(presentationQueue, &presentInfo);
+
+	currentFrame = (currentFrame + 1) % settings.framesInFlight;
 }
 
 void VulkanAPIHandler::updateUniformBuffers() {
@@ -66,7 +119,7 @@ void VulkanAPIHandler::updateUniformBuffers() {
 	// We are flipping the y coordinate since GLM was originally made for OpenGL
 	projection[1][1] *= -1;
 
-	scene->updateUniformBuffers(projection, view);
+	scene->updateUniformBuffers(projection, view, currentFrame);
 }
 
 void VulkanAPIHandler::update(float deltaTime) {
@@ -94,16 +147,142 @@ VkCommandPool VulkanAPIHandler::getCommandPool() {
 	return commandPool;
 }
 
+int VulkanAPIHandler::getFramesInFlight() {
+	return settings.framesInFlight;
+}
+
+RenderSettings VulkanAPIHandler::getRenderSettings() {
+	return settings;
+}
+
+VkFormat VulkanAPIHandler::getShadowMapFormat() {
+	switch (settings.shadowFormat) {
+	case SHADOW_FORMAT_D32:
+		return VK_FORMAT_D32_SFLOAT;
+	case SHADOW_FORMAT_D16:
+		return VK_FORMAT_D16_UNORM;
+	default:
+		return OFFSCREEN_FB_COLOR_FORMAT;
+	}
+}
+
+bool VulkanAPIHandler::hasDepthShadowMaps() {
+	return settings.shadowFormat != SHADOW_FORMAT_R32_DISTANCE;
+}
+
+VkFormatProperties VulkanAPIHandler::getFormatProperties(VkFormat format) {
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &formatProperties);
+	return formatProperties;
+}
+
+VkPhysicalDeviceProperties VulkanAPIHandler::getPhysicalDeviceProperties() {
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	return properties;
+}
+
+VkPhysicalDeviceMemoryProperties VulkanAPIHandler::getPhysicalDeviceMemoryProperties() {
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	return memProperties;
+}
+
+DeviceMemoryAllocator* VulkanAPIHandler::getMemoryAllocator() {
+	return memoryAllocator.get();
+}
+
+MeshCache* VulkanAPIHandler::getMeshCache() {
+	return meshCache.get();
+}
+
+TextureCache* VulkanAPIHandler::getTextureCache() {
+	return textureCache.get();
+}
+
+FrameRingBuffer* VulkanAPIHandler::getUniformRingBuffer() {
+	return uniformRingBuffer.get();
+}
+
+FrameRingBuffer* VulkanAPIHandler::getInstanceRingBuffer() {
+	return instanceRingBuffer.get();
+}
+
+UploadBatcher* VulkanAPIHandler::getUploadBatcher() {
+	return uploadBatcher.get();
+}
+
+UploadBatcher* VulkanAPIHandler::getStreamingBatcher() {
+	return transferBatcher != nullptr ? transferBatcher.get() : uploadBatcher.get();
+}
+
 void VulkanAPIHandler::handleInput(GLFWKeyEvent event) {
 	scene->handleInput(event);
 }
 
+void VulkanAPIHandler::printFrameStatistics(int numberOfFrames) {
+	printf("  CPU wait: %f ms/frame (%d frames in flight)\n", frameStatistics.cpuWaitTime / numberOfFrames, settings.framesInFlight);
+	printf("  Scene recording: %f ms/frame (%u threads)\n", frameStatistics.recordTime / numberOfFrames, commandRecorder->getThreadCount());
+	if (frameStatistics.gpuFramesMeasured > 0) {
+		printf("  GPU busy: %f ms/frame\n", frameStatistics.gpuBusyTime / frameStatistics.gpuFramesMeasured);
+		printf("  Shadow pass: %f ms/frame (%s, %s)\n", frameStatistics.shadowPassTime / frameStatistics.gpuFramesMeasured, settings.layeredShadows ? "layered" : "per face copies", scene->getShadowMapFormatName());
+	}
+	scene->printCullingStatistics();
+	scene->printDrawStatistics(numberOfFrames);
+	scene->printShadowStatistics();
+
+	frameStatistics = FrameStatistics();
+}
+
+void VulkanAPIHandler::resetFrameTimestamps(VkCommandBuffer commandBuffer, uint32_t frameIndex) {
+	if (timestampsSupported) {
+		vkCmdResetQueryPool(commandBuffer, timestampQueryPool, frameIndex * NUM_FRAME_TIMESTAMPS, NUM_FRAME_TIMESTAMPS);
+	}
+}
+
+void VulkanAPIHandler::writeFrameTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage, uint32_t frameIndex, FrameTimestamp timestamp) {
+	if (timestampsSupported) {
+		vkCmdWriteTimestamp(commandBuffer, stage, timestampQueryPool, frameIndex * NUM_FRAME_TIMESTAMPS + timestamp);
+	}
+}
+
+void VulkanAPIHandler::collectFrameTimestamps(uint32_t frameIndex) {
+	// Only called after the fence of the frame has been waited on, so the results are available
+	if (!timestampsWritten[frameIndex]) {
+		return;
+	}
+
+	std::array<uint64_t, NUM_FRAME_TIMESTAMPS> timestamps = {};
+	VkResult result = vkGetQueryPoolResults(device, 
+											timestampQueryPool, 
+											frameIndex * NUM_FRAME_TIMESTAMPS, 
+											NUM_FRAME_TIMESTAMPS, 
+											sizeof(timestamps), 
+											timestamps.data(), 
+											sizeof(uint64_t), 
+											VK_QUERY_RESULT_64_BIT);
+	if (result != VK_SUCCESS) {
+		return;
+	}
+
+	// The offscreen and scene submissions can be separated by the wait for the swap chain image, so they are measured separately
+	uint64_t shadowTicks = timestamps[TIMESTAMP_OFFSCREEN_END] - timestamps[TIMESTAMP_OFFSCREEN_BEGIN];
+	uint64_t busyTicks = shadowTicks + (timestamps[TIMESTAMP_SCENE_END] - timestamps[TIMESTAMP_SCENE_BEGIN]);
+	frameStatistics.gpuBusyTime += busyTicks * timestampPeriod / 1000000.f;
+	frameStatistics.shadowPassTime += shadowTicks * timestampPeriod / 1000000.f;
+	frameStatistics.gpuFramesMeasured++;
+}
+
 void VulkanAPIHandler::initVulkan() {
 	createInstance();
 	setupDebugCallback();
 	createSurface();
 	pickPhysicalDevice();
 	createLogicalDevice();
+
+	memoryAllocator = std::make_unique<DeviceMemoryAllocator>(this, settings.allocationStrategy);
+	meshCache = std::make_unique<MeshCache>(this);
+	textureCache = std::make_unique<TextureCache>(this);
 	
 	scene = new Scene(this);
 	scene->createRenderables();
@@ -114,23 +293,52 @@ void VulkanAPIHandler::initVulkan() {
 	createDescriptorSetLayout();
 	createGraphicsPipeline();
 	createCommandPool();
+
+	// Every setup copy and layout transition from here on is recorded into the same batch
+	QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+	uploadBatcher = std::make_unique<UploadBatcher>(this, graphicsQueue, indices.graphicsFamily, commandPool, settings.immediateUploads);
+
+	// Mesh and texture data goes through the transfer queue and overlaps with the rest of the setup
+	if (transferCommandPool != VK_NULL_HANDLE) {
+		transferBatcher = std::make_unique<UploadBatcher>(this, transferQueue, indices.transferFamily, transferCommandPool, settings.immediateUploads, uploadBatcher.get());
+	}
+
 	createDepthResources();
 	createFramebuffers();
 	createTextureImages();
-	createTextureImageViews();
 	createTextureSamplers();
 	createVertexIndexBuffers();
 	createUniformBuffers();
 
+	if (settings.gpuCulling) {
+		scene->prepareGpuCulling();
+	}
+
 	scene->prepareCubeMaps();
 
 	createDescriptorPool();
 	createDescriptorSet();
+	createTimestampQueryPool();
 	createCommandBuffers();
-	createSemaphores();
+	createSyncObjects();
+
+	uint32_t recordingThreads = settings.recordingThreads;
+	if (recordingThreads == 0) {
+		recordingThreads = std::max(1u, std::min<uint32_t>(MAX_RECORDING_THREADS, std::thread::hardware_concurrency()));
+	}
+	commandRecorder = std::make_unique<CommandRecorder>(this, indices.graphicsFamily, recordingThreads, settings.framesInFlight);
 
 	scene->prepareOffscreenFramebuffer();
-	scene->buildOffscreenCommandBuffer();
+	scene->createOffscreenCommandBuffers();
+	scene->printShadowMapStatistics();
+
+	// The first frame needs the streamed resources, this only blocks if the transfer queue is still busy
+	if (transferBatcher != nullptr) {
+		transferBatcher->waitAll();
+	}
+
+	// Nothing waits for the uploads here, the first frame is submitted after them on the same queue
+	uploadBatcher->flush();
 }
 
 void VulkanAPIHandler::createInstance() {
@@ -270,6 +478,9 @@ void VulkanAPIHandler::createLogicalDevice() {
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
 	std::set<int> uniqueQueueFamilies = { indices.graphicsFamily, indices.presentFamily };
+	if (settings.transferQueue) {
+		uniqueQueueFamilies.insert(indices.transferFamily);
+	}
 
 	// The queue priority lies between 0.0f and 1.0f
 	// Setup for the information structs for both of the queues
@@ -287,6 +498,89 @@ void VulkanAPIHandler::createLogicalDevice() {
 	VkPhysicalDeviceFeatures deviceFeatures = { };
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
 
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+	if (settings.layeredShadows && !supportedFeatures.geometryShader) {
+		printf("Geometry shaders are not supported, shadow cube maps are rendered one face at a time\n");
+		settings.layeredShadows = false;
+	}
+	deviceFeatures.geometryShader = settings.layeredShadows ? VK_TRUE : VK_FALSE;
+
+	// The atlas pipeline sends every face of a light to its own tile with gl_ViewportIndex
+	if (settings.shadowAtlas && (!settings.layeredShadows || !supportedFeatures.multiViewport)) {
+		printf("The shadow atlas needs layered shadows and multiple viewports, using the cube map array\n");
+		settings.shadowAtlas = false;
+	}
+	deviceFeatures.multiViewport = settings.shadowAtlas ? VK_TRUE : VK_FALSE;
+
+	if (settings.shadowAtlas && settings.paraboloidShadowLights != 0) {
+		printf("Dual-paraboloid shadows can not be used with the shadow atlas, all lights use cube faces\n");
+		settings.paraboloidShadowLights = 0;
+	}
+
+	// The paraboloid geometry shader clips the triangles at the edge of each half
+	if (settings.paraboloidShadowLights != 0 && (!settings.layeredShadows || !supportedFeatures.shaderClipDistance)) {
+		printf("Dual-paraboloid shadows need layered shadows and clip distances, all lights use cube maps\n");
+		settings.paraboloidShadowLights = 0;
+	}
+	deviceFeatures.shaderClipDistance = settings.paraboloidShadowLights != 0 ? VK_TRUE : VK_FALSE;
+
+	// The shadow maps of all lights are sampled from one cube map array
+	if (settings.shadowCubeMapArray && !supportedFeatures.imageCubeArray) {
+		printf("Cube map arrays are not supported, every light's shadow map is sampled as a separate cube map\n");
+		settings.shadowCubeMapArray = false;
+	}
+	deviceFeatures.imageCubeArray = settings.shadowCubeMapArray ? VK_TRUE : VK_FALSE;
+
+	// Depth-only shadow maps are rendered straight into the cube maps, there is no intermediate framebuffer to copy from
+	if (settings.shadowFormat != SHADOW_FORMAT_R32_DISTANCE && !settings.layeredShadows) {
+		printf("Depth-only shadow maps need layered shadows, using R32_SFLOAT distances\n");
+		settings.shadowFormat = SHADOW_FORMAT_R32_DISTANCE;
+	}
+
+	// D16_UNORM has to support both, D32_SFLOAT does not
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, VK_FORMAT_D32_SFLOAT, &formatProperties);
+	VkFormatFeatureFlags depthShadowFeatures = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+
+	if (settings.shadowFormat == SHADOW_FORMAT_D32 && (formatProperties.optimalTilingFeatures & depthShadowFeatures) != depthShadowFeatures) {
+		printf("D32_SFLOAT can not be used for shadow maps, using D16_UNORM\n");
+		settings.shadowFormat = SHADOW_FORMAT_D16;
+	}
+
+	// Merging the static and dynamic shadow layers blends into the 32 bit float cube maps. Depth-only maps merge with the depth test
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, OFFSCREEN_FB_COLOR_FORMAT, &formatProperties);
+	bool canMergeLayers = settings.shadowFormat != SHADOW_FORMAT_R32_DISTANCE || (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BLEND_BIT);
+
+	// Atlas tiles move between frames, a static layer per light would have to follow them
+	if (settings.staticShadowCache && (!settings.layeredShadows || !canMergeLayers || settings.shadowAtlas)) {
+		printf("Static shadow caching needs layered shadows, blending on R32_SFLOAT and no shadow atlas, shadows are rendered every frame\n");
+		settings.staticShadowCache = false;
+	}
+
+	// The culling shader runs on the graphics queue, in the same submission as the shadow passes
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	// The culling shader compacts the visible instances into a vertex buffer
+	if (settings.gpuCulling && settings.dynamicUniforms) {
+		printf("GPU culling draws from the instance vertex buffer, instances are culled on the CPU with dynamic uniforms\n");
+		settings.gpuCulling = false;
+	}
+
+	if (settings.gpuCulling && (queueFamilies[indices.graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT) == 0) {
+		printf("The graphics queue does not support compute, instances are culled on the CPU\n");
+		settings.gpuCulling = false;
+	}
+
+	if (settings.occlusionCulling && !settings.gpuCulling) {
+		printf("Occlusion culling needs GPU culling, it is turned off\n");
+		settings.occlusionCulling = false;
+	}
+
 	// Setting up device and queue info
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -316,6 +610,15 @@ void VulkanAPIHandler::createLogicalDevice() {
 	// It's good practice to setup both regardless
 	vkGetDeviceQueue(device, indices.graphicsFamily, 0, &graphicsQueue);
 	vkGetDeviceQueue(device, indices.presentFamily, 0, &presentationQueue);
+
+	if (settings.transferQueue && indices.hasDedicatedTransfer()) {
+		vkGetDeviceQueue(device, indices.transferFamily, 0, &transferQueue);
+		printf("Streaming uploads on dedicated transfer queue family %d\n", indices.transferFamily);
+	}
+	else {
+		transferQueue = graphicsQueue;
+		printf("Streaming uploads on the graphics queue\n");
+	}
 }
 
 void VulkanAPIHandler::createSurface() {
@@ -393,9 +696,12 @@ void VulkanAPIHandler::createSwapChain() {
 }
 
 void VulkanAPIHandler::createImageViews() {
-	swapChainImageViews.resize(swapChainImages.size(), VDeleter<VkImageView>{device, vkDestroyImageView});
+	// The device is idle when the swap chain is recreated, the old views can go
+	swapChainImageViews.clear();
+	swapChainImageViews.reserve(swapChainImages.size());
 	
 	for (uint32_t i = 0; i < swapChainImages.size(); i++) {
+		swapChainImageViews.emplace_back(VDeleter<VkImageView>{ device, vkDestroyImageView });
 		createImageView(swapChainImages[i], swapChainImageFormat, VK_IMAGE_ASPECT_COLOR_BIT, swapChainImageViews[i]);
 	}
 }
@@ -444,10 +750,11 @@ void VulkanAPIHandler::createRenderPass() {
 	VkSubpassDependency dependency = {};
 	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
 	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	// With several frames in flight the depth buffer is shared, so the previous frame's depth writes have to finish as well
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
 	std::array<VkAttachmentDescription, NUM_ATTACHMENTS> attachments = { colorAttachment, depthAttachment };
 	VkRenderPassCreateInfo renderPassInfo = {};
@@ -471,8 +778,9 @@ void VulkanAPIHandler::createDescriptorSetLayout() {
 }
 
 void VulkanAPIHandler::createGraphicsPipeline() {
-	auto vertShaderCode = ShaderHandler::readFile("Shaders/vert.spv");
-	auto fragShaderCode = ShaderHandler::readFile("Shaders/frag.spv");
+	auto vertShaderCode = ShaderHandler::readFile(settings.dynamicUniforms ? "Shaders/vertDynamic.spv" : "Shaders/vert.spv");
+	// Without cube map arrays the shadow maps are an array of cube map descriptors
+	auto fragShaderCode = ShaderHandler::readFile(settings.shadowCubeMapArray ? "Shaders/frag.spv" : "Shaders/fragCubeMaps.spv");
 
 	VDeleter<VkShaderModule> vertShaderModule{ device, vkDestroyShaderModule };
 	VDeleter<VkShaderModule> fragShaderModule{ device, vkDestroyShaderModule };
@@ -487,23 +795,44 @@ void VulkanAPIHandler::createGraphicsPipeline() {
 	vertShaderStageInfo.pName = "main";
 	//vertShaderStageInfo.pSpecializationInfo allows you to specify values for shader constants
 
+	// Depth-only shadow maps store the distance to the light divided by Z_FAR
+	float shadowDistanceScale = hasDepthShadowMaps() ? Z_FAR : 1.f;
+
+	VkSpecializationMapEntry specializationEntry = {};
+	specializationEntry.constantID = 0;
+	specializationEntry.offset = 0;
+	specializationEntry.size = sizeof(float);
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = 1;
+	specializationInfo.pMapEntries = &specializationEntry;
+	specializationInfo.dataSize = sizeof(float);
+	specializationInfo.pData = &shadowDistanceScale;
+
 	VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
 	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
 	fragShaderStageInfo.module = fragShaderModule;
 	fragShaderStageInfo.pName = "main";
+	fragShaderStageInfo.pSpecializationInfo = &specializationInfo;
 
 	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
 
-	// Setting up vertex input
+	// Setting up vertex input. Binding 0 is the mesh, binding 1 the instance buffer. With dynamic uniforms the
+	// instances are read from the renderable descriptor set, only the mesh attributes at the front are used
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = { Vertex::getBindingDescription(), InstanceData::getBindingDescription() };
+	auto vertexAttributeDescriptions = Vertex::getAttributeDescriptions();
+	auto instanceAttributeDescriptions = InstanceData::getAttributeDescriptions();
+
+	std::array<VkVertexInputAttributeDescription, NUM_VERTEX_ATTRIBUTES + NUM_INSTANCE_ATTRIBUTES> attributeDescriptions = {};
+	std::copy(vertexAttributeDescriptions.begin(), vertexAttributeDescriptions.end(), attributeDescriptions.begin());
+	std::copy(instanceAttributeDescriptions.begin(), instanceAttributeDescriptions.end(), attributeDescriptions.begin() + NUM_VERTEX_ATTRIBUTES);
 
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.vertexBindingDescriptionCount = settings.dynamicUniforms ? 1 : bindingDescriptions.size();
+	vertexInputInfo.vertexAttributeDescriptionCount = settings.dynamicUniforms ? NUM_VERTEX_ATTRIBUTES : attributeDescriptions.size();
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
 	// Setting up input assembly
@@ -654,9 +983,12 @@ void VulkanAPIHandler::createGraphicsPipeline() {
 }
 
 void VulkanAPIHandler::createFramebuffers() {
-	swapChainFramebuffers.resize(swapChainImageViews.size(), VDeleter<VkFramebuffer>{device, vkDestroyFramebuffer});
+	swapChainFramebuffers.clear();
+	swapChainFramebuffers.reserve(swapChainImageViews.size());
 
 	for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+		swapChainFramebuffers.emplace_back(VDeleter<VkFramebuffer>{ device, vkDestroyFramebuffer });
+
 		std::array<VkImageView, NUM_ATTACHMENTS> attachments = {
 			swapChainImageViews[i],
 			depthImageView
@@ -683,11 +1015,24 @@ void VulkanAPIHandler::createCommandPool() {
 	VkCommandPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-	poolInfo.flags = 0; // Optional
+	// The offscreen command buffers are recorded again every frame
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
 	if (vkCreateCommandPool(device, &poolInfo, nullptr, commandPool.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create command pool!");
 	}
+
+	if (!settings.transferQueue || !queueFamilyIndices.hasDedicatedTransfer()) {
+		return;
+	}
+
+	// Command buffers of the transfer queue are recorded once and freed after the batch has finished
+	poolInfo.queueFamilyIndex = queueFamilyIndices.transferFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, transferCommandPool.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create transfer command pool!");
+	}
 }
 
 void VulkanAPIHandler::createDepthResources() {
@@ -702,21 +1047,14 @@ void VulkanAPIHandler::createTextureImages() {
 	scene->createTextureImages();
 }
 
-void VulkanAPIHandler::createTextureImageViews() {
-	scene->createTextureImageViews();
-}
-
 void VulkanAPIHandler::createTextureSamplers() {
 	scene->createTextureSamplers();
 }
 
 void VulkanAPIHandler::createCommandBuffers() {
-	if (commandBuffers.size() > 0) {
-		vkFreeCommandBuffers(device, commandPool, commandBuffers.size(), commandBuffers.data());
-	}
+	// Every frame in flight binds its own descriptor sets, so it needs its own command buffer
+	commandBuffers.resize(settings.framesInFlight);
 
-	commandBuffers.resize(swapChainFramebuffers.size());
-	
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = commandPool;
@@ -726,54 +1064,71 @@ void VulkanAPIHandler::createCommandBuffers() {
 	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to allocate command buffers!");
 	}
+}
 
-	for (size_t i = 0; i < commandBuffers.size(); i++) {
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		beginInfo.pInheritanceInfo = nullptr; // Optional
+// Called every frame once the fence of the frame has been waited on. The draws are split over the recording
+// threads, the primary command buffer only begins the render pass and executes their secondary command buffers
+void VulkanAPIHandler::recordCommandBuffer(uint32_t frameIndex, uint32_t imageIndex) {
+	auto recordStart = std::chrono::high_resolution_clock::now();
+	VkCommandBuffer commandBuffer = commandBuffers[frameIndex];
+	bool useSecondaries = commandRecorder->getThreadCount() > 1;
 
-		vkBeginCommandBuffer(commandBuffers[i], &beginInfo);
+	// Each range binds everything itself, secondary command buffers do not inherit any state
+	RecordRangeFunction recordBatches = [this, frameIndex](VkCommandBuffer rangeCommandBuffer, uint32_t firstBatch, uint32_t batchCount) {
+		vkCmdBindPipeline(rangeCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapChainFramebuffers[i];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = swapChainExtent;
+		// Binding buffers for renderables and scene
+		VkDescriptorSet sceneDescSet = scene->getDescriptorSet(frameIndex);
+		vkCmdBindDescriptorSets(rangeCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, SCENE_UBO, 1, &sceneDescSet, 0, nullptr);
 
-		std::array<VkClearValue, NUM_ATTACHMENTS> clearValues = {};
-		clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-		clearValues[1].depthStencil = { 1.0f, 0 };
+		scene->drawSceneBatches(rangeCommandBuffer, pipelineLayout, frameIndex, firstBatch, batchCount);
+	};
 
-		renderPassInfo.clearValueCount = clearValues.size();
-		renderPassInfo.pClearValues = clearValues.data();
+	// Secondary command buffers have to be recorded before the primary executes them, but they can be recorded
+	// while the primary is not being recorded yet
+	std::vector<VkCommandBuffer> secondaryCommandBuffers;
+	if (useSecondaries) {
+		secondaryCommandBuffers = commandRecorder->record(frameIndex, renderPass, swapChainFramebuffers[imageIndex], scene->getNumInstanceBatches(), recordBatches);
+	}
 
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-		// Binding buffers for renderables and scene
-		VkDescriptorSet sceneDescSet = scene->getDescriptorSet();
-		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, SCENE_UBO, 1, &sceneDescSet, 0, nullptr);
-		
-		VkDeviceSize offsets[] = { 0 };
-		for (auto& renderable : scene->getRenderableObjects()) {
-			VkBuffer currentVertexBuffer[] = { renderable.second->getVertexBuffer() };
-			VkDescriptorSet currentDescriptorSet = renderable.second->getDescriptorSet();
-
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, currentVertexBuffer, offsets);
-			vkCmdBindIndexBuffer(commandBuffers[i], renderable.second->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, RENDERABLE_UBO, 1, &currentDescriptorSet, 0, nullptr);
-
-			vkCmdDrawIndexed(commandBuffers[i], renderable.second->numIndices(), 1, 0, 0, 0);
-		}
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	writeFrameTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, frameIndex, TIMESTAMP_SCENE_BEGIN);
 
-		vkCmdEndRenderPass(commandBuffers[i]);
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = swapChainExtent;
 
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
-			throw std::runtime_error("failed to record command buffer!");
-		}
+	std::array<VkClearValue, NUM_ATTACHMENTS> clearValues = {};
+	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	renderPassInfo.clearValueCount = clearValues.size();
+	renderPassInfo.pClearValues = clearValues.data();
+
+	if (useSecondaries) {
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		vkCmdExecuteCommands(commandBuffer, secondaryCommandBuffers.size(), secondaryCommandBuffers.data());
 	}
+	else {
+		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+		recordBatches(commandBuffer, 0, scene->getNumInstanceBatches());
+	}
+
+	vkCmdEndRenderPass(commandBuffer);
+	writeFrameTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, frameIndex, TIMESTAMP_SCENE_END);
+
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record command buffer!");
+	}
+
+	frameStatistics.recordTime += std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - recordStart).count();
 }
 
 void VulkanAPIHandler::createVertexIndexBuffers() {
@@ -781,29 +1136,49 @@ void VulkanAPIHandler::createVertexIndexBuffers() {
 }
 
 void VulkanAPIHandler::createUniformBuffers() {
+	// The scene and the renderables reserve their slots first, then the whole buffer is allocated at once
+	uniformRingBuffer = std::make_unique<FrameRingBuffer>(this, settings.framesInFlight);
+	// The culling shader reads the instances as a storage buffer, the vertex shaders read them as uniforms with dynamic uniforms
+	VkBufferUsageFlags instanceUsage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | (settings.gpuCulling ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0);
+	if (settings.dynamicUniforms) {
+		instanceUsage |= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	}
+	instanceRingBuffer = std::make_unique<FrameRingBuffer>(this, settings.framesInFlight, instanceUsage);
 	scene->createUniformBuffers();
+	uniformRingBuffer->create();
+	instanceRingBuffer->create();
 }
 
 void VulkanAPIHandler::createDescriptorPool() {
-	std::array<VkDescriptorPoolSize, 3> poolSizes = {};
+	std::vector<VkDescriptorPoolSize> poolSizes(2);
+	// The scene descriptor set exists once per frame in flight
+	uint32_t numFrames = settings.framesInFlight;
+	// This only depends on the number of textures, not on the number of objects
+	uint32_t numRenderableSets = scene->getNumRenderableDescriptorSets();
 	
-	// General Uniform buffer containing matrices. The scene also has one of these so +1
+	// Scene uniform buffer
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = scene->getRenderableObjects().size() + 1;
+	poolSizes[0].descriptorCount = numFrames;
 	
-	// Texture sampler, used for shadow cube map as well
+	// Texture sampler, used for the shadow cube map array, its paraboloid view and the shadow atlas as well.
+	// Without cube map arrays every light has a cube map descriptor of its own
+	uint32_t numShadowCubeMaps = settings.shadowCubeMapArray ? 1 : NUM_LIGHTS;
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = scene->getRenderableObjects().size() + NUM_LIGHTS;
-	
-	// Material buffer
-	poolSizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[2].descriptorCount = scene->getRenderableObjects().size();
+	poolSizes[1].descriptorCount = numRenderableSets + (numShadowCubeMaps + 2) * numFrames;
+
+	// The instance array of every shared renderable set
+	if (settings.dynamicUniforms) {
+		VkDescriptorPoolSize instancePoolSize = {};
+		instancePoolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+		instancePoolSize.descriptorCount = numRenderableSets;
+		poolSizes.push_back(instancePoolSize);
+	}
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = poolSizes.size();
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = scene->getRenderableObjects().size() + 1;
+	poolInfo.maxSets = numRenderableSets + numFrames;
 
 	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, descriptorPool.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create descriptor pool!");
@@ -814,14 +1189,65 @@ void VulkanAPIHandler::createDescriptorSet() {
 	scene->createDescriptorSets(descriptorPool);
 }
 
-void VulkanAPIHandler::createSemaphores() {
+void VulkanAPIHandler::createSyncObjects() {
+	imageAvailableSemaphores.reserve(settings.framesInFlight);
+	renderFinishedSemaphores.reserve(settings.framesInFlight);
+	inFlightFences.reserve(settings.framesInFlight);
+
+	for (int i = 0; i < settings.framesInFlight; i++) {
+		imageAvailableSemaphores.emplace_back(VDeleter<VkSemaphore>{ device, vkDestroySemaphore });
+		renderFinishedSemaphores.emplace_back(VDeleter<VkSemaphore>{ device, vkDestroySemaphore });
+		inFlightFences.emplace_back(VDeleter<VkFence>{ device, vkDestroyFence });
+	}
+
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, imageAvailableSemaphore.replace()) != VK_SUCCESS ||
-		vkCreateSemaphore(device, &semaphoreInfo, nullptr, renderFinishedSemaphore.replace()) != VK_SUCCESS) {
+	// The fences start signaled so the first wait on every frame returns immediately
+	VkFenceCreateInfo fenceInfo = {};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+	for (int i = 0; i < settings.framesInFlight; i++) {
+		if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, imageAvailableSemaphores[i].replace()) != VK_SUCCESS ||
+			vkCreateSemaphore(device, &semaphoreInfo, nullptr, renderFinishedSemaphores[i].replace()) != VK_SUCCESS) {
+
+			throw std::runtime_error("failed to create semaphores!");
+		}
 
-		throw std::runtime_error("failed to create semaphores!");
+		if (vkCreateFence(device, &fenceInfo, nullptr, inFlightFences[i].replace()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create fences!");
+		}
+	}
+}
+
+void VulkanAPIHandler::createTimestampQueryPool() {
+	timestampsWritten.assign(settings.framesInFlight, false);
+
+	// Timestamps are optional. Queues reporting zero valid bits cannot write them
+	QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	timestampsSupported = queueFamilies[indices.graphicsFamily].timestampValidBits > 0;
+	timestampPeriod = properties.limits.timestampPeriod;
+
+	if (!timestampsSupported) {
+		return;
+	}
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = settings.framesInFlight * NUM_FRAME_TIMESTAMPS;
+
+	if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, timestampQueryPool.replace()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create timestamp query pool!");
 	}
 }
 
@@ -845,10 +1271,9 @@ void VulkanAPIHandler::recreateSwapChain() {
 	createGraphicsPipeline();
 	createDepthResources();
 	createFramebuffers();
-	createCommandBuffers();
 }
 
-VkCommandBuffer VulkanAPIHandler::beginSingleTimeCommands(bool startRecording) {
+VkCommandBuffer VulkanAPIHandler::allocateCommandBuffer() {
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -856,39 +1281,15 @@ VkCommandBuffer VulkanAPIHandler::beginSingleTimeCommands(bool startRecording) {
 	allocInfo.commandBufferCount = 1;
 
 	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-	if (startRecording) {
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-		vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate command buffer!");
 	}
 
 	return commandBuffer;
 }
 
-void VulkanAPIHandler::endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-	vkEndCommandBuffer(commandBuffer);
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
-
-	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(graphicsQueue);
-
-	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
-}
-
 void VulkanAPIHandler::transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int subResourceLayerCount, bool hasDepthStencilBit) {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	transitionImageLayoutCore(image, format, oldLayout, newLayout, commandBuffer, subResourceLayerCount, hasDepthStencilBit);
-
-	endSingleTimeCommands(commandBuffer);
+	uploadBatcher->transitionImageLayout(image, format, oldLayout, newLayout, subResourceLayerCount, hasDepthStencilBit);
 }
 
 void VulkanAPIHandler::transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int subResourceLayerCount, bool hasDepthStencilBit) {
@@ -951,6 +1352,10 @@ bool VulkanAPIHandler::hasStencilComponent(VkFormat format) {
 	return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 }
 
+bool VulkanAPIHandler::hasDepthComponent(VkFormat format) {
+	return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_D32_SFLOAT || hasStencilComponent(format);
+}
+
 VulkanAPIHandler::QueueFamilyIndices VulkanAPIHandler::findQueueFamilies(VkPhysicalDevice device) {
 	QueueFamilyIndices indices;
 
@@ -981,6 +1386,20 @@ VulkanAPIHandler::QueueFamilyIndices VulkanAPIHandler::findQueueFamilies(VkPhysi
 		i++;
 	}
 
+	// A family that can only transfer usually maps to the DMA engines, which copy without taking time from rendering
+	for (i = 0; i < (int)queueFamilies.size(); i++) {
+		VkQueueFlags flags = queueFamilies[i].queueFlags;
+
+		if (queueFamilies[i].queueCount > 0 && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+			indices.transferFamily = i;
+			break;
+		}
+	}
+
+	if (indices.transferFamily < 0) {
+		indices.transferFamily = indices.graphicsFamily;
+	}
+
 	return indices;
 }
 
@@ -1049,6 +1468,10 @@ void VulkanAPIHandler::transitionImageLayoutCore(VkImage image, VkFormat format,
 		barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT;
 		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 	}
+	else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	}
 	else if (oldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
 		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
@@ -1079,19 +1502,21 @@ void VulkanAPIHandler::transitionImageLayoutCore(VkImage image, VkFormat format,
 		throw std::invalid_argument("unsupported layout transition!");
 	}
 
-	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+	if (newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
+		if (barrier.srcAccessMask == 0) {
+			//barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+		}
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	}
+
+	// Depth images, including depth-only shadow maps that are sampled and copied
+	if (newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL || hasDepthComponent(format)) {
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
 
 		if (hasStencilComponent(format) || hasDepthStencilBit) {
 			barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
 		}
 	}
-	else if (newLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) {
-		if (barrier.srcAccessMask == 0) {
-			//barrier.srcAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-		}
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-	}
 	else {
 		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 	}
@@ -1124,7 +1549,7 @@ void VulkanAPIHandler::createBuffer(
 	VkBufferUsageFlags usage, 
 	VkMemoryPropertyFlags properties, 
 	VDeleter<VkBuffer>& buffer, 
-	VDeleter<VkDeviceMemory>& bufferMemory) {
+	MemoryAllocation& bufferMemory) {
 	
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1139,71 +1564,10 @@ void VulkanAPIHandler::createBuffer(
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	// NOTE: You are not supposed to call this for every individual buffer due to limitations on the amount of memory allocations you can do.
-	// The right way to allocate memory for a large number of objects is to create a custom allocator 
-	// that splits up a single allocation among many different objects by using the offset parameters that we've seen in many functions.
-	if (vkAllocateMemory(device, &allocInfo, nullptr, bufferMemory.replace()) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate buffer memory!");
-	}
-
-	vkBindBufferMemory(device, buffer, bufferMemory, 0);
-}
-
-void VulkanAPIHandler::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	VkBufferCopy copyRegion = {};
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-	endSingleTimeCommands(commandBuffer);
-}
-
-void VulkanAPIHandler::copyImage(VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height) {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	// Specifying which part of the image needs to be copied to which part of the other image.
-	VkImageSubresourceLayers subResource = {};
-	subResource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	subResource.baseArrayLayer = 0;
-	subResource.mipLevel = 0;
-	subResource.layerCount = 1;
-
-	VkImageCopy region = {};
-	region.srcSubresource = subResource;
-	region.dstSubresource = subResource;
-	region.srcOffset = { 0, 0, 0 };
-	region.dstOffset = { 0, 0, 0 };
-	region.extent.width = width;
-	region.extent.height = height;
-	region.extent.depth = 1;
-	
-	vkCmdCopyImage(
-		commandBuffer,
-		srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-		dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1, &region
-	);
-
-	endSingleTimeCommands(commandBuffer);
-}
-
-void VulkanAPIHandler::copyImage(VkImage srcImage, VkImage dstImage, VkImageCopy copyRegion) {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-	vkCmdCopyImage(
-		commandBuffer,
-		srcImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-		dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		1, &copyRegion
-	);
+	// The buffer gets a range of a larger block instead of an allocation of its own
+	memoryAllocator->allocate(memRequirements, properties, true, bufferMemory);
 
-	endSingleTimeCommands(commandBuffer);
+	vkBindBufferMemory(device, buffer, bufferMemory.getMemory(), bufferMemory.getOffset());
 }
 
 void VulkanAPIHandler::createImage(uint32_t width, uint32_t height, 
@@ -1212,7 +1576,7 @@ void VulkanAPIHandler::createImage(uint32_t width, uint32_t height,
 								   VkImageUsageFlags usage, 
 								   VkMemoryPropertyFlags properties, 
 								   VDeleter<VkImage>& image, 
-								   VDeleter<VkDeviceMemory>& imageMemory) {
+								   MemoryAllocation& imageMemory) {
 	VkImageCreateInfo imageInfo = {};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	imageInfo.imageType = VK_IMAGE_TYPE_2D;
@@ -1235,19 +1599,12 @@ void VulkanAPIHandler::createImage(uint32_t width, uint32_t height,
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device, &allocInfo, nullptr, imageMemory.replace()) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
+	memoryAllocator->allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR, imageMemory);
 
-	vkBindImageMemory(device, image, imageMemory, 0);
+	vkBindImageMemory(device, image, imageMemory.getMemory(), imageMemory.getOffset());
 }
 
-void VulkanAPIHandler::createImage(VkImageCreateInfo imageInfo, VkMemoryPropertyFlags properties, VDeleter<VkImage>& image, VDeleter<VkDeviceMemory>& imageMemory) {
+void VulkanAPIHandler::createImage(VkImageCreateInfo imageInfo, VkMemoryPropertyFlags properties, VDeleter<VkImage>& image, MemoryAllocation& imageMemory) {
 	if (vkCreateImage(device, &imageInfo, nullptr, image.replace()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create image!");
 	}
@@ -1255,19 +1612,12 @@ void VulkanAPIHandler::createImage(VkImageCreateInfo imageInfo, VkMemoryProperty
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+	memoryAllocator->allocate(memRequirements, properties, imageInfo.tiling == VK_IMAGE_TILING_LINEAR, imageMemory);
 
-	if (vkAllocateMemory(device, &allocInfo, nullptr, imageMemory.replace()) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
-
-	vkBindImageMemory(device, image, imageMemory, 0);
+	vkBindImageMemory(device, image, imageMemory.getMemory(), imageMemory.getOffset());
 }
 
-void VulkanAPIHandler::createImage(VkImageCreateInfo imageInfo, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+void VulkanAPIHandler::createImage(VkImageCreateInfo imageInfo, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory) {
 	if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create image!");
 	}
@@ -1275,16 +1625,9 @@ void VulkanAPIHandler::createImage(VkImageCreateInfo imageInfo, VkMemoryProperty
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
+	memoryAllocator->allocate(memRequirements, properties, imageInfo.tiling == VK_IMAGE_TILING_LINEAR, imageMemory);
 
-	vkBindImageMemory(device, image, imageMemory, 0);
+	vkBindImageMemory(device, image, imageMemory.getMemory(), imageMemory.getOffset());
 }
 
 VkSurfaceFormatKHR VulkanAPIHandler::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
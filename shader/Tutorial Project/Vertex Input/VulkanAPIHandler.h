@@ -28,6 +28,12 @@
 #include "ShaderHandler.h"
 #include "Structs.h"
 #include "Scene.h"
+#include "FrameRingBuffer.h"
+#include "UploadBatcher.h"
+#include "CommandRecorder.h"
+#include "DeviceMemoryAllocator.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
 
 /*
 const std::vector<Vertex> vertices = {
@@ -52,17 +58,35 @@ const std::vector<uint16_t> indices = {
 // Class primarily consisting of snippets from https://vulkan-tutorial.com
 class VulkanAPIHandler {
 public:
-	VulkanAPIHandler(GLFWwindow* GLFWwindow);
+	VulkanAPIHandler(GLFWwindow* GLFWwindow, RenderSettings renderSettings);
 	~VulkanAPIHandler();
 	void drawFrame(); 
-	void updateUniformBuffers();
 	void update(float deltaTime);
+	void printFrameStatistics(int numberOfFrames);
 	static void onWindowResized(GLFWwindow* window, int width, int height);
 	VulkanAPIHandler* getPtr();
 	VkDevice getDevice();
 	VkCommandPool getCommandPool();
+	int getFramesInFlight();
+	RenderSettings getRenderSettings();
+	// Format of the shadow cube maps for the shadow format in the settings
+	VkFormat getShadowMapFormat();
+	bool hasDepthShadowMaps();
+	VkFormatProperties getFormatProperties(VkFormat format);
+	VkPhysicalDeviceProperties getPhysicalDeviceProperties();
+	VkPhysicalDeviceMemoryProperties getPhysicalDeviceMemoryProperties();
+	DeviceMemoryAllocator* getMemoryAllocator();
+	MeshCache* getMeshCache();
+	TextureCache* getTextureCache();
+	FrameRingBuffer* getUniformRingBuffer();
+	FrameRingBuffer* getInstanceRingBuffer();
+	UploadBatcher* getUploadBatcher();
+	UploadBatcher* getStreamingBatcher();
 	void handleInput(GLFWKeyEvent event);
 
+	void resetFrameTimestamps(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	void writeFrameTimestamp(VkCommandBuffer commandBuffer, VkPipelineStageFlagBits stage, uint32_t frameIndex, FrameTimestamp timestamp);
+
 	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int subResourceLayerCount = 1, bool hasDepthStencilBit = false);
 	void transitionImageLayout(VkCommandBuffer commandBuffer, VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, int subResourceLayerCount = 1, bool hasDepthStencilBit = false);
 	void createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, VDeleter<VkImageView>& imageView);
@@ -74,8 +98,7 @@ public:
 		VkBufferUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VDeleter<VkBuffer>& buffer,
-		VDeleter<VkDeviceMemory>& bufferMemory);
-	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+		MemoryAllocation& bufferMemory);
 
 	void createImage(
 		uint32_t width,
@@ -85,25 +108,22 @@ public:
 		VkImageUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VDeleter<VkImage>& image,
-		VDeleter<VkDeviceMemory>& imageMemory);
+		MemoryAllocation& imageMemory);
 	void createImage(
 		VkImageCreateInfo imageInfo,
 		VkMemoryPropertyFlags properties,
 		VDeleter<VkImage>& image,
-		VDeleter<VkDeviceMemory>& imageMemory);
+		MemoryAllocation& imageMemory);
 	void createImage(
 		VkImageCreateInfo imageInfo,
 		VkMemoryPropertyFlags properties,
 		VkImage& image,
-		VkDeviceMemory& imageMemory);
-	void copyImage(VkImage srcImage, VkImage dstImage, uint32_t width, uint32_t height);
-	void copyImage(VkImage srcImage, VkImage dstImage, VkImageCopy copyRegion);
+		MemoryAllocation& imageMemory);
 
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 	VkFormat findDepthFormat();
 
-	VkCommandBuffer beginSingleTimeCommands(bool startRecording = true);
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+	VkCommandBuffer allocateCommandBuffer();
 
 	void createShaderModule(const std::vector<char>& code, VDeleter<VkShaderModule>& shaderModule);
 private:
@@ -131,10 +151,16 @@ private:
 	struct QueueFamilyIndices {
 		int graphicsFamily = -1;
 		int presentFamily = -1;
+		// Falls back to the graphics family if there is no transfer only family
+		int transferFamily = -1;
 
 		bool isComplete() {
 			return graphicsFamily >= 0 && presentFamily >= 0;
 		}
+
+		bool hasDedicatedTransfer() {
+			return transferFamily >= 0 && transferFamily != graphicsFamily;
+		}
 	};
 
 	struct SwapChainSupportDetails {
@@ -149,6 +175,7 @@ private:
 
 	Scene* scene;
 	GLFWwindow* window;
+	RenderSettings settings;
 
 	VDeleter<VkInstance> instance{ vkDestroyInstance };
 	VDeleter<VkDebugReportCallbackEXT> callback{ instance, DestroyDebugReportCallbackEXT };
@@ -159,8 +186,17 @@ private:
 	VkPhysicalDevice physicalDevice;
 	VDeleter<VkDevice> device{ vkDestroyDevice };
 
+	// Declared right after the device so every resource is destroyed before its memory blocks
+	std::unique_ptr<DeviceMemoryAllocator> memoryAllocator;
+
+	// Models shared between renderables. Only holds weak references, the renderables own the meshes
+	std::unique_ptr<MeshCache> meshCache;
+	// Textures shared between renderables, and the samplers they use
+	std::unique_ptr<TextureCache> textureCache;
+
 	VkQueue graphicsQueue;
 	VkQueue presentationQueue;
+	VkQueue transferQueue;
 
 	VDeleter<VkSwapchainKHR> swapChain{ device, vkDestroySwapchainKHR };
 	std::vector<VkImage> swapChainImages;
@@ -174,15 +210,39 @@ private:
 	VDeleter<VkPipeline> graphicsPipeline{ device, vkDestroyPipeline };
 
 	VDeleter<VkCommandPool> commandPool{ device, vkDestroyCommandPool };
+	VDeleter<VkCommandPool> transferCommandPool{ device, vkDestroyCommandPool };
+	// One per frame in flight, recorded again every frame for the swap chain image that was acquired
 	std::vector<VkCommandBuffer> commandBuffers;
+	// Records the draws of the scene pass into secondary command buffers on worker threads
+	std::unique_ptr<CommandRecorder> commandRecorder;
+
+	// Records setup uploads and layout transitions into batches on the graphics queue
+	std::unique_ptr<UploadBatcher> uploadBatcher;
+	// Only exists with a dedicated transfer queue. Hands ownership of its uploads to uploadBatcher
+	std::unique_ptr<UploadBatcher> transferBatcher;
 
 	VDeleter<VkDescriptorPool> descriptorPool{ device, vkDestroyDescriptorPool };
 
-	VDeleter<VkSemaphore> imageAvailableSemaphore{ device, vkDestroySemaphore };
-	VDeleter<VkSemaphore> renderFinishedSemaphore{ device, vkDestroySemaphore };
+	// Holds the per frame uniforms of the scene
+	std::unique_ptr<FrameRingBuffer> uniformRingBuffer;
+	// Per-instance model matrices, colours and materials, rewritten every frame
+	std::unique_ptr<FrameRingBuffer> instanceRingBuffer;
+
+	// Synchronization objects, one of each per frame in flight
+	uint32_t currentFrame{0};
+	std::vector<VDeleter<VkSemaphore>> imageAvailableSemaphores;
+	std::vector<VDeleter<VkSemaphore>> renderFinishedSemaphores;
+	std::vector<VDeleter<VkFence>> inFlightFences;
+
+	// GPU timing. Each frame in flight owns NUM_FRAME_TIMESTAMPS consecutive queries
+	VDeleter<VkQueryPool> timestampQueryPool{ device, vkDestroyQueryPool };
+	bool timestampsSupported{false};
+	float timestampPeriod{1.f};
+	std::vector<bool> timestampsWritten;
+	FrameStatistics frameStatistics;
 
 	VDeleter<VkImage> depthImage{ device, vkDestroyImage };
-	VDeleter<VkDeviceMemory> depthImageMemory{ device, vkFreeMemory };
+	MemoryAllocation depthImageMemory;
 	VDeleter<VkImageView> depthImageView{ device, vkDestroyImageView };
 
 
@@ -207,17 +267,21 @@ private:
 	void createCommandPool();
 	void createDepthResources();
 	void createTextureImages();
-	void createTextureImageViews();
 	void createTextureSamplers();
 	void createCommandBuffers();
+	void recordCommandBuffer(uint32_t frameIndex, uint32_t imageIndex);
 	void createVertexIndexBuffers();
 	void createUniformBuffers();
 	void createDescriptorPool();
 	void createDescriptorSet();
-	void createSemaphores();
+	void createSyncObjects();
+	void createTimestampQueryPool();
+	void collectFrameTimestamps(uint32_t frameIndex);
+	void updateUniformBuffers();
 	void recreateSwapChain();
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 	bool hasStencilComponent(VkFormat format);
+	bool hasDepthComponent(VkFormat format);
 
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
 	SwapChainSupportDetails querySwapChainSupport(VkPhysicalDevice device);
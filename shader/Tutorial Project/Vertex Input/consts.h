@@ -3,12 +3,73 @@ const int WINDOW_WIDTH = 1280;
 const int WINDOW_HEIGHT = 720;
 
 const int NUM_VERTEX_ATTRIBUTES = 4;
+// Model matrix (four columns), colour and material
+const int NUM_INSTANCE_ATTRIBUTES = 6;
+// With dynamic uniforms the instances are one uniform array. Has to match MAX_UNIFORM_INSTANCES in the vertex shaders
+const int MAX_UNIFORM_INSTANCES = 128;
 const int NUM_ATTACHMENTS = 2;
 
 const int NUM_LIGHTS = 4;
 const int NUM_GHOSTS = 3;
 
 const int NUM_CUBE_FACES = 6;
+// One bit per cube map face
+const uint32_t ALL_CUBE_FACES = (1 << NUM_CUBE_FACES) - 1;
+// Analytic wall shadows pass the maze walls in the scene UBO. Has to match fragmentShader.frag
+const int MAX_ANALYTIC_WALLS = 32;
+
+// Dual-paraboloid shadow maps split the sphere around the light at its horizontal plane
+const int NUM_PARABOLOID_HALVES = 2;
+const uint32_t ALL_PARABOLOID_HALVES = (1 << NUM_PARABOLOID_HALVES) - 1;
+
+// The shadow cube maps of all lights are the layers of one cube map array, light by light
+const int NUM_SHADOW_MAP_LAYERS = NUM_LIGHTS * NUM_CUBE_FACES;
+
+// GPU culling tests every instance against the camera and one view per shadow map layer. Has to match cullInstances.comp
+const int NUM_CULLING_VIEWS = 1 + NUM_SHADOW_MAP_LAYERS;
+const uint32_t CAMERA_CULLING_VIEW = 0;
+const uint32_t CULLING_WORKGROUP_SIZE = 64;
+
+// Occlusion culling renders the static occluders into a depth image of this size and reduces it into a pyramid of
+// the farthest depth per texel. Powers of two, so every level halves the previous one. Has to match depthPyramid.comp
+const uint32_t DEPTH_PYRAMID_WIDTH = 512;
+const uint32_t DEPTH_PYRAMID_HEIGHT = 256;
+const uint32_t DEPTH_PYRAMID_WORKGROUP_SIZE = 8;
+
+// Fields of the draw sort keys of RenderQueue, from the most to the least significant bits. They add up to 64
+const uint32_t SORT_KEY_PIPELINE_BITS = 4;
+const uint32_t SORT_KEY_MATERIAL_BITS = 12;
+const uint32_t SORT_KEY_MESH_BITS = 12;
+const uint32_t SORT_KEY_DEPTH_BITS = 16;
+const uint32_t SORT_KEY_ITEM_BITS = 20;
+
+// The shadow atlas is one square 2D image. Faces get tiles of CUBE_MAP_TEX_DIM halved once per level,
+// a light drops a level for every SHADOW_ATLAS_LEVEL_DISTANCE it is away from the camera
+const uint32_t SHADOW_ATLAS_DIM = 4096;
+const uint32_t SHADOW_ATLAS_LEVELS = 4;
+const float SHADOW_ATLAS_LEVEL_DISTANCE = 250.f;
+// How far a light has to move past a level boundary before its tiles change size again
+const float SHADOW_ATLAS_HYSTERESIS = 0.1f;
+
+// Without layered shadows, faces are rendered into a pool of offscreen targets and copied into the cube
+// map array in batches of this size
+const int NUM_OFFSCREEN_TARGETS = NUM_CUBE_FACES;
+
+// Lights do not reach further than this. Has to match attenuationRadius in fragmentShader.frag
+const float LIGHT_ATTENUATION_RADIUS = 500.f;
+
+// How many frames the CPU is allowed to record ahead of the GPU
+const int DEFAULT_FRAMES_IN_FLIGHT = 2;
+const int MAX_FRAMES_IN_FLIGHT = 3;
+
+// Upper limit for the threads that record the scene pass in parallel
+const int MAX_RECORDING_THREADS = 16;
+
+// Size of the host visible blocks the upload batcher sub-allocates staging memory from
+const uint64_t STAGING_BLOCK_SIZE = 8 * 1024 * 1024;
+
+// Default size of the blocks the device memory allocator carves buffers and images out of
+const uint64_t DEVICE_MEMORY_BLOCK_SIZE = 64 * 1024 * 1024;
 
 const int INDEX_OFFSET_BEFORE_GHOST = 2;
 